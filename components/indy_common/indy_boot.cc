@@ -0,0 +1,42 @@
+#include "indy_boot.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <cinttypes>
+
+namespace {
+  const char *TAG = "indy_boot";
+
+  const char* const PHASE_NAMES[] = {
+    "setup_started", "nvs_loaded", "relay_restored", "wifi_started", "mdns_started", "config_loaded",
+    "wifi_connected", "mqtt_started", "time_started", "mqtt_ready", "time_synced", "scheduler_ready",
+  };
+  static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) == static_cast<size_t>(IndyBootPhase::COUNT),
+    "Each IndyBootPhase needs a name");
+}
+
+// Records that `phase` has finished, unless it already has
+void IndyBootTimeline::Record(IndyBootPhase phase) {
+  unsigned int now = (unsigned int) esp_timer_get_time();
+  unsigned int expected = 0;
+  size_t index = static_cast<size_t>(phase);
+  if (atomic_compare_exchange_strong(&times[index], &expected, now))
+    ESP_LOGI(TAG, "Boot phase %s finished at %u us", PHASE_NAMES[index], now);
+}
+
+// Returns when `phase` finished, in microseconds since boot, or 0 if it hasn't
+int64_t IndyBootTimeline::GetTime(IndyBootPhase phase) {
+  return atomic_load(&times[static_cast<size_t>(phase)]);
+}
+
+// Returns JSON with the time each finished phase finished, in microseconds since boot
+cJSON* IndyBootTimeline::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  for (size_t ii = 0; ii < times.size(); ii++) {
+    unsigned int time = atomic_load(&times[ii]);
+    if (time != 0)
+      cJSON_AddNumberToObject(json, PHASE_NAMES[ii], time);
+  }
+  return json;
+}
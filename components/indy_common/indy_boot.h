@@ -0,0 +1,55 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_BOOT_H_
+#define COMPONENTS_INDY_COMMON_INDY_BOOT_H_
+
+#include <cJSON.h>
+#include <stdatomic.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Boot phases, in the order they usually finish
+enum class IndyBootPhase {
+  SETUP_STARTED,
+  NVS_LOADED,
+  RELAY_RESTORED,
+  WIFI_STARTED,
+  MDNS_STARTED,
+  CONFIG_LOADED,
+  WIFI_CONNECTED,
+  MQTT_STARTED,
+  TIME_STARTED,
+  MQTT_READY,
+  TIME_SYNCED,
+  SCHEDULER_READY,
+  COUNT,  // Number of phases
+};
+
+// Records when each boot phase finished, in microseconds since boot. Phases
+// run on several tasks at once, so each is recorded the first time it
+// finishes, whichever task that's on.
+class IndyBootTimeline {
+ public:
+  static IndyBootTimeline& GetInstance() {
+    static IndyBootTimeline instance;
+    return instance;
+  }
+
+  void Record(IndyBootPhase phase);
+  int64_t GetTime(IndyBootPhase phase);
+
+  cJSON* CreateJson();  // Caller owns returned memory
+
+ private:
+  IndyBootTimeline() {}
+
+  // Microseconds since boot, as 32 bits so they can be atomic, or 0 if the
+  // phase hasn't finished
+  std::array<atomic_uint, static_cast<size_t>(IndyBootPhase::COUNT)> times = {};
+
+  // Prevent copy and assignment since IndyBootTimeline is a singleton.
+  IndyBootTimeline(const IndyBootTimeline&) = delete;
+  IndyBootTimeline& operator=(const IndyBootTimeline&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_BOOT_H_
@@ -1,79 +1,186 @@
 #include "indy_button.h"
 
-#include <driver/gpio.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/portmacro.h>
-#include <freertos/task.h>
-#include <FreeRTOSConfig.h>
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <cinttypes>
 
 #include "indy_config.h"
-#include "indy_util.h"
+#include "indy_rtos.h"
 
-// Notify the button task that there's been a change on the GPIO pin for this button
-void IndyButton::ButtonHandlerISR(void *arg) {
-  ESP_ERROR_CHECK(gpio_intr_disable(BUTTON_GPIO));  // Ignore additional changes while handling this change
-  IndyButton* button = reinterpret_cast<IndyButton*>(arg);
-  button->task.TaskNotifyGiveFromISR();
+namespace {
+  const char *TAG = "indy_button";
+
+  const char* const GESTURE_NAMES[] = { "short", "long", "double" };
 }
 
-// Returns the state of `pin` when the pin is stable.
-int debounce(gpio_num_t pin) {
-  TickType_t debounce_delay = pdMS_TO_TICKS(50);  // Debounce time in milliseconds
+// Sets up the IndyButton, and starts watching the pin
+void IndyButton::Setup() {
+  // Create the button task, the queue of pin changes for it, and the gesture timer
+  edges.Setup();
+  gesture_timer = IndyRtos::CreateTimer("ButtonGesture", 1, pdFALSE, this, GestureTimerCallback,
+    &gesture_timer_buffer);
+  if (gesture_timer == nullptr) {
+    ESP_LOGE(TAG, "Create gesture timer failed");
+    abort();
+  }
+  task.CreateTask(TaskFunction, this);
 
-  // Initialize debounce
-  int pin_state = gpio_get_level(pin);
-  int last_pin_state = pin_state;
-  TickType_t last_debounce_time = xTaskGetTickCount();
+  // Watch the pin
+  StartPin();
+}
 
-  while (1) {
-    // What's the pin state now?
-    pin_state = gpio_get_level(pin);
+// Handles pin changes and gesture timeouts
+void IndyButton::TaskFunction(void *arg) {
+  IndyButton* button = reinterpret_cast<IndyButton*>(arg);
+  button->HandleEvents();
+}
 
-    // Did the state change?
-    if (pin_state != last_pin_state) {
-      // The state changed. Start waiting again
-      last_debounce_time = xTaskGetTickCount();
-      last_pin_state = pin_state;
-    } else {
-      // The state didn't change. Is it stable?
-      if ((xTaskGetTickCount() - last_debounce_time) > debounce_delay) {
-        return pin_state;
+// Posts a debounced change of the pin to `level` to the button task. A press
+// is offered to the fast press handlers first. `time` is when the pin first
+// changed.
+void IndyButton::PostLevel(int level, int64_t time) {
+  bool handled = false;
+  if (level == 0) {  // Low means pressed.
+    for (const FastPressHandler& handler : fast_press_handlers) {
+      if (handler(time)) {
+        handled = true;
+        break;
       }
     }
-
-    // Wait for next check.
-    vTaskDelay(pdMS_TO_TICKS(5));  // Wait time in milliseconds
   }
+  if (!edges.Post({ level, time, handled }))
+    ESP_LOGE(TAG, "Button edge dropped");
 }
 
-// Notifies button handlers if the button is pressed
-void IndyButton::TaskFunction(void *arg) {
-  bool is_pressed = debounce(BUTTON_GPIO) == 0;  // Read pin state. Low means pressed.
-  if (is_pressed) {
-    // Call button press handlers
-    IndyButton* button = reinterpret_cast<IndyButton*>(arg);
-    for (const ButtonPressHandler& handler : button->handlers) {
+// Classifies debounced pin changes into gestures
+void IndyButton::HandleEvents() {
+  task_wakeups++;
+  edges.Drain([this](const IndyButtonEdge& edge) {
+    if (edge.level == 0)  // Low means pressed.
+      HandlePress(edge);
+    else
+      HandleRelease();
+  });
+  if (gesture_deadline != 0 && esp_timer_get_time() >= gesture_deadline)
+    HandleGestureTimeout();
+}
+
+// Starts a gesture, or completes a double press
+void IndyButton::HandlePress(const IndyButtonEdge& edge) {
+  if (edge.handled) {
+    // A fast press handler already handled it. Finish any short press waiting
+    // to become a double press first.
+    if (gesture_state == GestureState::RELEASED) {
+      StopGestureTimer();
+      ReportGesture(IndyButtonGesture::SHORT_PRESS);
+    }
+    fast_presses++;
+    press_time = edge.time;
+    ReportGesture(IndyButtonGesture::SHORT_PRESS, false);
+    gesture_state = GestureState::HANDLED;
+    for (const ButtonPressHandler& handler : fast_press_done_handlers)
       handler();
+  } else if (gesture_state == GestureState::RELEASED) {
+    StopGestureTimer();
+    press_time = edge.time;
+    ReportGesture(IndyButtonGesture::DOUBLE_PRESS);
+    gesture_state = GestureState::HANDLED;
+  } else if (gesture_state == GestureState::IDLE) {
+    press_time = edge.time;
+    if (!HasHandlers(IndyButtonGesture::LONG_PRESS) && !HasHandlers(IndyButtonGesture::DOUBLE_PRESS)) {
+      // Nothing else this press could become, so don't wait for the release
+      ReportGesture(IndyButtonGesture::SHORT_PRESS);
+      gesture_state = GestureState::HANDLED;
+    } else {
+      gesture_state = GestureState::PRESSED;
+      if (HasHandlers(IndyButtonGesture::LONG_PRESS))
+        StartGestureTimer(BUTTON_LONG_PRESS_MS);
     }
   }
-  ESP_ERROR_CHECK(gpio_intr_enable(BUTTON_GPIO));  // Resume watching for pin changes
 }
 
-// Sets up the IndyButton
-void IndyButton::Setup() {
-  // Configure BUTTON_GPIO pin for input
-  gpio_config_t io_conf;
-  io_conf.intr_type = GPIO_INTR_ANYEDGE;       // Watch for button presses
-  io_conf.mode = GPIO_MODE_INPUT;              // Input mode
-  io_conf.pin_bit_mask = 1ULL << BUTTON_GPIO;  // GPIO pin mask
-  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-  io_conf.pull_up_en = GPIO_PULLUP_ENABLE;     // Enable internal pull-up resistor
-  ESP_ERROR_CHECK(gpio_config(&io_conf));
-
-  // Create the button task
-  task.CreateTask(TaskFunction, this);
+// Completes a short press, or waits to see if it becomes a double press
+void IndyButton::HandleRelease() {
+  if (gesture_state == GestureState::PRESSED) {
+    StopGestureTimer();
+    if (HasHandlers(IndyButtonGesture::DOUBLE_PRESS)) {
+      gesture_state = GestureState::RELEASED;
+      StartGestureTimer(BUTTON_DOUBLE_PRESS_MS);
+    } else {
+      ReportGesture(IndyButtonGesture::SHORT_PRESS);
+      gesture_state = GestureState::IDLE;
+    }
+  } else if (gesture_state == GestureState::HANDLED) {
+    gesture_state = GestureState::IDLE;
+  }
+}
+
+// Completes a long press while the button is held, or a short press once the
+// double press window has closed
+void IndyButton::HandleGestureTimeout() {
+  gesture_deadline = 0;
+  if (gesture_state == GestureState::PRESSED) {
+    ReportGesture(IndyButtonGesture::LONG_PRESS);
+    gesture_state = GestureState::HANDLED;
+  } else if (gesture_state == GestureState::RELEASED) {
+    ReportGesture(IndyButtonGesture::SHORT_PRESS);
+    gesture_state = GestureState::IDLE;
+  }
+}
+
+// Counts `gesture`, and calls its handlers if `call_handlers` is set
+void IndyButton::ReportGesture(IndyButtonGesture gesture, bool call_handlers) {
+  int index = static_cast<int>(gesture);
+  int64_t latency_us = esp_timer_get_time() - press_time;
+  gesture_counts[index]++;
+  latency.Add(latency_us);
+  ESP_LOGI(TAG, "Button %s press, %" PRId64 " us after the press started", GESTURE_NAMES[index], latency_us);
+  if (!call_handlers)
+    return;
+  for (const ButtonPressHandler& handler : handlers[index]) {
+    handler();
+  }
+}
+
+// Starts the gesture timer to wake the task in `ms` milliseconds
+void IndyButton::StartGestureTimer(uint32_t ms) {
+  gesture_deadline = esp_timer_get_time() + (int64_t) ms * 1000;
+  // Add a tick so the timer doesn't fire before the deadline
+  if (xTimerChangePeriod(gesture_timer, pdMS_TO_TICKS(ms) + 1, 0) != pdPASS)
+    ESP_LOGE(TAG, "Failed to start gesture timer");
+}
+
+// Stops the gesture timer
+void IndyButton::StopGestureTimer() {
+  gesture_deadline = 0;
+  xTimerStop(gesture_timer, 0);
+}
 
-  // Install the interrupt handler that watches for button presses
-  ESP_ERROR_CHECK(gpio_install_isr_service(0));
-  ESP_ERROR_CHECK(gpio_isr_handler_add(BUTTON_GPIO, ButtonHandlerISR, this));
+// Wakes the task to handle a gesture timeout
+void IndyButton::GestureTimerCallback(TimerHandle_t timer) {
+  IndyButton* button = reinterpret_cast<IndyButton*>(pvTimerGetTimerID(timer));
+  button->task.TaskNotifyGive();
+}
+
+// Returns JSON with gesture counts, latency from press to handler, and how
+// often the ISR, debounce timer and task woke up per gesture
+cJSON* IndyButton::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  uint32_t gestures = 0;
+  for (int ii = 0; ii < GESTURE_COUNT; ii++) {
+    cJSON_AddNumberToObject(json, GESTURE_NAMES[ii], gesture_counts[ii]);
+    gestures += gesture_counts[ii];
+  }
+  cJSON_AddNumberToObject(json, "fast", fast_presses);
+  cJSON_AddItemToObject(json, "latency_us", latency.CreateJson());
+  cJSON_AddNumberToObject(json, "isr_wakeups", isr_wakeups);
+  cJSON_AddNumberToObject(json, "timer_wakeups", timer_wakeups);
+  cJSON_AddNumberToObject(json, "task_wakeups", task_wakeups);
+  if (gestures > 0) {
+    cJSON_AddNumberToObject(json, "wakeups_per_gesture",
+      static_cast<double>(isr_wakeups + timer_wakeups + task_wakeups) / gestures);
+  }
+  return json;
 }
@@ -1,30 +1,136 @@
 #ifndef COMPONENTS_INDY_COMMON_INDY_BUTTON_H_
 #define COMPONENTS_INDY_COMMON_INDY_BUTTON_H_
 
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <sdkconfig.h>
+
+#include <array>
+#include <cstdint>
 #include <functional>
+#include <string>
 #include <vector>
 
+#include "indy_config.h"
+#include "indy_gpio.h"
+#include "indy_histogram.h"
 #include "indy_task.h"
+#include "indy_work_queue.h"
+
+struct esp_timer;
+
+// Gestures recognized by IndyButton
+enum class IndyButtonGesture {
+  SHORT_PRESS,
+  LONG_PRESS,    // Held for BUTTON_LONG_PRESS_MS
+  DOUBLE_PRESS,  // Pressed again within BUTTON_DOUBLE_PRESS_MS of release
+  COUNT
+};
 
-// Manages a button attached to a GPIO pin
+// A debounced change of the button's GPIO pin, posted to the button task
+struct IndyButtonEdge {
+  int level;     // Pin level after the change. Low means pressed.
+  int64_t time;  // When the pin first changed, in microseconds since boot
+  bool handled;  // Whether a fast press handler handled the press
+};
+
+// Manages a button attached to a GPIO pin. Pin changes are debounced by a
+// timer rather than by polling, and the button's task classifies presses into
+// gestures and calls the handlers registered for them. When only short press
+// handlers are registered, they're called as soon as the button is pressed.
+// Otherwise a short press is reported once it can't become a long or double
+// press.
 class IndyButton {
  public:
+  IndyButton(gpio_num_t pin, const std::string& task_name) : pin(pin), task(task_name, BUTTON_TASK_CONFIG) {}
+
   void Setup();
 
-  // Button press handlers
+  // Gesture handlers. Register before Setup.
   using ButtonPressHandler = std::function<void()>;
-  void RegisterButtonPressHandler(const ButtonPressHandler& handler) { handlers.push_back(handler); }
+  void RegisterGestureHandler(IndyButtonGesture gesture, const ButtonPressHandler& handler) {
+    handlers[static_cast<int>(gesture)].push_back(handler);
+  }
+
+  // Fast press handlers, which are called on the debounce timer's task as
+  // soon as a press is confirmed, with when the press started. They must not
+  // block. If one returns true, the press is counted as a short press, and
+  // short press handlers aren't called for it. Instead, fast press done
+  // handlers are called on the button task, to finish work that can block.
+  // Register before Setup.
+  using FastPressHandler = std::function<bool(int64_t press_time)>;
+  void RegisterFastPressHandler(const FastPressHandler& handler) { fast_press_handlers.push_back(handler); }
+  void RegisterFastPressDoneHandler(const ButtonPressHandler& handler) { fast_press_done_handlers.push_back(handler); }
+
+  cJSON* CreateJson();  // Caller owns returned memory
 
  private:
-  // ISR
+  // Watching the pin, which is implemented by indy_button_pin.cc on the ESP32
+  // and indy_button_pin_host.cc on Linux hosts
+  gpio_num_t pin;
+  void StartPin();
+  int last_level = 1;  // Debounced pin level
+  void PostLevel(int level, int64_t time);
+
+#if !CONFIG_IDF_TARGET_LINUX
+  // Debounce, where the ISR starts the debounce timer on the first edge and
+  // the timer posts the pin level once it's been quiet for the debounce time
   static void ButtonHandlerISR(void *arg);
+  static void DebounceTimerCallback(void *arg);
+  esp_timer* debounce_timer = nullptr;
+  portMUX_TYPE debounce_spinlock = portMUX_INITIALIZER_UNLOCKED;
+  bool debouncing = false;       // Guarded by debounce_spinlock
+  int64_t first_edge_time = 0;   // Guarded by debounce_spinlock
+  int64_t last_edge_time = 0;    // Guarded by debounce_spinlock
+#endif
 
   // Task
-  IndyTask task = IndyTask("ButtonTask");
+  IndyTask task;
   static void TaskFunction(void *arg);
+  void HandleEvents();
+
+  // Debounced pin changes waiting to be handled
+  static const UBaseType_t EDGES_MAX = 8;
+  IndyWorkQueue<IndyButtonEdge, EDGES_MAX> edges{&task};
+
+  // Gesture state, which is only used by the button task
+  enum class GestureState {
+    IDLE,      // Released
+    PRESSED,   // Pressed, and waiting to see if it's a long press
+    HANDLED,   // Pressed, and the gesture has been reported
+    RELEASED,  // Released after a press, and waiting to see if it's a double press
+  };
+  GestureState gesture_state = GestureState::IDLE;
+  int64_t press_time = 0;
+  void HandlePress(const IndyButtonEdge& edge);
+  void HandleRelease();
+  void HandleGestureTimeout();
+  void ReportGesture(IndyButtonGesture gesture, bool call_handlers = true);
+  bool HasHandlers(IndyButtonGesture gesture) const { return !handlers[static_cast<int>(gesture)].empty(); }
+
+  // Timer that wakes the task when a press becomes long, or the double press
+  // window closes
+  TimerHandle_t gesture_timer = nullptr;
+  StaticTimer_t gesture_timer_buffer;
+  int64_t gesture_deadline = 0;  // Microseconds since boot, or 0 if not running
+  void StartGestureTimer(uint32_t ms);
+  void StopGestureTimer();
+  static void GestureTimerCallback(TimerHandle_t timer);
+
+  // Gesture handlers
+  static const int GESTURE_COUNT = static_cast<int>(IndyButtonGesture::COUNT);
+  std::array<std::vector<ButtonPressHandler>, GESTURE_COUNT> handlers;
+  std::vector<FastPressHandler> fast_press_handlers;
+  std::vector<ButtonPressHandler> fast_press_done_handlers;
 
-  // Button press handlers
-  std::vector<ButtonPressHandler> handlers;
+  // Stats. Wakeups count each time the ISR, debounce timer and task run.
+  std::array<uint32_t, GESTURE_COUNT> gesture_counts = {};
+  IndyHistogram latency;  // From the first edge of the press to calling handlers, in microseconds
+  uint32_t isr_wakeups = 0;
+  uint32_t timer_wakeups = 0;
+  uint32_t task_wakeups = 0;
+  uint32_t fast_presses = 0;
 };
 
 #endif  //  COMPONENTS_INDY_COMMON_INDY_BUTTON_H_
@@ -0,0 +1,94 @@
+#include "indy_button.h"
+
+#include <driver/gpio.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#include "indy_config.h"
+
+// ESP32 button pin, debounced with an esp_timer started from the ISR
+
+namespace {
+  // How long the pin must be quiet before its level is taken. Contact bounce
+  // settles within a few milliseconds, and this is most of the time from press
+  // to relay on the fast path.
+  const int64_t DEBOUNCE_US = 20 * 1000;
+
+  bool isr_service_installed = false;
+}
+
+// Starts the debounce timer on the first edge of a change, and records the
+// time of the latest edge so the timer can wait for the pin to be quiet
+void IndyButton::ButtonHandlerISR(void *arg) {
+  IndyButton* button = reinterpret_cast<IndyButton*>(arg);
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL_ISR(&button->debounce_spinlock);
+  button->isr_wakeups++;
+  button->last_edge_time = now;
+  bool start = !button->debouncing;
+  if (start) {
+    button->debouncing = true;
+    button->first_edge_time = now;
+  }
+  portEXIT_CRITICAL_ISR(&button->debounce_spinlock);
+  if (start)
+    esp_timer_start_once(button->debounce_timer, DEBOUNCE_US);
+}
+
+// Posts the pin level once the pin has been quiet for DEBOUNCE_US, if the
+// level has changed. Bounces back to the same level are ignored.
+void IndyButton::DebounceTimerCallback(void *arg) {
+  IndyButton* button = reinterpret_cast<IndyButton*>(arg);
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&button->debounce_spinlock);
+  button->timer_wakeups++;
+  int64_t quiet_us = now - button->last_edge_time;
+  int64_t first_edge_time = button->first_edge_time;
+  bool is_quiet = quiet_us >= DEBOUNCE_US;
+  if (is_quiet)
+    button->debouncing = false;
+  portEXIT_CRITICAL(&button->debounce_spinlock);
+
+  // Wait out the rest of the debounce time if the pin changed since the timer started
+  if (!is_quiet) {
+    esp_timer_start_once(button->debounce_timer, DEBOUNCE_US - quiet_us);
+    return;
+  }
+
+  int level = gpio_get_level(button->pin);
+  if (level == button->last_level)
+    return;
+  button->last_level = level;
+  button->PostLevel(level, first_edge_time);
+}
+
+// Configures the pin and starts watching it
+void IndyButton::StartPin() {
+  // Configure pin for input
+  gpio_config_t io_conf;
+  io_conf.intr_type = GPIO_INTR_ANYEDGE;       // Watch for button presses
+  io_conf.mode = GPIO_MODE_INPUT;              // Input mode
+  io_conf.pin_bit_mask = 1ULL << pin;          // GPIO pin mask
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_conf.pull_up_en = GPIO_PULLUP_ENABLE;     // Enable internal pull-up resistor
+  ESP_ERROR_CHECK(gpio_config(&io_conf));
+  last_level = gpio_get_level(pin);
+
+  // Create the debounce timer
+  const esp_timer_create_args_t timer_args = {
+    .callback = DebounceTimerCallback,
+    .arg = this,
+    .dispatch_method = ESP_TIMER_TASK,
+    .name = "ButtonDebounce",
+    .skip_unhandled_events = false,
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &debounce_timer));
+
+  // Install the interrupt handler that watches for button presses. The ISR
+  // service is shared by every button.
+  if (!isr_service_installed) {
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    isr_service_installed = true;
+  }
+  ESP_ERROR_CHECK(gpio_isr_handler_add(pin, ButtonHandlerISR, this));
+}
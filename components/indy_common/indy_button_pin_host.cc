@@ -0,0 +1,22 @@
+#include "indy_button.h"
+
+#include <esp_timer.h>
+
+#include "indy_config.h"
+#include "indy_host_gpio.h"
+
+// Host button pin, which is a simulated pin. Simulated pins don't bounce, so
+// there's no debouncing.
+
+// Starts watching the simulated pin
+void IndyButton::StartPin() {
+  IndyHostGpio& gpio = IndyHostGpio::GetInstance();
+  last_level = gpio.GetLevel(pin);
+  gpio.RegisterChangeHandler(pin, [this, &gpio]() {
+    int level = gpio.GetLevel(pin);
+    if (level == last_level)
+      return;
+    last_level = level;
+    PostLevel(level, esp_timer_get_time());
+  });
+}
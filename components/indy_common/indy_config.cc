@@ -1,31 +1,148 @@
 #include "indy_config.h"
 
 #include <FreeRTOSConfig.h>
-#include <driver/gpio.h>
+
+#include <cstdlib>
+
+#include "indy_gpio.h"
 
 //#define CONFIG_DEVKITC
 #define CONFIG_LILYGO_T7
 
-//const char* const HOSTNAME = "esp-vorona";
-const char* const HOSTNAME = "esp-hollanda";
+namespace {
+  //const char* const DEVICE_HOSTNAME = "esp-vorona";
+  const char* const DEVICE_HOSTNAME = "esp-hollanda";
+
+#if CONFIG_IDF_TARGET_LINUX
+  // Returns the hostname for a Linux host, which the INDY_HOSTNAME environment
+  // variable overrides, so two instances on one host can follow each other
+  const char* GetHostHostname() {
+    const char* hostname = getenv("INDY_HOSTNAME");
+    return hostname != nullptr && hostname[0] != '\0' ? hostname : DEVICE_HOSTNAME;
+  }
+#endif
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+const char* const HOSTNAME = GetHostHostname();
+#else
+const char* const HOSTNAME = DEVICE_HOSTNAME;
+#endif
 
+// Relay, LED and button pins of each channel. Use GPIO_NUM_NC for a channel
+// without an LED or button.
 #ifdef CONFIG_DEVKITC
-const gpio_num_t BUTTON_GPIO = GPIO_NUM_16;
-const gpio_num_t LED_GPIO = GPIO_NUM_17;
-const gpio_num_t RELAY_GPIO = GPIO_NUM_21;
+const IndyChannelConfig CHANNEL_CONFIGS[INDY_CHANNEL_COUNT] = {
+  { GPIO_NUM_21, GPIO_NUM_17, GPIO_NUM_16 },
+};
 #elif defined(CONFIG_LILYGO_T7)
-const gpio_num_t BUTTON_GPIO = GPIO_NUM_25;
-const gpio_num_t LED_GPIO = GPIO_NUM_27;
-const gpio_num_t RELAY_GPIO = GPIO_NUM_21;
+const IndyChannelConfig CHANNEL_CONFIGS[INDY_CHANNEL_COUNT] = {
+  { GPIO_NUM_21, GPIO_NUM_27, GPIO_NUM_25 },
+};
 #else
 #error "No device configured"
 #endif
 
 const char* const MQTT_BROKER = "mqtts://elias.alexan.org:8883";  // The MQTT broker address
 
+// Acks for messages to topics shared by many devices, such as group topics,
+// are collected by each device for the window and published as one batch per
+// device. Each device waits a random time up to the spread on top, so a
+// fleet's batches don't reach the broker at once. Acks from different devices
+// aren't combined.
+const uint32_t SHARED_ACK_WINDOW_MS = 500;
+const uint32_t SHARED_ACK_SPREAD_MS = 1000;
+
+// Switch state changes are multicast to peers on the LAN. Each change is sent
+// several times, a few milliseconds apart, since multicast over wifi isn't
+// acknowledged. The receive timeout bounds how long the receive task takes to
+// notice a restart. Peers are announced over mDNS as the service below.
+const char* const PEER_MULTICAST_ADDRESS = "239.255.73.83";
+const uint16_t PEER_PORT = 7383;
+const int PEER_SEND_COUNT = 3;
+const uint32_t PEER_REPEAT_MS = 10;
+const uint32_t PEER_RECEIVE_TIMEOUT_MS = 100;
+const char* const PEER_MDNS_SERVICE = "_indy-peer";
+const char* const PEER_MDNS_PROTO = "_udp";
+
 const bool USE_SNTP = true;  // Whether to use the SNTP service
 const char* const SNTP_TIME_SERVER = "pool.ntp.org";  // Which SNTP server to sync with
 
+// Wifi reconnect backoff. The delay before each reconnect attempt doubles from
+// the minimum up to the maximum, and a random delay of up to half of it is
+// taken off so devices behind the same router don't reconnect in step.
+const uint32_t WIFI_RECONNECT_MIN_MS = 1000;
+const uint32_t WIFI_RECONNECT_MAX_MS = 60000;
+
+// Button gestures. A press held this long is a long press, and a press this
+// soon after a release is a double press.
+const uint32_t BUTTON_LONG_PRESS_MS = 1000;
+const uint32_t BUTTON_DOUBLE_PRESS_MS = 300;
+
+// How long the status LED takes to fade between on and off. 0 switches it
+// straight away.
+const uint32_t STATUS_LED_FADE_MS = 250;
+
+// Switch commands from MQTT and the schedule. Commands that arrive within the
+// coalescing window of the one before are held, and only the last of them
+// takes effect. A relay stays on or off for at least the dwell time before a
+// command changes it again. Button presses aren't held.
+const uint32_t SWITCH_COALESCE_MS = 250;
+const uint32_t SWITCH_MIN_DWELL_MS = 1000;
+
+// How often the switch history and daily usage are saved to NVS, if they've
+// changed. The history in RTC memory survives restarts, and both are saved
+// before a restart, so this only limits what power loss loses.
+const uint32_t RECORDS_SAVE_MS = 60 * 60 * 1000;
+
+// Whether state is written to the journal by the journal task, rather than by
+// the task that changed it
+const bool JOURNAL_WRITE_ASYNC = true;
+
+// Whether the work of IndyTasks marked for dispatch is done by one dispatcher
+// task, rather than each having its own task and stack. Off by default: the
+// dispatcher saves stack RAM, but runs button and scheduler work one after
+// another at one priority.
+const bool USE_TASK_DISPATCHER = false;
+
+// FreeRTOS task settings. Wifi, lwIP and MQTT are pinned to core 0 in
+// sdkconfig, so control and scheduling run on core 1 at a higher priority,
+// where TLS work can't delay them. The journal runs below the control tasks so
+// flash writes don't hold up the relay, and is never dispatched, since the
+// dispatcher would run it at the control tasks' priority. Coroutines do
+// network setup, so they run with the network. Peer datagrams are received on
+// the control core, so a follower switches without waiting on the network
+// tasks.
+const BaseType_t NETWORK_CORE = 0;
+const BaseType_t CONTROL_CORE = 1;
+constexpr IndyTaskConfig BUTTON_TASK_CONFIG = { 4096, 10, CONTROL_CORE, true };
+constexpr IndyTaskConfig ACTUATOR_TASK_CONFIG = { 4096, 10, CONTROL_CORE, true };
+constexpr IndyTaskConfig SCHEDULER_TASK_CONFIG = { 6144, 10, CONTROL_CORE, true };
+constexpr IndyTaskConfig JOURNAL_TASK_CONFIG = { 4096, 5, CONTROL_CORE, false };
+constexpr IndyTaskConfig PUBLISH_TASK_CONFIG = { 8192, 5, NETWORK_CORE, false };
+constexpr IndyTaskConfig DISPATCHER_TASK_CONFIG = { 8192, 10, CONTROL_CORE, false };
+constexpr IndyTaskConfig COROUTINE_TASK_CONFIG = { 8192, 5, NETWORK_CORE, false };
+constexpr IndyTaskConfig PEER_RECEIVE_TASK_CONFIG = { 4096, 10, CONTROL_CORE, false };
+constexpr IndyTaskConfig PEER_SEND_TASK_CONFIG = { 4096, 5, NETWORK_CORE, false };
+
+// Check that the stack pool holds the stack of every task created: each task
+// that isn't dispatched, with a button and scheduler task for each channel,
+// and the dispatcher if it's used. IndyRtos rounds stacks up to 16 bytes.
+#ifdef INDY_STATIC_ALLOCATION
+namespace {
+  constexpr uint32_t GetStackBytes(const IndyTaskConfig& config) {
+    return USE_TASK_DISPATCHER && config.dispatch ? 0 : (config.stack_depth + 15) & ~15u;
+  }
+  constexpr uint32_t TASK_STACK_BYTES =
+    INDY_CHANNEL_COUNT * (GetStackBytes(BUTTON_TASK_CONFIG) + GetStackBytes(SCHEDULER_TASK_CONFIG)) +
+    GetStackBytes(ACTUATOR_TASK_CONFIG) + GetStackBytes(JOURNAL_TASK_CONFIG) + GetStackBytes(PUBLISH_TASK_CONFIG) +
+    GetStackBytes(COROUTINE_TASK_CONFIG) + GetStackBytes(PEER_RECEIVE_TASK_CONFIG) +
+    GetStackBytes(PEER_SEND_TASK_CONFIG) + (USE_TASK_DISPATCHER ? GetStackBytes(DISPATCHER_TASK_CONFIG) : 0);
+}
+static_assert(INDY_TASK_STACK_POOL_SIZE >= TASK_STACK_BYTES,
+  "INDY_TASK_STACK_POOL_SIZE is too small for the task stacks. Increase it.");
+#endif
+
 // The maximum time to wait for operations that should complete quickly
 const int MAX_WAIT_SECONDS = 10;
 const int MAX_WAIT = (MAX_WAIT_SECONDS * configTICK_RATE_HZ);  // ticks
@@ -1,22 +1,72 @@
 #ifndef COMPONENTS_INDY_COMMON_INDY_CONFIG_H_
 #define COMPONENTS_INDY_COMMON_INDY_CONFIG_H_
 
-#include <driver/gpio.h>
+#include "indy_gpio.h"
+#include "indy_task.h"
 
 #define VERSION_MAJOR 1
 #define VERSION_MINOR 2
 #define VERSION_PATCH 1
 
+// Create tasks, semaphores, queues and timers in storage reserved in .bss,
+// rather than on the heap. Comment out to use the heap.
+#define INDY_STATIC_ALLOCATION
+
+// Bytes reserved in .bss for task stacks, when INDY_STATIC_ALLOCATION is set.
+// Needs to hold the stacks of all tasks created, which indy_config.cc checks at
+// build time against the task settings: 36 KB with the dispatcher and 42 KB
+// without, plus 10 KB for each channel after the first. The pool keeps 2 KB
+// spare so a stack can grow a little without a change here.
+#define INDY_TASK_STACK_POOL_SIZE (44 * 1024)
+
+// Number of switch channels, each with its own relay, LED, button, state and
+// schedule. CHANNEL_CONFIGS in indy_config.cc needs an entry for each.
+#define INDY_CHANNEL_COUNT 1
+
+// Switch events kept in the history, at 4 bytes each in RTC memory
+#define INDY_HISTORY_EVENT_COUNT 256
+
+// Coroutine frame pool. The largest frame requested is reported in status, as
+// "coroutines"."frame_size_max".
+#define INDY_COROUTINE_FRAME_SIZE 1024
+#define INDY_COROUTINE_FRAME_COUNT 8
+
 extern const char* const WIFI_SSID;
 extern const char* const WIFI_PASSWORD;
 
+extern const uint32_t WIFI_RECONNECT_MIN_MS;
+extern const uint32_t WIFI_RECONNECT_MAX_MS;
+
 extern const char* const HOSTNAME;
 
-extern const gpio_num_t BUTTON_GPIO;
-extern const gpio_num_t LED_GPIO;
-extern const gpio_num_t RELAY_GPIO;
+// GPIO pins of a switch channel
+struct IndyChannelConfig {
+  gpio_num_t relay;
+  gpio_num_t led;
+  gpio_num_t button;
+};
+extern const IndyChannelConfig CHANNEL_CONFIGS[INDY_CHANNEL_COUNT];
+
+extern const uint32_t BUTTON_LONG_PRESS_MS;
+extern const uint32_t BUTTON_DOUBLE_PRESS_MS;
+
+extern const uint32_t STATUS_LED_FADE_MS;
+
+extern const uint32_t SWITCH_COALESCE_MS;
+extern const uint32_t SWITCH_MIN_DWELL_MS;
+extern const uint32_t RECORDS_SAVE_MS;
 
 extern const char* const MQTT_BROKER;
+extern const uint32_t SHARED_ACK_WINDOW_MS;
+extern const uint32_t SHARED_ACK_SPREAD_MS;
+
+extern const char* const PEER_MULTICAST_ADDRESS;
+extern const uint16_t PEER_PORT;
+extern const int PEER_SEND_COUNT;
+extern const uint32_t PEER_REPEAT_MS;
+extern const uint32_t PEER_RECEIVE_TIMEOUT_MS;
+extern const char* const PEER_MDNS_SERVICE;
+extern const char* const PEER_MDNS_PROTO;
 
 extern const char* const MQTT_USER;
 extern const char* const MQTT_PASSWORD;
@@ -24,6 +74,19 @@ extern const char* const MQTT_PASSWORD;
 extern const bool USE_SNTP;
 extern const char* const SNTP_TIME_SERVER;
 
+extern const bool JOURNAL_WRITE_ASYNC;
+extern const bool USE_TASK_DISPATCHER;
+
+extern const IndyTaskConfig BUTTON_TASK_CONFIG;
+extern const IndyTaskConfig ACTUATOR_TASK_CONFIG;
+extern const IndyTaskConfig SCHEDULER_TASK_CONFIG;
+extern const IndyTaskConfig JOURNAL_TASK_CONFIG;
+extern const IndyTaskConfig PUBLISH_TASK_CONFIG;
+extern const IndyTaskConfig DISPATCHER_TASK_CONFIG;
+extern const IndyTaskConfig COROUTINE_TASK_CONFIG;
+extern const IndyTaskConfig PEER_RECEIVE_TASK_CONFIG;
+extern const IndyTaskConfig PEER_SEND_TASK_CONFIG;
+
 extern const int MAX_WAIT;
 
 #endif  //  COMPONENTS_INDY_COMMON_INDY_CONFIG_H_
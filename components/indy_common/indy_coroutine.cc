@@ -0,0 +1,302 @@
+#include "indy_coroutine.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <utility>
+
+#include "indy_config.h"
+#include "indy_rtos.h"
+
+namespace {
+  const char *TAG = "indy_coroutine";
+}
+
+// Schedules a new coroutine to run on the coroutine task
+void IndyCoroutine::Start::await_suspend(std::coroutine_handle<> handle) noexcept {
+  IndyCoroutineRuntime::GetInstance().Schedule(handle);
+}
+
+// Allocates a coroutine frame from the pool. Returns nullptr if there isn't
+// one, so the coroutine doesn't start.
+void* IndyCoroutine::promise_type::operator new(std::size_t size) noexcept {
+  return IndyCoroutineRuntime::GetInstance().AllocateFrame(size);
+}
+
+// Returns a coroutine frame to the pool
+void IndyCoroutine::promise_type::operator delete(void* frame, std::size_t size) noexcept {
+  IndyCoroutineRuntime::GetInstance().FreeFrame(frame);
+}
+
+// Creates an IndyWait for `bits` of `events`, or for just `timeout` if
+// `events` is nullptr
+IndyWait::IndyWait(IndyAwaitableEvents* events, EventBits_t bits, bool wait_for_all, TickType_t timeout) {
+  waiter.events = events;
+  waiter.bits = bits;
+  waiter.wait_for_all = wait_for_all;
+  waiter.deadline = timeout == portMAX_DELAY ? 0 :
+    esp_timer_get_time() + (int64_t) timeout * portTICK_PERIOD_MS * 1000 + 1;
+  waiter.result = 0;
+}
+
+// Suspends the coroutine unless the wait is already over
+bool IndyWait::await_suspend(std::coroutine_handle<> handle) noexcept {
+  waiter.handle = handle;
+  return IndyCoroutineRuntime::GetInstance().AddWaiter(&waiter);
+}
+
+IndyWait IndyDelay(TickType_t ticks) {
+  return IndyWait(nullptr, 0, false, ticks);
+}
+
+// Sets `bits`, resuming coroutines that were waiting for them
+void IndyAwaitableEvents::Set(EventBits_t bits) {
+  IndyCoroutineRuntime::GetInstance().SetBits(this, bits);
+}
+
+// Clears `bits`
+void IndyAwaitableEvents::Clear(EventBits_t bits) {
+  IndyCoroutineRuntime::GetInstance().ClearBits(this, bits);
+}
+
+// Returns the bits that are set
+EventBits_t IndyAwaitableEvents::Get() {
+  return IndyCoroutineRuntime::GetInstance().GetBits(this);
+}
+
+// Creates the coroutine task, its queue, and the deadline timer
+IndyCoroutineRuntime::IndyCoroutineRuntime() {
+  mutex = IndyRtos::CreateMutex(&mutex_buffer);
+  if (mutex == nullptr) {
+    ESP_LOGE(TAG, "Create coroutine mutex failed");
+    abort();
+  }
+  timer = IndyRtos::CreateTimer("CoroutineTimer", 1, pdFALSE, this, TimerCallback, &timer_buffer);
+  if (timer == nullptr) {
+    ESP_LOGE(TAG, "Create coroutine timer failed");
+    abort();
+  }
+  ready.Setup();
+  task.CreateTask(TaskFunction, this);
+}
+
+// Queues `handle` to be resumed on the coroutine task
+void IndyCoroutineRuntime::Schedule(std::coroutine_handle<> handle) {
+  if (!ready.Post(std::move(handle)))
+    ESP_LOGE(TAG, "Ready queue is full. A coroutine was lost.");
+}
+
+// Expires waiters whose deadlines have passed, and resumes ready coroutines
+void IndyCoroutineRuntime::TaskFunction(void *arg) {
+  IndyCoroutineRuntime* runtime = reinterpret_cast<IndyCoroutineRuntime*>(arg);
+  runtime->ExpireWaiters();
+  runtime->ready.Drain([](std::coroutine_handle<>& handle) { handle.resume(); });
+}
+
+// Wakes the coroutine task when the earliest deadline passes
+void IndyCoroutineRuntime::TimerCallback(TimerHandle_t timer) {
+  IndyCoroutineRuntime* runtime = reinterpret_cast<IndyCoroutineRuntime*>(pvTimerGetTimerID(timer));
+  runtime->task.TaskNotifyGive();
+}
+
+// Returns a frame of at least `size` bytes, or nullptr if there isn't one
+void* IndyCoroutineRuntime::AllocateFrame(std::size_t size) {
+  void* frame = nullptr;
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to allocate frame");
+    return nullptr;
+  }
+  if (size > frame_size_max)
+    frame_size_max = size;
+  if (size <= INDY_COROUTINE_FRAME_SIZE) {
+    for (size_t ii = 0; ii < frame_used.size(); ii++) {
+      if (!frame_used[ii]) {
+        frame_used[ii] = true;
+        frame = frames[ii];
+        frames_used_count++;
+        if (frames_used_count > frames_used_max)
+          frames_used_max = frames_used_count;
+        break;
+      }
+    }
+  }
+  if (frame == nullptr)
+    frame_failures++;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after allocating frame");
+  if (frame == nullptr)
+    ESP_LOGE(TAG, "No coroutine frame for %d bytes. Frames are %d bytes and %d of %d are used.",
+      (int) size, INDY_COROUTINE_FRAME_SIZE, (int) frames_used_count, INDY_COROUTINE_FRAME_COUNT);
+  return frame;
+}
+
+// Returns `frame` to the pool
+void IndyCoroutineRuntime::FreeFrame(void* frame) {
+  size_t index = (reinterpret_cast<uint8_t*>(frame) - frames[0]) / INDY_COROUTINE_FRAME_SIZE;
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to free frame");
+    return;
+  }
+  frame_used[index] = false;
+  frames_used_count--;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after freeing frame");
+}
+
+// Returns whether `bits` end the wait of `waiter`
+bool IndyCoroutineRuntime::IsSatisfied(const IndyCoroutineWaiter& waiter, EventBits_t bits) {
+  if (waiter.events == nullptr)
+    return waiter.deadline == 0 || waiter.deadline <= esp_timer_get_time();
+  EventBits_t matched = bits & waiter.bits;
+  return waiter.wait_for_all ? matched == waiter.bits : matched != 0;
+}
+
+// Adds `waiter` to the waiting coroutines. Returns `false`, so the coroutine
+// carries on, if the wait is already over or there's no room to wait.
+bool IndyCoroutineRuntime::AddWaiter(IndyCoroutineWaiter* waiter) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to add waiter");
+    return false;
+  }
+  EventBits_t bits = waiter->events != nullptr ? waiter->events->bits : 0;
+  bool satisfied = IsSatisfied(*waiter, bits);
+  bool waiting = !satisfied && waiter_count < WAITERS_MAX;
+  if (waiting) {
+    waiters[waiter_count++] = waiter;
+    if (waiter_count > waiters_max)
+      waiters_max = waiter_count;
+    if (waiter->deadline != 0)
+      ArmTimer();
+  } else {
+    waiter->result = bits;
+  }
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after adding waiter");
+  if (!waiting && !satisfied)
+    ESP_LOGE(TAG, "Too many waiting coroutines. The wait ended early.");
+  return waiting;
+}
+
+// Removes the waiter at `index`. Caller must hold the lock.
+void IndyCoroutineRuntime::RemoveWaiter(size_t index) {
+  waiters[index] = waiters[--waiter_count];
+  waiters[waiter_count] = nullptr;
+}
+
+// Sets `bits` of `events`, and schedules the coroutines waiting for them
+void IndyCoroutineRuntime::SetBits(IndyAwaitableEvents* events, EventBits_t bits) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to set bits");
+    return;
+  }
+  events->bits |= bits;
+  for (size_t ii = 0; ii < waiter_count;) {
+    IndyCoroutineWaiter* waiter = waiters[ii];
+    if (waiter->events == events && IsSatisfied(*waiter, events->bits)) {
+      waiter->result = events->bits;
+      RemoveWaiter(ii);
+      Schedule(waiter->handle);
+    } else {
+      ii++;
+    }
+  }
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after setting bits");
+}
+
+// Clears `bits` of `events`
+void IndyCoroutineRuntime::ClearBits(IndyAwaitableEvents* events, EventBits_t bits) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to clear bits");
+    return;
+  }
+  events->bits &= ~bits;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after clearing bits");
+}
+
+// Returns the bits of `events` that are set
+EventBits_t IndyCoroutineRuntime::GetBits(IndyAwaitableEvents* events) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to get bits");
+    return 0;
+  }
+  EventBits_t bits = events->bits;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after getting bits");
+  return bits;
+}
+
+// Schedules the coroutines whose deadlines have passed
+void IndyCoroutineRuntime::ExpireWaiters() {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to expire waiters");
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  for (size_t ii = 0; ii < waiter_count;) {
+    IndyCoroutineWaiter* waiter = waiters[ii];
+    if (waiter->deadline != 0 && waiter->deadline <= now) {
+      waiter->result = waiter->events != nullptr ? waiter->events->bits : 0;
+      if (waiter->events != nullptr)
+        timeouts++;
+      RemoveWaiter(ii);
+      Schedule(waiter->handle);
+    } else {
+      ii++;
+    }
+  }
+  ArmTimer();
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after expiring waiters");
+}
+
+// Starts the timer for the earliest deadline, or stops it if there are no
+// deadlines. Caller must hold the lock.
+void IndyCoroutineRuntime::ArmTimer() {
+  int64_t earliest = 0;
+  for (size_t ii = 0; ii < waiter_count; ii++) {
+    int64_t deadline = waiters[ii]->deadline;
+    if (deadline != 0 && (earliest == 0 || deadline < earliest))
+      earliest = deadline;
+  }
+  if (earliest == 0) {
+    xTimerStop(timer, 0);
+    return;
+  }
+  int64_t wait_us = earliest - esp_timer_get_time();
+  TickType_t ticks = wait_us > 0 ? (TickType_t) (wait_us / 1000 / portTICK_PERIOD_MS) + 1 : 1;
+  if (xTimerChangePeriod(timer, ticks, 0) != pdPASS)
+    ESP_LOGE(TAG, "Failed to start coroutine timer");
+}
+
+// Returns JSON with frame pool use, waiters and timeouts
+cJSON* IndyCoroutineRuntime::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to create coroutines JSON");
+    return json;
+  }
+  cJSON_AddNumberToObject(json, "frame_size", INDY_COROUTINE_FRAME_SIZE);
+  cJSON_AddNumberToObject(json, "frame_size_max", frame_size_max);
+  cJSON_AddNumberToObject(json, "frames", INDY_COROUTINE_FRAME_COUNT);
+  cJSON_AddNumberToObject(json, "frames_used", frames_used_count);
+  cJSON_AddNumberToObject(json, "frames_used_max", frames_used_max);
+  cJSON_AddNumberToObject(json, "frame_failures", frame_failures);
+  cJSON_AddNumberToObject(json, "waiters", waiter_count);
+  cJSON_AddNumberToObject(json, "waiters_max", waiters_max);
+  cJSON_AddNumberToObject(json, "timeouts", timeouts);
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after creating coroutines JSON");
+  return json;
+}
+
+bool IndyCoroutineRuntime::Lock() {
+  // Acquire mutex
+  return xSemaphoreTake(mutex, MAX_WAIT) == pdTRUE;
+}
+
+bool IndyCoroutineRuntime::Unlock() {
+  // Release mutex
+  return xSemaphoreGive(mutex) == pdTRUE;
+}
@@ -0,0 +1,168 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_COROUTINE_H_
+#define COMPONENTS_INDY_COMMON_INDY_COROUTINE_H_
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+
+#include "indy_config.h"
+#include "indy_task.h"
+#include "indy_work_queue.h"
+
+class IndyAwaitableEvents;
+
+// The return type of coroutines run by the IndyCoroutineRuntime. A coroutine
+// starts on the coroutine task, and when it waits, its task moves on to other
+// coroutines until what it's waiting for happens. Nothing waits for a
+// coroutine to finish, and its frame is freed when it does. Frames come from a
+// fixed pool, so if the pool is used up the coroutine doesn't start.
+class IndyCoroutine {
+ public:
+  // Schedules the coroutine on the coroutine task, rather than running its
+  // first steps on the caller's task
+  struct Start {
+    bool await_ready() noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept;
+    void await_resume() noexcept {}
+  };
+
+  struct promise_type {
+    IndyCoroutine get_return_object() { return IndyCoroutine(true); }
+    static IndyCoroutine get_return_object_on_allocation_failure() { return IndyCoroutine(false); }
+    Start initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { abort(); }
+
+    static void* operator new(std::size_t size) noexcept;
+    static void operator delete(void* frame, std::size_t size) noexcept;
+  };
+
+  // Whether the coroutine was given a frame, and so will run
+  bool IsStarted() const { return started; }
+
+ private:
+  explicit IndyCoroutine(bool started) : started(started) {}
+  bool started;
+};
+
+// A coroutine waiting for event bits, a deadline, or both
+struct IndyCoroutineWaiter {
+  std::coroutine_handle<> handle;
+  IndyAwaitableEvents* events;  // nullptr when only waiting for the deadline
+  EventBits_t bits;
+  bool wait_for_all;
+  int64_t deadline;             // Microseconds since boot, or 0 to wait forever
+  EventBits_t result;           // Bits that were set when the wait ended
+};
+
+// Suspends a coroutine until event bits are set or a timeout passes. Use with
+// co_await, which returns the event bits that were set when the wait ended.
+class IndyWait {
+ public:
+  IndyWait(IndyAwaitableEvents* events, EventBits_t bits, bool wait_for_all, TickType_t timeout);
+
+  bool await_ready() noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> handle) noexcept;
+  EventBits_t await_resume() noexcept { return waiter.result; }
+
+ private:
+  IndyCoroutineWaiter waiter;
+};
+
+// Returns an IndyWait that suspends a coroutine for `ticks`
+IndyWait IndyDelay(TickType_t ticks);
+
+// Event bits that coroutines can wait for. Like a FreeRTOS event group, but
+// waiting suspends the coroutine rather than blocking its task. Bits may be set
+// from any task, but not from an ISR.
+class IndyAwaitableEvents {
+ public:
+  void Set(EventBits_t bits);
+  void Clear(EventBits_t bits);
+  EventBits_t Get();
+
+  // Waits for any of `bits`, or all of them when `wait_for_all` is set
+  IndyWait Wait(EventBits_t bits, bool wait_for_all = false, TickType_t timeout = portMAX_DELAY) {
+    return IndyWait(this, bits, wait_for_all, timeout);
+  }
+
+ private:
+  friend class IndyCoroutineRuntime;
+  EventBits_t bits = 0;  // Guarded by the runtime's mutex
+};
+
+// Runs coroutines on one task, the coroutine task. Coroutines that are ready
+// to run are queued to the task. Waiting coroutines are kept in a fixed table,
+// and one FreeRTOS timer wakes the task when the earliest deadline passes.
+class IndyCoroutineRuntime {
+ public:
+  static IndyCoroutineRuntime& GetInstance() {
+    static IndyCoroutineRuntime instance;
+    return instance;
+  }
+
+  void Schedule(std::coroutine_handle<> handle);
+
+  void* AllocateFrame(std::size_t size);
+  void FreeFrame(void* frame);
+
+  bool AddWaiter(IndyCoroutineWaiter* waiter);
+  void SetBits(IndyAwaitableEvents* events, EventBits_t bits);
+  void ClearBits(IndyAwaitableEvents* events, EventBits_t bits);
+  EventBits_t GetBits(IndyAwaitableEvents* events);
+
+  cJSON* CreateJson();  // Caller owns returned memory
+
+ private:
+  IndyCoroutineRuntime();
+
+  // Coroutine task, and the coroutines ready to run on it. Each coroutine is
+  // queued at most once, so there's room for a coroutine in every frame.
+  IndyTask task = IndyTask("CoroutineTask", COROUTINE_TASK_CONFIG);
+  IndyWorkQueue<std::coroutine_handle<>, INDY_COROUTINE_FRAME_COUNT> ready{&task};
+  static void TaskFunction(void *arg);
+
+  // Frame pool
+  alignas(16) uint8_t frames[INDY_COROUTINE_FRAME_COUNT][INDY_COROUTINE_FRAME_SIZE];
+  std::array<bool, INDY_COROUTINE_FRAME_COUNT> frame_used = {};
+
+  // Waiting coroutines, and the timer for their deadlines
+  static const size_t WAITERS_MAX = 16;
+  std::array<IndyCoroutineWaiter*, WAITERS_MAX> waiters = {};
+  size_t waiter_count = 0;
+  TimerHandle_t timer = nullptr;
+  StaticTimer_t timer_buffer;
+  static void TimerCallback(TimerHandle_t timer);
+  static bool IsSatisfied(const IndyCoroutineWaiter& waiter, EventBits_t bits);
+  void RemoveWaiter(size_t index);
+  void ExpireWaiters();
+  void ArmTimer();
+
+  // Mutex for locking frames, waiters and event bits
+  SemaphoreHandle_t mutex = nullptr;
+  StaticSemaphore_t mutex_buffer;
+  bool Lock();
+  bool Unlock();
+
+  // Stats
+  uint32_t frames_used_count = 0;
+  uint32_t frames_used_max = 0;
+  uint32_t frame_size_max = 0;
+  uint32_t frame_failures = 0;
+  uint32_t waiters_max = 0;
+  uint32_t timeouts = 0;
+
+  // Prevent copy and assignment since IndyCoroutineRuntime is a singleton.
+  IndyCoroutineRuntime(const IndyCoroutineRuntime&) = delete;
+  IndyCoroutineRuntime& operator=(const IndyCoroutineRuntime&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_COROUTINE_H_
@@ -0,0 +1,83 @@
+#include "indy_dispatcher.h"
+
+#include <esp_log.h>
+
+#include "indy_config.h"
+#include "indy_rtos.h"
+#include "indy_task.h"
+#include "indy_task_manager.h"
+
+namespace {
+  const char *TAG = "indy_dispatcher";
+}
+
+// Creates the dispatcher task and its queue
+IndyDispatcher::IndyDispatcher() {
+  queue = IndyRtos::CreateQueue(QUEUE_LENGTH, sizeof(IndyDispatcherEvent), queue_storage, &queue_buffer);
+  if (queue == nullptr) {
+    ESP_LOGE(TAG, "Create dispatcher queue failed");
+    abort();
+  }
+  running_bit = IndyTaskManager::GetInstance().AddRunningTask("DispatcherTask");
+  handle = IndyTask::CreateFreeRtosTask(DispatchLoop, "DispatcherTask", DISPATCHER_TASK_CONFIG, this, &task_buffer);
+}
+
+// Adds `task` to the tasks whose work is done by the dispatcher
+void IndyDispatcher::AddTask(IndyTask* task) {
+  task_count++;
+  task_stack_bytes += task->GetConfig().stack_depth;
+  ESP_LOGI(TAG, "Dispatching %s. Dispatcher has %" PRIu32 " tasks.", task->GetName().c_str(), task_count);
+}
+
+// Queues an event asking the dispatcher to call the function of `task`
+void IndyDispatcher::Post(IndyTask* task) {
+  IndyDispatcherEvent event = { task };
+  if (xQueueSend(queue, &event, 0) != pdTRUE) {
+    atomic_fetch_add(&dropped_count, 1);
+    ESP_LOGE(TAG, "Dispatcher queue is full. Dropped event for %s.", task->GetName().c_str());
+  }
+}
+
+// Queues an event from an ISR asking the dispatcher to call the function of `task`
+void IndyDispatcher::PostFromISR(IndyTask* task) {
+  IndyDispatcherEvent event = { task };
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+  if (xQueueSendFromISR(queue, &event, &xHigherPriorityTaskWoken) != pdTRUE)
+    atomic_fetch_add(&dropped_count, 1);
+  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+// Calls the function of the task for each event received, and ends when the
+// task manager says it's time to end
+void IndyDispatcher::DispatchLoop(void *arg) {
+  IndyDispatcher* dispatcher = reinterpret_cast<IndyDispatcher*>(arg);
+  IndyDispatcherEvent event;
+  while (1) {
+    // Wait for work
+    if (xQueueReceive(dispatcher->queue, &event, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    // Do work unless exiting
+    if (IndyTaskManager::GetInstance().Exiting())
+      break;
+    event.task->RunTaskFunction();
+    if (IndyTaskManager::GetInstance().Exiting())
+      break;
+  }
+
+  // End task
+  IndyTaskManager::GetInstance().EndRunningTask(dispatcher->running_bit);
+  vTaskDelete(nullptr);
+}
+
+// Returns JSON with the dispatcher's stats. Without the dispatcher each task
+// would have its own stack, so the RAM saved is the stacks of all the tasks
+// less the dispatcher's own stack.
+cJSON* IndyDispatcher::CreateJson() const {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "tasks", task_count);
+  int32_t saved = (int32_t) task_stack_bytes - (int32_t) DISPATCHER_TASK_CONFIG.stack_depth;
+  cJSON_AddNumberToObject(json, "stack_bytes_saved", saved);
+  cJSON_AddNumberToObject(json, "dropped", atomic_load(&dropped_count));
+  return json;
+}
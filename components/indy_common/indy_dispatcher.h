@@ -0,0 +1,68 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_DISPATCHER_H_
+#define COMPONENTS_INDY_COMMON_INDY_DISPATCHER_H_
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <stdatomic.h>
+
+#include <cstdint>
+
+class IndyTask;
+
+// An event posted to the dispatcher, asking it to call a task's function
+struct IndyDispatcherEvent {
+  IndyTask* task;
+};
+
+// Does the work of many IndyTasks on one FreeRTOS task, so each IndyTask
+// doesn't need its own stack. An IndyTask posts an event to the dispatcher's
+// queue when it's notified, and the dispatcher calls the task's function for
+// each event in the order they arrive.
+class IndyDispatcher {
+ public:
+  static IndyDispatcher& GetInstance() {
+    static IndyDispatcher instance;
+    return instance;
+  }
+
+  void AddTask(IndyTask* task);
+
+  void Post(IndyTask* task);
+  void PostFromISR(IndyTask* task);
+
+  cJSON* CreateJson() const;  // Caller owns returned memory
+
+  TaskHandle_t GetHandle() const { return handle; }
+  EventBits_t GetRunningBit() const { return running_bit; }
+
+  // Least free stack since the dispatcher task started, in bytes
+  uint32_t GetStackHighWaterMark() { return uxTaskGetStackHighWaterMark(handle); }
+
+ private:
+  IndyDispatcher();
+
+  // Dispatcher task, and its queue of events. Each task has at most one event
+  // queued at a time, so the queue only needs to be as long as the number of tasks.
+  static const UBaseType_t QUEUE_LENGTH = 16;
+  TaskHandle_t handle = nullptr;
+  StaticTask_t task_buffer;
+  EventBits_t running_bit = 0;  // Set by the task manager when the dispatcher task ends
+  QueueHandle_t queue = nullptr;
+  StaticQueue_t queue_buffer;
+  uint8_t queue_storage[QUEUE_LENGTH * sizeof(IndyDispatcherEvent)];
+  static void DispatchLoop(void *arg);
+
+  // Stats
+  uint32_t task_count = 0;
+  uint32_t task_stack_bytes = 0;  // Total stack the tasks would have had on their own
+  atomic_uint dropped_count = ATOMIC_VAR_INIT(0);  // Counted from tasks and ISRs
+
+  // Prevent copy and assignment since IndyDispatcher is a singleton.
+  IndyDispatcher(const IndyDispatcher&) = delete;
+  IndyDispatcher& operator=(const IndyDispatcher&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_DISPATCHER_H_
@@ -0,0 +1,22 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_GPIO_H_
+#define COMPONENTS_INDY_COMMON_INDY_GPIO_H_
+
+#include <sdkconfig.h>
+
+#if CONFIG_IDF_TARGET_LINUX
+// Linux hosts have no GPIO driver, so pins are simulated by IndyHostGpio. The
+// pin numbers match the ESP32's.
+typedef enum {
+  GPIO_NUM_NC = -1,
+  GPIO_NUM_0 = 0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5, GPIO_NUM_6, GPIO_NUM_7,
+  GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10, GPIO_NUM_11, GPIO_NUM_12, GPIO_NUM_13, GPIO_NUM_14, GPIO_NUM_15,
+  GPIO_NUM_16, GPIO_NUM_17, GPIO_NUM_18, GPIO_NUM_19, GPIO_NUM_20, GPIO_NUM_21, GPIO_NUM_22, GPIO_NUM_23,
+  GPIO_NUM_25 = 25, GPIO_NUM_26, GPIO_NUM_27, GPIO_NUM_28, GPIO_NUM_29, GPIO_NUM_30, GPIO_NUM_31,
+  GPIO_NUM_32, GPIO_NUM_33, GPIO_NUM_34, GPIO_NUM_35, GPIO_NUM_36, GPIO_NUM_37, GPIO_NUM_38, GPIO_NUM_39,
+  GPIO_NUM_MAX,
+} gpio_num_t;
+#else
+#include <driver/gpio.h>
+#endif
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_GPIO_H_
@@ -0,0 +1,34 @@
+#include "indy_histogram.h"
+
+#include <cJSON.h>
+
+#include <string>
+
+#include "indy_util.h"
+
+// Adds `value` to the histogram
+void IndyHistogram::Add(uint32_t value) {
+  int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+  buckets[bucket]++;
+  count++;
+  sum += value;
+  if (value > max)
+    max = value;
+}
+
+// Returns the histogram as JSON, with the count, mean and max, and the count
+// for each bucket that isn't empty keyed by the bucket's upper bound
+cJSON* IndyHistogram::CreateJson() const {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "count", count);
+  cJSON_AddNumberToObject(json, "mean", count > 0 ? sum / count : 0);
+  cJSON_AddNumberToObject(json, "max", max);
+  cJSON* buckets_json = cJSON_AddObjectToObject(json, "buckets");
+  for (int ii = 0; ii < BUCKET_COUNT; ii++) {
+    if (buckets[ii] > 0) {
+      std::string upper_bound = FormatString("<%llu", 1ULL << ii);
+      cJSON_AddNumberToObject(buckets_json, upper_bound.c_str(), buckets[ii]);
+    }
+  }
+  return json;
+}
@@ -0,0 +1,28 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_HISTOGRAM_H_
+#define COMPONENTS_INDY_COMMON_INDY_HISTOGRAM_H_
+
+#include <cJSON.h>
+
+#include <array>
+#include <cstdint>
+
+// Counts samples, such as latencies in microseconds, in power of two buckets
+class IndyHistogram {
+ public:
+  void Add(uint32_t value);
+
+  uint32_t GetCount() const { return count; }
+
+  cJSON* CreateJson() const;  // Caller owns returned memory
+
+ private:
+  // Bucket ii counts values less than 2^ii, and at least 2^(ii - 1)
+  static const int BUCKET_COUNT = 33;
+  std::array<uint32_t, BUCKET_COUNT> buckets = {};
+
+  uint32_t count = 0;
+  uint32_t max = 0;
+  uint64_t sum = 0;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_HISTOGRAM_H_
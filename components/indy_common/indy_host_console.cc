@@ -0,0 +1,134 @@
+#include "indy_host_console.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+#include "indy_config.h"
+#include "indy_host_gpio.h"
+#include "indy_rtos.h"
+
+namespace {
+  const char *TAG = "indy_host_console";
+
+  // How often stdin is checked for commands, and how long a press lasts by
+  // default
+  const uint32_t POLL_MS = 10;
+  const uint32_t PRESS_MS = 100;
+}
+
+// Starts polling stdin for commands
+void IndyHostConsole::Start() {
+  timer = IndyRtos::CreateTimer("HostConsole", pdMS_TO_TICKS(POLL_MS), pdTRUE, this, TimerCallback, &timer_buffer);
+  if (timer == nullptr) {
+    ESP_LOGE(TAG, "Create host console timer failed");
+    abort();
+  }
+  if (xTimerStart(timer, 0) == pdFAIL)
+    ESP_LOGE(TAG, "Unable to start host console timer");
+  ESP_LOGI(TAG, "Reading commands from stdin");
+}
+
+void IndyHostConsole::TimerCallback(TimerHandle_t timer) {
+  reinterpret_cast<IndyHostConsole*>(pvTimerGetTimerID(timer))->Poll();
+}
+
+// Releases a held button once its time is up, and handles any commands that
+// have arrived
+void IndyHostConsole::Poll() {
+  if (pressed_pin != GPIO_NUM_NC && esp_timer_get_time() >= release_time)
+    Release();
+  if (!input_closed)
+    ReadInput();
+}
+
+// Reads whatever stdin has without waiting, and handles each complete line
+void IndyHostConsole::ReadInput() {
+  struct pollfd poll_fd = { STDIN_FILENO, POLLIN, 0 };
+  while (poll(&poll_fd, 1, 0) > 0) {
+    char buffer[128];
+    ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length <= 0) {
+      ESP_LOGI(TAG, "Stdin closed");
+      input_closed = true;
+      return;
+    }
+    input.append(buffer, length);
+  }
+
+  size_t end;
+  while ((end = input.find('\n')) != std::string::npos) {
+    std::string line = input.substr(0, end);
+    input.erase(0, end + 1);
+    HandleCommand(line);
+  }
+}
+
+// Handles one command line
+void IndyHostConsole::HandleCommand(const std::string& line) {
+  std::istringstream stream(line);
+  std::string command;
+  if (!(stream >> command))
+    return;
+
+  if (command == "press") {
+    int channel = -1;
+    uint32_t hold_ms = PRESS_MS;
+    stream >> channel;
+    if (!(stream >> hold_ms))
+      hold_ms = PRESS_MS;
+    if (channel < 0 || channel >= INDY_CHANNEL_COUNT || CHANNEL_CONFIGS[channel].button == GPIO_NUM_NC)
+      printf("error no button for channel %d\n", channel);
+    else
+      Press(channel, hold_ms);
+  } else if (command == "gpio") {
+    int pin = -1;
+    int level = -1;
+    stream >> pin >> level;
+    if (pin < 0 || pin >= GPIO_NUM_MAX || (level != 0 && level != 1))
+      printf("error usage: gpio PIN 0|1\n");
+    else
+      IndyHostGpio::GetInstance().SetLevel((gpio_num_t) pin, level);
+  } else if (command == "events") {
+    PrintEvents();
+  } else if (command == "clear") {
+    IndyHostGpio::GetInstance().ClearEvents();
+  } else {
+    printf("error unknown command '%s'\n", command.c_str());
+  }
+  fflush(stdout);
+}
+
+// Pulls the button of `channel` low, as a press does, to be released after
+// `hold_ms`. A button still held from an earlier press is released first.
+void IndyHostConsole::Press(int channel, uint32_t hold_ms) {
+  if (pressed_pin != GPIO_NUM_NC)
+    Release();
+  pressed_pin = CHANNEL_CONFIGS[channel].button;
+  release_time = esp_timer_get_time() + (int64_t) hold_ms * 1000;
+  IndyHostGpio::GetInstance().SetLevel(pressed_pin, 0);
+}
+
+// Lets the held button go high again
+void IndyHostConsole::Release() {
+  IndyHostGpio::GetInstance().SetLevel(pressed_pin, 1);
+  pressed_pin = GPIO_NUM_NC;
+}
+
+// Prints the GPIO events recorded, and clears them
+void IndyHostConsole::PrintEvents() {
+  uint32_t dropped = 0;
+  std::vector<IndyGpioEvent> events = IndyHostGpio::GetInstance().TakeEvents(&dropped);
+  for (const IndyGpioEvent& event : events)
+    printf("gpio_event %" PRId64 " %d %d\n", event.time, (int) event.pin, event.level);
+  printf("gpio_events %zu %" PRIu32 "\n", events.size(), dropped);
+}
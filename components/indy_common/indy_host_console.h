@@ -0,0 +1,62 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_HOST_CONSOLE_H_
+#define COMPONENTS_INDY_COMMON_INDY_HOST_CONSOLE_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+
+#include <cstdint>
+#include <string>
+
+#include "indy_gpio.h"
+
+// Reads commands from stdin on Linux hosts, to press buttons and read back the
+// simulated GPIO events, so switch latency can be measured without hardware.
+// Each line is one command:
+//
+//   press CHANNEL [MS]  Holds the channel's button down for MS milliseconds,
+//                       100 by default
+//   gpio PIN LEVEL      Sets the level of a simulated pin
+//   events              Prints the GPIO events recorded, one "gpio_event TIME
+//                       PIN LEVEL" line each with TIME in microseconds since
+//                       boot, then a "gpio_events COUNT DROPPED" line, and
+//                       clears them
+//   clear               Clears the GPIO events recorded
+//
+// Stdin is polled from a FreeRTOS timer, so nothing blocks the simulated tasks.
+class IndyHostConsole {
+ public:
+  static IndyHostConsole& GetInstance() {
+    static IndyHostConsole instance;
+    return instance;
+  }
+
+  void Start();
+
+ private:
+  IndyHostConsole() {}
+
+  TimerHandle_t timer = nullptr;
+  StaticTimer_t timer_buffer;
+  static void TimerCallback(TimerHandle_t timer);
+  void Poll();
+
+  // Input not yet ended by a newline, and whether stdin has closed
+  std::string input;
+  bool input_closed = false;
+  void ReadInput();
+  void HandleCommand(const std::string& line);
+
+  // Button held down by a press command, if any, and when to release it
+  gpio_num_t pressed_pin = GPIO_NUM_NC;
+  int64_t release_time = 0;
+  void Press(int channel, uint32_t hold_ms);
+  void Release();
+
+  void PrintEvents();
+
+  // Prevent copy and assignment since IndyHostConsole is a singleton.
+  IndyHostConsole(const IndyHostConsole&) = delete;
+  IndyHostConsole& operator=(const IndyHostConsole&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_HOST_CONSOLE_H_
@@ -0,0 +1,111 @@
+#include "indy_host_gpio.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "indy_config.h"
+#include "indy_rtos.h"
+
+namespace {
+  const char *TAG = "indy_host_gpio";
+}
+
+// Sets up this IndyHostGpio
+IndyHostGpio::IndyHostGpio() {
+  mutex = IndyRtos::CreateMutex(&mutex_buffer);
+  if (mutex == nullptr) {
+    ESP_LOGE(TAG, "Create host GPIO mutex failed");
+    abort();
+  }
+
+  // Pins idle high, the same as a pin with its pull-up resistor enabled
+  levels.fill(1);
+}
+
+// Returns the level of `pin`
+int IndyHostGpio::GetLevel(gpio_num_t pin) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  int level = levels[pin];
+  xSemaphoreGive(mutex);
+  return level;
+}
+
+// Sets the level of `pin`, records the change, and calls the pin's change handler
+void IndyHostGpio::SetLevel(gpio_num_t pin, int level) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  bool changed = levels[pin] != level;
+  levels[pin] = level;
+  if (changed)
+    RecordEvent(esp_timer_get_time(), pin, level);
+  ChangeHandler handler = handlers[pin];
+  xSemaphoreGive(mutex);
+
+  if (changed) {
+    ESP_LOGI(TAG, "GPIO %d set to %d", pin, level);
+    if (handler)
+      handler();
+  }
+}
+
+// Sets the pins in `high_mask` high and the pins in `low_mask` low, all with
+// the same timestamp, and calls their change handlers
+void IndyHostGpio::SetLevels(uint64_t high_mask, uint64_t low_mask) {
+  std::vector<ChangeHandler> changed_handlers;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  int64_t now = esp_timer_get_time();
+  for (int pin = 0; pin < GPIO_NUM_MAX; pin++) {
+    uint64_t bit = 1ULL << pin;
+    if (!((high_mask | low_mask) & bit))
+      continue;
+    int level = (high_mask & bit) ? 1 : 0;
+    if (levels[pin] == level)
+      continue;
+    levels[pin] = level;
+    RecordEvent(now, (gpio_num_t) pin, level);
+    ESP_LOGI(TAG, "GPIO %d set to %d", pin, level);
+    if (handlers[pin])
+      changed_handlers.push_back(handlers[pin]);
+  }
+  xSemaphoreGive(mutex);
+
+  for (const ChangeHandler& handler : changed_handlers) {
+    handler();
+  }
+}
+
+// Registers `handler` to be called when the level of `pin` changes
+void IndyHostGpio::RegisterChangeHandler(gpio_num_t pin, const ChangeHandler& handler) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  handlers[pin] = handler;
+  xSemaphoreGive(mutex);
+}
+
+// Returns the changes in level recorded since the events were last cleared,
+// and clears them. `dropped` is set to the number of changes not recorded
+// because EVENTS_MAX events were already recorded.
+std::vector<IndyGpioEvent> IndyHostGpio::TakeEvents(uint32_t* dropped) {
+  std::vector<IndyGpioEvent> result;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  result.swap(events);
+  *dropped = dropped_events;
+  dropped_events = 0;
+  xSemaphoreGive(mutex);
+  return result;
+}
+
+// Clears recorded events
+void IndyHostGpio::ClearEvents() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  events.clear();
+  dropped_events = 0;
+  xSemaphoreGive(mutex);
+}
+
+// Records a change in level, or counts it as dropped if the events are full.
+// Caller must hold the mutex.
+void IndyHostGpio::RecordEvent(int64_t time, gpio_num_t pin, int level) {
+  if (events.size() < EVENTS_MAX)
+    events.push_back(IndyGpioEvent{time, pin, level});
+  else
+    dropped_events++;
+}
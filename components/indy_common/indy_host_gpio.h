@@ -0,0 +1,64 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_HOST_GPIO_H_
+#define COMPONENTS_INDY_COMMON_INDY_HOST_GPIO_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "indy_gpio.h"
+
+// A change in level of a simulated GPIO
+struct IndyGpioEvent {
+  int64_t time;     // Microseconds since boot
+  gpio_num_t pin;
+  int level;
+};
+
+// Simulates the ESP32's GPIO pins on Linux hosts, and records each change in
+// level with a timestamp so actuation latency can be measured without hardware.
+// At most EVENTS_MAX events are kept. Once full, later changes are counted as
+// dropped until the events are cleared.
+class IndyHostGpio {
+ public:
+  static IndyHostGpio& GetInstance() {
+    static IndyHostGpio instance;
+    return instance;
+  }
+
+  // Levels
+  int GetLevel(gpio_num_t pin);
+  void SetLevel(gpio_num_t pin, int level);
+  void SetLevels(uint64_t high_mask, uint64_t low_mask);
+
+  // Change handlers, called when the level of an input pin is changed
+  using ChangeHandler = std::function<void()>;
+  void RegisterChangeHandler(gpio_num_t pin, const ChangeHandler& handler);
+
+  // Events
+  static const size_t EVENTS_MAX = 1024;
+  std::vector<IndyGpioEvent> TakeEvents(uint32_t* dropped);
+  void ClearEvents();
+
+ private:
+  IndyHostGpio();
+
+  std::array<int, GPIO_NUM_MAX> levels = {};
+  std::array<ChangeHandler, GPIO_NUM_MAX> handlers;
+  std::vector<IndyGpioEvent> events;
+  uint32_t dropped_events = 0;
+  void RecordEvent(int64_t time, gpio_num_t pin, int level);
+
+  // Mutex for locking levels and events
+  SemaphoreHandle_t mutex;
+  StaticSemaphore_t mutex_buffer;
+
+  // Prevent copy and assignment since IndyHostGpio is a singleton.
+  IndyHostGpio(const IndyHostGpio&) = delete;
+  IndyHostGpio& operator=(const IndyHostGpio&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_HOST_GPIO_H_
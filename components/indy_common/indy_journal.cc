@@ -0,0 +1,371 @@
+#include "indy_journal.h"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+#include <cstddef>
+#include <cstring>
+
+#include "indy_config.h"
+#include "indy_rtos.h"
+#include "indy_util.h"
+
+namespace {
+  const char *TAG = "indy_journal";
+
+  // The journal partition, from partitions.csv
+  const char* const JOURNAL_PARTITION_LABEL = "journal";
+  const esp_partition_subtype_t JOURNAL_PARTITION_SUBTYPE = (esp_partition_subtype_t) 0x40;
+
+  const uint32_t ERASED_WORD = 0xFFFFFFFF;
+}
+
+// Sets up the journal, and recovers the most recent state saved to it
+void IndyJournal::Setup() {
+  // Create mutexes
+  mutex = IndyRtos::CreateMutex(&mutex_buffer);
+  if (mutex == nullptr) {
+    ESP_LOGE(TAG, "Create journal mutex failed");
+    abort();
+  }
+  write_mutex = IndyRtos::CreateMutex(&write_mutex_buffer);
+  if (write_mutex == nullptr) {
+    ESP_LOGE(TAG, "Create journal write mutex failed");
+    abort();
+  }
+
+  // Find the journal partition
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE, JOURNAL_PARTITION_LABEL);
+  if (partition == nullptr) {
+    ESP_LOGE(TAG, "Journal partition '%s' not found. State will not be saved.", JOURNAL_PARTITION_LABEL);
+    return;
+  }
+  records_per_sector = SPI_FLASH_SEC_SIZE / sizeof(Record);
+  sector_count = partition->size / SPI_FLASH_SEC_SIZE;
+  if (sector_count < 2) {
+    ESP_LOGE(TAG, "Journal partition needs at least 2 sectors but has %d", (int) sector_count);
+    partition = nullptr;
+    return;
+  }
+
+  // Find the most recent record
+  Recover();
+
+  // Create the journal task, that writes state changes
+  if (JOURNAL_WRITE_ASYNC)
+    task.CreateTask(TaskFunction, this);
+
+  ESP_LOGI(TAG, "Setup completed");
+}
+
+// Returns the current state of `channel`
+IndyJournalState IndyJournal::GetState(int channel) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to get state");
+    return IndyJournalState();
+  }
+  IndyJournalState result = states[channel];
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after getting state");
+  return result;
+}
+
+// Saves all of `state` to the journal for `channel`
+void IndyJournal::WriteState(int channel, const IndyJournalState& state) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to write state");
+    return;
+  }
+  states[channel] = state;
+  has_state = true;
+  is_dirty[channel] = true;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after writing state");
+  RequestWrite();
+}
+
+// Saves `is_on` to the journal for `channel`
+void IndyJournal::WriteIsOn(int channel, bool is_on) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to write is_on");
+    return;
+  }
+  states[channel].is_on = is_on;
+  has_state = true;
+  is_dirty[channel] = true;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after writing is_on");
+  RequestWrite();
+}
+
+// Saves `next_action` and `next_action_time` to the journal for `channel`
+void IndyJournal::WriteNextAction(int channel, int32_t next_action, time_t next_action_time) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to write next action");
+    return;
+  }
+  states[channel].next_action = next_action;
+  states[channel].next_action_time = next_action_time;
+  has_state = true;
+  is_dirty[channel] = true;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after writing next action");
+  RequestWrite();
+}
+
+// Has the journal task write the current state, or writes it now if there's
+// no journal task
+void IndyJournal::RequestWrite() {
+  if (task.IsRunning())
+    task.TaskNotifyGive();
+  else
+    Flush();
+}
+
+// Writes state changes to flash
+void IndyJournal::TaskFunction(void *arg) {
+  IndyJournal* journal = reinterpret_cast<IndyJournal*>(arg);
+  journal->Flush();
+}
+
+// Writes the current state to flash if it's changed since it was last written
+void IndyJournal::Flush() {
+  // Only one writer at a time
+  if (xSemaphoreTake(write_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire write mutex");
+    return;
+  }
+
+  // Take a copy of the current state, so the lock isn't held while writing
+  std::array<bool, INDY_CHANNEL_COUNT> should_write = {};
+  std::array<IndyJournalState, INDY_CHANNEL_COUNT> states_to_write;
+  if (Lock()) {
+    should_write = is_dirty;
+    states_to_write = states;
+    is_dirty.fill(false);
+    if (!Unlock())
+      ESP_LOGE(TAG, "Failed to release lock after copying state");
+  } else {
+    ESP_LOGE(TAG, "Failed to acquire lock to copy state");
+  }
+
+  // Write the state of each channel that changed. A channel whose write failed
+  // is marked dirty again, so its latest state is written by the next flush.
+  for (int channel = 0; channel < INDY_CHANNEL_COUNT; channel++) {
+    if (!should_write[channel])
+      continue;
+    const IndyJournalState& state = states_to_write[channel];
+    ESP_LOGI(TAG, "Writing channel %d state: is_on %d, next action %" PRIi32 ", next action time %" PRId64,
+      channel, state.is_on, state.next_action, (int64_t) state.next_action_time);
+    if (Append(channel, state))
+      continue;
+    if (Lock()) {
+      is_dirty[channel] = true;
+      if (!Unlock())
+        ESP_LOGE(TAG, "Failed to release lock after marking state dirty");
+    } else {
+      ESP_LOGE(TAG, "Failed to acquire lock to mark state dirty");
+    }
+  }
+
+  // Release write mutex
+  if (xSemaphoreGive(write_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release write mutex");
+}
+
+// Erases all records from the journal
+void IndyJournal::Reset() {
+  if (!IsActive())
+    return;
+  ESP_LOGI(TAG, "Resetting");
+  stats.erases += sector_count;
+  esp_err_t err = esp_partition_erase_range(partition, 0, partition->size);
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Error erasing journal: %s", esp_err_to_name(err));
+}
+
+bool IndyJournal::Lock() {
+  // Acquire mutex
+  return xSemaphoreTake(mutex, MAX_WAIT) == pdTRUE;
+}
+
+bool IndyJournal::Unlock() {
+  // Release mutex
+  return xSemaphoreGive(mutex) == pdTRUE;
+}
+
+// Reads the record at `slot` into `record`. Returns `false` if the read failed.
+bool IndyJournal::ReadRecord(size_t slot, Record* record) {
+  esp_err_t err = esp_partition_read(partition, slot * sizeof(Record), record, sizeof(Record));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error reading record %d: %s", (int) slot, esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+// Returns whether `record` has never been written to
+bool IndyJournal::IsErased(const Record& record) {
+  return record.seq == ERASED_WORD;
+}
+
+// Returns whether `record` was completely written
+bool IndyJournal::IsValid(const Record& record) {
+  return !IsErased(record) && record.crc == ComputeCrc(record);
+}
+
+// Returns the channel of `record`
+int IndyJournal::GetChannel(const Record& record) {
+  return record.channel == 0xFF ? 0 : record.channel;
+}
+
+// Returns the CRC of `record`, computed over every field but the CRC itself
+uint32_t IndyJournal::ComputeCrc(const Record& record) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&record), offsetof(Record, crc));
+}
+
+// Finds the most recent valid record of each channel, and restores state from
+// them. Sequence numbers only increase, so the first record of each sector
+// identifies the sector written most recently, and records within a sector are
+// written in order, so a binary search finds the end of that sector. Every
+// sector starts with the state of every channel, so searching back from the
+// end of that sector finds them all. With one channel, recovery reads
+// O(sector_count + log(records_per_sector)) records.
+void IndyJournal::Recover() {
+  // Find the sector whose first record is most recent
+  Record record;
+  bool found = false;
+  bool read_failed = false;
+  size_t head_sector = 0;
+  uint32_t head_seq = 0;
+  for (size_t sector = 0; sector < sector_count; sector++) {
+    if (!ReadRecord(sector * records_per_sector, &record)) {
+      read_failed = true;
+      continue;
+    }
+    if (IsValid(record) && (!found || record.seq > head_seq)) {
+      found = true;
+      head_sector = sector;
+      head_seq = record.seq;
+    }
+  }
+  if (!found && read_failed) {
+    // A sector that couldn't be read may hold the saved state, so leave the
+    // flash alone, and don't save state until the next boot
+    ESP_LOGE(TAG, "Unable to read journal. State will not be saved.");
+    partition = nullptr;
+    return;
+  }
+  if (!found) {
+    // Every sector is erased or holds no valid record, so the journal is new.
+    // Start again with an empty journal.
+    ESP_LOGI(TAG, "No saved state found. Starting a new journal.");
+    Reset();
+    next_slot = 0;
+    next_seq = 1;
+    return;
+  }
+
+  // Find the first erased slot in the head sector
+  size_t first_slot = head_sector * records_per_sector;
+  size_t low = 1;  // The first record in the head sector is known to be written
+  size_t high = records_per_sector;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (ReadRecord(first_slot + middle, &record) && IsErased(record))
+      high = middle;
+    else
+      low = middle + 1;
+  }
+
+  // Search back for the last valid record of each channel, skipping any that
+  // were only partly written
+  std::array<bool, INDY_CHANNEL_COUNT> found_channels = {};
+  int found_count = 0;
+  uint32_t last_seq = 0;
+  for (size_t slot = first_slot + low; slot > first_slot && found_count < INDY_CHANNEL_COUNT; slot--) {
+    if (!(ReadRecord(slot - 1, &record) && IsValid(record)))
+      continue;
+    if (last_seq == 0)
+      last_seq = record.seq;
+    int channel = GetChannel(record);
+    if (channel >= INDY_CHANNEL_COUNT || found_channels[channel])
+      continue;
+    found_channels[channel] = true;
+    found_count++;
+
+    // Restore state
+    IndyJournalState& state = states[channel];
+    state.is_on = record.is_on != 0;
+    state.next_action = record.next_action;
+    state.next_action_time = record.next_action_time == ERASED_WORD ? NULL_TIME : (time_t) record.next_action_time;
+    written_states[channel] = state;
+    ESP_LOGI(TAG, "Recovered record %" PRIu32 " for channel %d: is_on %d, next action %" PRIi32
+      ", next action time %" PRId64, record.seq, channel, state.is_on, state.next_action,
+      (int64_t) state.next_action_time);
+  }
+  has_state = true;
+
+  // Continue after the end of the head sector
+  next_slot = (first_slot + low) % (sector_count * records_per_sector);
+  next_seq = last_seq + 1;
+}
+
+// Appends `state` of `channel` to the journal. Returns `false` if the erase
+// or write failed. Caller must hold the write mutex.
+bool IndyJournal::Append(int channel, const IndyJournalState& state) {
+  if (!IsActive())
+    return true;
+
+  // Erase the next sector if this is the first write to it and it still has old records
+  Record record;
+  bool is_sector_start = next_slot % records_per_sector == 0;
+  if (is_sector_start && !(ReadRecord(next_slot, &record) && IsErased(record))) {
+    stats.erases++;
+    esp_err_t err = esp_partition_erase_range(partition, next_slot * sizeof(Record), SPI_FLASH_SEC_SIZE);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Error erasing journal sector: %s", esp_err_to_name(err));
+      return false;
+    }
+  }
+
+  // Start a new sector with the state of the other channels, since their
+  // latest records may be in the next sector to be erased
+  if (is_sector_start) {
+    for (int other = 0; other < INDY_CHANNEL_COUNT; other++) {
+      if (other != channel && !AppendRecord(other, written_states[other]))
+        return false;
+    }
+  }
+
+  if (!AppendRecord(channel, state))
+    return false;
+  written_states[channel] = state;
+  return true;
+}
+
+// Writes a record with `state` of `channel` to the next slot. Returns `false`
+// if the write failed. Caller must hold the write mutex.
+bool IndyJournal::AppendRecord(int channel, const IndyJournalState& state) {
+  // Write record
+  Record record;
+  memset(&record, 0xFF, sizeof(record));
+  record.seq = next_seq;
+  record.next_action_time = state.next_action_time == NULL_TIME ? ERASED_WORD : (uint32_t) state.next_action_time;
+  record.is_on = state.is_on;
+  record.next_action = (uint8_t) state.next_action;
+  record.channel = (uint8_t) channel;
+  record.crc = ComputeCrc(record);
+  stats.writes++;
+  esp_err_t err = esp_partition_write(partition, next_slot * sizeof(Record), &record, sizeof(record));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error writing journal record: %s", esp_err_to_name(err));
+    return false;
+  }
+
+  // Advance to the next slot
+  next_slot = (next_slot + 1) % (sector_count * records_per_sector);
+  next_seq++;
+  return true;
+}
@@ -0,0 +1,116 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_JOURNAL_H_
+#define COMPONENTS_INDY_COMMON_INDY_JOURNAL_H_
+
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+
+#include "indy_config.h"
+#include "indy_task.h"
+#include "indy_util.h"
+
+// Holds the state of a switch channel that's saved to the journal
+struct IndyJournalState {
+  bool is_on = false;
+  int32_t next_action = 0;
+  time_t next_action_time = NULL_TIME;
+};
+
+// Counts journal flash operations, to measure flash traffic
+struct IndyJournalStats {
+  uint32_t writes = 0;
+  uint32_t erases = 0;
+};
+
+// Manages an append-only journal of switch state, kept in its own flash
+// partition. Each state change appends one small record, and sectors are only
+// erased when the journal wraps around, so frequent state changes don't wear
+// out NVS pages. Records are written by the journal task, so callers don't wait
+// on flash. If several changes arrive before the task runs, only the latest
+// state is written. Each record holds the state of one channel, and each sector
+// starts with the state of every channel, so the latest state of every channel
+// is always in the sector written most recently.
+class IndyJournal {
+ public:
+  void Setup();
+
+  bool IsActive() const { return partition != nullptr; }
+  bool HasState() const { return has_state; }
+
+  IndyJournalState GetState(int channel);
+
+  void WriteState(int channel, const IndyJournalState& state);
+  void WriteIsOn(int channel, bool is_on);
+  void WriteNextAction(int channel, int32_t next_action, time_t next_action_time);
+
+  void Flush();
+  void Reset();
+
+  IndyJournalStats GetStats() const { return stats; }
+
+ private:
+  // A journal record as stored in flash
+  struct Record {
+    uint32_t seq;               // Sequence number. 0xFFFFFFFF means the slot is erased.
+    uint32_t next_action_time;  // Seconds since the epoch. 0xFFFFFFFF means NULL_TIME.
+    uint8_t is_on;
+    uint8_t next_action;
+    uint8_t channel;            // 0xFF in records written before there were channels, meaning channel 0
+    uint8_t reserved;
+    uint32_t crc;               // CRC32 of the fields above
+  };
+  static_assert(sizeof(Record) == 16, "Journal record should be 16 bytes");
+  static_assert(INDY_CHANNEL_COUNT < 0xFF, "Journal records have one byte for the channel");
+
+  // Journal partition
+  const esp_partition_t* partition = nullptr;
+  size_t records_per_sector = 0;
+  size_t sector_count = 0;
+
+  // Where the next record goes
+  size_t next_slot = 0;
+  uint32_t next_seq = 1;
+
+  // Current state of each channel, and whether it's changed since it was last
+  // written
+  std::array<IndyJournalState, INDY_CHANNEL_COUNT> states;
+  std::array<bool, INDY_CHANNEL_COUNT> is_dirty = {};
+  bool has_state = false;
+
+  // State of each channel as last written to flash, for the start of each sector
+  std::array<IndyJournalState, INDY_CHANNEL_COUNT> written_states;
+
+  // Flash operations since boot
+  IndyJournalStats stats;
+
+  // Mutex for locking state
+  SemaphoreHandle_t mutex = nullptr;
+  StaticSemaphore_t mutex_buffer;
+  bool Lock();
+  bool Unlock();
+
+  // Mutex held while writing to flash
+  SemaphoreHandle_t write_mutex = nullptr;
+  StaticSemaphore_t write_mutex_buffer;
+
+  // Journal task, which writes changed state to flash
+  IndyTask task = IndyTask("JournalTask", JOURNAL_TASK_CONFIG);
+  static void TaskFunction(void *arg);
+  void RequestWrite();
+
+  // Records
+  bool ReadRecord(size_t slot, Record* record);
+  static bool IsErased(const Record& record);
+  static bool IsValid(const Record& record);
+  static uint32_t ComputeCrc(const Record& record);
+  static int GetChannel(const Record& record);
+  void Recover();
+  bool Append(int channel, const IndyJournalState& state);
+  bool AppendRecord(int channel, const IndyJournalState& state);
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_JOURNAL_H_
@@ -153,6 +153,20 @@ JsonResult<int> JsonParser::GetInt(const cJSON* object, const char *context, con
   return JsonResult<int>(result.value->valueint);
 }
 
+// Returns the number value of `attr` in `object`, for numbers too big for an int
+JsonResult<double> JsonParser::GetDouble(const cJSON* object, const char *context, const char *attr) const {
+  // Get item and check that it's a number
+  JsonResult<cJSON*> result = GetItem(object, context, attr);
+  if (result.is_error) {
+    return JsonResult<double>(result.message.c_str());
+  } else if (!cJSON_IsNumber(result.value)) {
+    std::string message = FormatString2(context, "the value for attribute '%s' is not a number", attr);
+    LogError(message);
+    return JsonResult<double>(message.c_str());
+  }
+  return JsonResult<double>(result.value->valuedouble);
+}
+
 // Returns the keys found in `object`
 std::vector<std::string> JsonParser::LookupKeys(const cJSON* object) const {
   std::vector<std::string> keys;
@@ -183,7 +197,7 @@ cJSON* JsonParser::CloneJSON(cJSON* json) {
     cJSON* clone = cJSON_Parse(json_str);
 
     // Clean up
-    free(json_str);
+    cJSON_free(json_str);
 
     return clone;
 }
@@ -35,6 +35,7 @@ class JsonParser {
   JsonResult<std::vector<std::string>> GetStringArray(const cJSON* object, const char *context, const char *attr) const;
   JsonResult<bool> GetBool(const cJSON* object, const char *context, const char *attr) const;
   JsonResult<int> GetInt(const cJSON* object, const char *context, const char *attr) const;
+  JsonResult<double> GetDouble(const cJSON* object, const char *context, const char *attr) const;
   std::vector<std::string> LookupKeys(const cJSON* object) const;
 
   static cJSON* CloneJSON(cJSON *json);
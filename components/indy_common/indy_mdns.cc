@@ -24,3 +24,18 @@ void IndyMdns::Setup() {
 
   ESP_LOGI(TAG, "Setup completed");
 }
+
+// Announces service `type` on `port`, with this device's hostname as the
+// instance name
+void IndyMdns::AddService(const char* type, const char* proto, uint16_t port) {
+  esp_err_t err = mdns_service_add(HOSTNAME, type, proto, port, nullptr, 0);
+  if (err)
+    ESP_LOGE(TAG, "Add service %s.%s failed: %s", type, proto, esp_err_to_name(err));
+}
+
+// Sets TXT record `key` of service `type` to `value`
+void IndyMdns::SetServiceTxt(const char* type, const char* proto, const char* key, const char* value) {
+  esp_err_t err = mdns_service_txt_item_set(type, proto, key, value);
+  if (err)
+    ESP_LOGE(TAG, "Set %s.%s TXT %s failed: %s", type, proto, key, esp_err_to_name(err));
+}
@@ -1,10 +1,16 @@
 #ifndef COMPONENTS_INDY_COMMON_INDY_MDNS_H_
 #define COMPONENTS_INDY_COMMON_INDY_MDNS_H_
 
+#include <cstdint>
+
 // Manages the ESP32 mDNS service for this device
 class IndyMdns {
  public:
   void Setup();
+
+  // Announces a service of this device, such as "_indy-peer", "_udp"
+  void AddService(const char* type, const char* proto, uint16_t port);
+  void SetServiceTxt(const char* type, const char* proto, const char* key, const char* value);
 };
 
 #endif  // COMPONENTS_INDY_COMMON_INDY_MDNS_H_
@@ -0,0 +1,22 @@
+#include "indy_mdns.h"
+
+#include <esp_log.h>
+
+namespace {
+  const char *TAG = "indy_mdns";
+}
+
+// Sets up this IndyMdns. mDNS isn't used on Linux hosts.
+void IndyMdns::Setup() {
+  ESP_LOGI(TAG, "mDNS is not available on host");
+}
+
+// Announcing services isn't available on Linux hosts. Peers find each other
+// by multicast, so they don't need it.
+void IndyMdns::AddService(const char* type, const char* proto, uint16_t port) {
+  ESP_LOGI(TAG, "Not announcing %s.%s on port %u on host", type, proto, port);
+}
+
+void IndyMdns::SetServiceTxt(const char* type, const char* proto, const char* key, const char* value) {
+  ESP_LOGI(TAG, "Not setting %s.%s TXT %s=%s on host", type, proto, key, value);
+}
@@ -0,0 +1,109 @@
+#include "indy_memory.h"
+
+#include <esp_log.h>
+#include <sdkconfig.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include <malloc.h>
+#else
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#endif
+
+#include <cstdlib>
+
+namespace {
+  const char *TAG = "indy_memory";
+
+  // Tag names, in the same order as IndyHeapTag
+  const char* const TAG_NAMES[] = {
+    "nvs", "journal", "peripherals", "config", "wifi", "mdns", "peer", "mqtt", "time", "json",
+  };
+  static_assert(sizeof(TAG_NAMES) / sizeof(TAG_NAMES[0]) == static_cast<size_t>(IndyHeapTag::COUNT),
+    "Each IndyHeapTag needs a name");
+
+  // cJSON allocation hooks
+  void* JsonMalloc(size_t size) {
+    return IndyMemory::GetInstance().Allocate(IndyHeapTag::JSON, size);
+  }
+  void JsonFree(void* ptr) {
+    IndyMemory::GetInstance().Free(IndyHeapTag::JSON, ptr);
+  }
+}
+
+// Sets up heap tracking. Call before anything else uses cJSON.
+void IndyMemory::Setup() {
+  cJSON_Hooks hooks = { JsonMalloc, JsonFree };
+  cJSON_InitHooks(&hooks);
+}
+
+// Returns the free heap in bytes. Linux hosts don't have a fixed heap, so
+// return 0.
+uint32_t IndyMemory::GetFreeHeap() {
+#if CONFIG_IDF_TARGET_LINUX
+  return 0;
+#else
+  return esp_get_free_heap_size();
+#endif
+}
+
+// Records the heap used while setting up the subsystem `tag`, which is the
+// drop in free heap since `free_heap`. Updates `free_heap` to the current free heap.
+void IndyMemory::RecordSetup(IndyHeapTag tag, uint32_t* free_heap) {
+  uint32_t now = GetFreeHeap();
+  GetUsage(tag).setup_bytes += *free_heap > now ? *free_heap - now : 0;
+  *free_heap = now;
+}
+
+// Returns the size of the allocated block at `ptr`
+size_t IndyMemory::GetAllocatedSize(void* ptr) {
+#if CONFIG_IDF_TARGET_LINUX
+  return malloc_usable_size(ptr);
+#else
+  return heap_caps_get_allocated_size(ptr);
+#endif
+}
+
+// Allocates `size` bytes for the subsystem `tag`
+void* IndyMemory::Allocate(IndyHeapTag tag, size_t size) {
+  void* ptr = malloc(size);
+  if (ptr == nullptr)
+    return nullptr;
+
+  // Count the allocation, and update the peak
+  Usage& usage = GetUsage(tag);
+  unsigned int allocated = GetAllocatedSize(ptr);
+  unsigned int bytes = atomic_fetch_add(&usage.bytes, allocated) + allocated;
+  atomic_fetch_add(&usage.allocations, 1);
+  unsigned int peak = atomic_load(&usage.peak_bytes);
+  while (bytes > peak && !atomic_compare_exchange_weak(&usage.peak_bytes, &peak, bytes)) {
+  }
+  return ptr;
+}
+
+// Frees `ptr`, which was allocated for the subsystem `tag`
+void IndyMemory::Free(IndyHeapTag tag, void* ptr) {
+  if (ptr == nullptr)
+    return;
+  atomic_fetch_sub(&GetUsage(tag).bytes, GetAllocatedSize(ptr));
+  free(ptr);
+}
+
+// Returns JSON with free heap and heap used by each subsystem
+cJSON* IndyMemory::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+#if !CONFIG_IDF_TARGET_LINUX
+  cJSON_AddNumberToObject(json, "free_heap", esp_get_free_heap_size());
+  cJSON_AddNumberToObject(json, "min_free_heap", esp_get_minimum_free_heap_size());
+  cJSON_AddNumberToObject(json, "largest_free_block", heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+#endif
+  cJSON* subsystems_json = cJSON_AddObjectToObject(json, "subsystems");
+  for (size_t ii = 0; ii < usages.size(); ii++) {
+    Usage& usage = usages[ii];
+    cJSON* usage_json = cJSON_AddObjectToObject(subsystems_json, TAG_NAMES[ii]);
+    cJSON_AddNumberToObject(usage_json, "setup_bytes", usage.setup_bytes);
+    cJSON_AddNumberToObject(usage_json, "bytes", atomic_load(&usage.bytes));
+    cJSON_AddNumberToObject(usage_json, "peak_bytes", atomic_load(&usage.peak_bytes));
+    cJSON_AddNumberToObject(usage_json, "allocations", atomic_load(&usage.allocations));
+  }
+  return json;
+}
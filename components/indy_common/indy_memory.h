@@ -0,0 +1,69 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_MEMORY_H_
+#define COMPONENTS_INDY_COMMON_INDY_MEMORY_H_
+
+#include <cJSON.h>
+#include <stdatomic.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Subsystems whose heap use is tracked
+enum class IndyHeapTag {
+  NVS,
+  JOURNAL,
+  PERIPHERALS,
+  CONFIG,
+  WIFI,
+  MDNS,
+  PEER,
+  MQTT,
+  TIME,
+  JSON,
+  COUNT,  // Number of tags
+};
+
+// Tracks heap use by subsystem, so stacks and queues can be sized from data.
+// Heap used while a subsystem is set up is measured as the drop in free heap,
+// which is approximate since other tasks may allocate at the same time. Heap
+// used at runtime is counted by wrapping the subsystem's allocations. cJSON
+// allocations are counted under JSON, so strings from cJSON_Print need to be
+// released with cJSON_free.
+class IndyMemory {
+ public:
+  static IndyMemory& GetInstance() {
+    static IndyMemory instance;
+    return instance;
+  }
+
+  void Setup();
+
+  static uint32_t GetFreeHeap();
+  void RecordSetup(IndyHeapTag tag, uint32_t* free_heap);
+
+  void* Allocate(IndyHeapTag tag, size_t size);
+  void Free(IndyHeapTag tag, void* ptr);
+
+  cJSON* CreateJson();  // Caller owns returned memory
+
+ private:
+  IndyMemory() {}
+
+  // Heap used by one subsystem
+  struct Usage {
+    uint32_t setup_bytes = 0;
+    atomic_uint bytes = ATOMIC_VAR_INIT(0);
+    atomic_uint peak_bytes = ATOMIC_VAR_INIT(0);
+    atomic_uint allocations = ATOMIC_VAR_INIT(0);
+  };
+  std::array<Usage, static_cast<size_t>(IndyHeapTag::COUNT)> usages;
+  Usage& GetUsage(IndyHeapTag tag) { return usages[static_cast<size_t>(tag)]; }
+
+  static size_t GetAllocatedSize(void* ptr);
+
+  // Prevent copy and assignment since IndyMemory is a singleton.
+  IndyMemory(const IndyMemory&) = delete;
+  IndyMemory& operator=(const IndyMemory&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_MEMORY_H_
@@ -2,120 +2,50 @@
 
 #include <cJSON.h>
 #include <esp_log.h>
-#include <mqtt_client.h>
+#include <esp_random.h>
+#include <sys/time.h>
+
+#include <utility>
 
 #include "indy_config.h"
 #include "indy_json.h"
+#include "indy_rtos.h"
 #include "indy_util.h"
 
-// Code is based on example code from
-// [ESP-MQTT SSL Sample application](https://github.com/espressif/esp-idf/tree/v5.1.1/examples/protocols/mqtt/ssl)
-
-#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
-
-// The root cert used to create TLS client connections, from the file main/elias_alexan_org.pem
-extern const uint8_t indy_pem_start[]  asm("_binary_elias_alexan_org_pem_start");
-extern const uint8_t indy_pem_end[]    asm("_binary_elias_alexan_org_pem_end");
-
 namespace {
   const char *TAG = "indy_mqtt";
 
   const int COMMAND_QOS = 2;
   const int ACK_QOS = 1;
 
-  const int RESPONSES_MAX = 32;
-}
-
-// Handles events generated by the MQTT service
-static void MqttEventHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
-  esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t) event_data;
-  IndyMqtt *indy_mqtt = reinterpret_cast<IndyMqtt*>(handler_args);
-  switch ((esp_mqtt_event_id_t) event_id) {
-  case MQTT_EVENT_CONNECTED:
-    ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-    indy_mqtt->HandleMqttConnected();
-    break;
-  case MQTT_EVENT_DISCONNECTED:
-    ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
-    break;
-  case MQTT_EVENT_SUBSCRIBED:
-    ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-    break;
-  case MQTT_EVENT_UNSUBSCRIBED:
-    ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
-    break;
-  case MQTT_EVENT_PUBLISHED:
-    ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-    break;
-  case MQTT_EVENT_DATA:
-    {
-      std::string topic(event->topic, event->topic_len);
-      ESP_LOGI(TAG, "MQTT_EVENT_DATA for topic %s", topic.c_str());
-      indy_mqtt->HandleMqttData(topic, std::string(event->data, event->data_len));
-    }
-    break;
-  case MQTT_EVENT_ERROR:
-    ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
-    if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
-      ESP_LOGI(TAG, "Last error code reported from esp-tls: 0x%x", event->error_handle->esp_tls_last_esp_err);
-      ESP_LOGI(TAG, "Last tls stack error number: 0x%x", event->error_handle->esp_tls_stack_err);
-      ESP_LOGI(TAG, "Last captured errno : %d (%s)",  event->error_handle->esp_transport_sock_errno,
-               strerror(event->error_handle->esp_transport_sock_errno));
-    } else if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
-      ESP_LOGI(TAG, "Connection refused error: 0x%x", event->error_handle->connect_return_code);
-    } else {
-      ESP_LOGW(TAG, "Unknown error type: 0x%x", event->error_handle->error_type);
-    }
-    break;
-  default:
-    ESP_LOGI(TAG, "Other event id:%d", event->event_id);
-    break;
-  }
+  // Commands to shared topics are delivered at least once rather than
+  // exactly once, which halves the broker's handshakes when it fans them out.
+  // The commands set a state rather than toggle it, so a repeat is harmless.
+  const int SHARED_QOS = 1;
 }
 
 // Sets up this IndyMqtt
 void IndyMqtt::Setup() {
-  // Configure the MQTT client
-  const esp_mqtt_client_config_t config = {
-    .broker = {
-      .address = {
-        .uri = MQTT_BROKER,
-      },
-      .verification = {
-        .certificate = (const char *) indy_pem_start
-      },
-    },
-    .credentials = {
-      .username = MQTT_USER,
-      .client_id = HOSTNAME,
-      .authentication = {
-        .password = MQTT_PASSWORD,
-      },
-     },
-  };
-  client = esp_mqtt_client_init(&config);
-  if (client == nullptr) {
-    ESP_LOGE(TAG, "Initialize client failed");
+  // Create the responses queue, and start counting responses waiting to be published
+  responses.Setup();
+  unacked_mutex = IndyRtos::CreateMutex(&unacked_mutex_buffer);
+  if (unacked_mutex == nullptr) {
+    ESP_LOGE(TAG, "Create unacked mutex failed");
+    abort();
+  }
+  publish_events.Set(PUBLISHED_BIT);
+  shared_acks_mutex = IndyRtos::CreateMutex(&shared_acks_mutex_buffer);
+  if (shared_acks_mutex == nullptr) {
+    ESP_LOGE(TAG, "Create shared acks mutex failed");
     abort();
   }
-
-  // Register the MQTT event handler
-  ESP_ERROR_CHECK(esp_mqtt_client_register_event(
-    client, (esp_mqtt_event_id_t) ESP_EVENT_ANY_ID, MqttEventHandler, this));
-
-  // Start the MQTT client
-  ESP_ERROR_CHECK(esp_mqtt_client_start(client));
 
   // Create the publish task used to send responses, so that publishing doesn't
   // block other work.
   publish_task.CreateTask(PublishTaskFunction, this);
 
-  // Create the responses mutex
-  responses_mutex = xSemaphoreCreateMutex();
-  if (responses_mutex == nullptr) {
-    ESP_LOGE(TAG, "Create responses mutex failed");
-    abort();
-  }
+  // Start the MQTT client
+  StartClient();
 }
 
 // Subscribes to the specified topic and registers the handler to call when data
@@ -123,17 +53,33 @@ void IndyMqtt::Setup() {
 void IndyMqtt::SubscribeToTopic(const char* topic, const DataHandler& handler) {
   ESP_LOGI(TAG, "Subscribing to %s", topic);
   // Subscribe
-  int result = esp_mqtt_client_subscribe(client, topic, COMMAND_QOS);
-  if (result == -2) {
-    ESP_LOGE(TAG, "Susbcribe to %s failed: full outbox", topic);
+  if (!ClientSubscribe(topic, COMMAND_QOS))
     return;
-  } else if (result <= 0) {
-    ESP_LOGE(TAG, "Susbcribe to %s failed: return code %d", topic, result);
+
+  // Register handler
+  dataHandlers[topic].push_back(handler);
+}
+
+// Subscribes to `topic`, which is shared by many devices, and registers the
+// handler to call when data for the topic is received. Responses that are
+// asked for are published to `ack_topic`.
+void IndyMqtt::SubscribeToSharedTopic(const char* topic, const char* ack_topic, const DataHandler& handler) {
+  ESP_LOGI(TAG, "Subscribing to shared %s", topic);
+  // Subscribe
+  if (!ClientSubscribe(topic, SHARED_QOS))
     return;
-  }
 
   // Register handler
   dataHandlers[topic].push_back(handler);
+  shared_ack_topics[topic] = ack_topic;
+}
+
+// Unsubscribes from `topic`, and removes its handlers
+void IndyMqtt::UnsubscribeFromTopic(const char* topic) {
+  ESP_LOGI(TAG, "Unsubscribing from %s", topic);
+  ClientUnsubscribe(topic);
+  dataHandlers.erase(topic);
+  shared_ack_topics.erase(topic);
 }
 
 // Calls the handlers that have been registered for the MQTT_EVENT_CONNECTED event
@@ -144,8 +90,23 @@ void IndyMqtt::HandleMqttConnected() {
   }
 }
 
-// Returns an MqttResponse to return for the message `data` received for `topic`
-MqttResponse IndyMqtt::GenerateMqttResponse(const std::string& topic, const std::string& data) {
+// Calls the handlers that have been registered for the MQTT_EVENT_DISCONNECTED event
+void IndyMqtt::HandleMqttDisconnected() {
+  // Call disconnected handlers
+  for (const DisconnectedHandler& handler : disconnectedHandlers) {
+    handler();
+  }
+}
+
+// Reconnects the client straight away when the network connects, rather than
+// when the client's reconnect timeout next passes
+void IndyMqtt::HandleNetworkConnected() {
+  ClientReconnect();
+}
+
+// Returns an MqttResponse to return for the message `data` received for
+// `topic`. Sets `ack_requested` if the message header has "ack": true.
+MqttResponse IndyMqtt::GenerateMqttResponse(const std::string& topic, const std::string& data, bool* ack_requested) {
   // Parse the received message JSON data
   JsonParser parser(data.c_str(), TAG, FormatString("JSON parsing failed for topic '%s'", topic.c_str()));
   std::string message = parser.Parse();
@@ -163,6 +124,25 @@ MqttResponse IndyMqtt::GenerateMqttResponse(const std::string& topic, const std:
   if (message_id.is_error)
     return MqttResponse(MQTT_BAD_REQUEST, message_id.message);
 
+  // Find the optional ack request, and the time the message was sent, in
+  // milliseconds since the epoch
+  const char* ACK = "ack";
+  const char* SENT_TIME = "sent_time";
+  double sent_time = 0;
+  for (const std::string& key : parser.LookupKeys(header.value)) {
+    if (key == ACK) {
+      JsonResult<bool> ack = parser.GetBool(header.value, HEADER, ACK);
+      if (ack.is_error)
+        return MqttResponse(MQTT_BAD_REQUEST, ack.message);
+      *ack_requested = ack.value;
+    } else if (key == SENT_TIME) {
+      JsonResult<double> sent = parser.GetDouble(header.value, HEADER, SENT_TIME);
+      if (sent.is_error)
+        return MqttResponse(MQTT_BAD_REQUEST, sent.message);
+      sent_time = sent.value;
+    }
+  }
+
   // Find the message content object
   JsonResult<cJSON *> content = parser.GetObject(nullptr, nullptr, "content");
   if (content.is_error) {
@@ -181,6 +161,15 @@ MqttResponse IndyMqtt::GenerateMqttResponse(const std::string& topic, const std:
       return response;
   }
 
+  // Work out the latency from when the message was sent, if time has synced
+  // so it can be compared with the sender's clock
+  if (sent_time > 0) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec >= TIME_SYNCED_MIN)
+      response.SetLatency((int64_t) now.tv_sec * 1000 + now.tv_usec / 1000 - (int64_t) sent_time);
+  }
+
   // Return the last good response
   return response;
 }
@@ -192,34 +181,15 @@ void IndyMqtt::PublishTaskFunction(void *arg) {
   indy_mqtt->PublishResponses();
 }
 
-// Publishes responses
+// Publishes queued responses. The publish call might block, but just this task will be blocked.
 void IndyMqtt::PublishResponses() {
-  // Acquire responses mutex
-  if (xSemaphoreTake(responses_mutex, MAX_WAIT) != pdTRUE) {
-    ESP_LOGE(TAG, "Failed to acquire reponses mutex for next response");
-    return;
-  }
-
-  // Find responses to publish
-  std::vector<MqttResponse> responses_to_publish;
-  for (auto& candidate : responses) {
-    if (!candidate.GetSent()) {
-      // Make local copies since memory allocated for originals needs to be
-      // released back on the main thread where it was allocated
-      candidate.SetSent(true);
-      responses_to_publish.push_back(candidate);  // Makes a local copy
-    }
-  }
-
-  // Release responses mutex
-  if (xSemaphoreGive(responses_mutex) != pdTRUE)
-    ESP_LOGE(TAG, "Failed to release reponses mutex for next response");
-
-  // Publish responses. The publish call might block, but just this task will be blocked.
-  std::string topic = FormatString("indy-switch/%s/ack", HOSTNAME);
-  for (auto& response : responses_to_publish) {
+  std::string device_topic = FormatString("indy-switch/%s/ack", HOSTNAME);
+  responses.Drain([this, &device_topic](MqttResponse& response) {
+    std::string topic = response.GetTopic().size() > 0 ? response.GetTopic() : device_topic;
     std::string json = response.Marshal();
-    int result = esp_mqtt_client_publish(client, topic.c_str(), json.c_str(), json.length(), ACK_QOS, false);
+    int result = ClientPublish(topic.c_str(), json, ACK_QOS);
+    if (result <= 0 || ACK_QOS == 0)
+      RemoveUnacked();  // There won't be an acknowledgement
     if (result > 0) {
       ESP_LOGI(TAG, "Published %d to %s:\n%s", result, topic.c_str(), json.c_str());
     } else {
@@ -229,42 +199,137 @@ void IndyMqtt::PublishResponses() {
       message += FormatString("\n%s", json.c_str());
       ESP_LOGE(TAG, "%s", message.c_str());
     }
-  }
+  });
 }
 
 // Handles the MQTT_EVENT_DATA event
 void IndyMqtt::HandleMqttData(const std::string& topic, const std::string& data) {
-  // Generate a response
-  MqttResponse response = GenerateMqttResponse(topic, data);
+  // Count the response before it's generated, so handlers can wait for it to be published
+  AddUnacked();
 
-  // Acquire the responses mutex
-  if (xSemaphoreTake(responses_mutex, MAX_WAIT) != pdTRUE) {
-    ESP_LOGE(TAG, "%s", response.CreateErrorMessage("Failed to acquire reponses mutex").c_str());
+  // Generate a response
+  bool ack_requested = false;
+  MqttResponse response = GenerateMqttResponse(topic, data, &ack_requested);
+
+  // Responses to shared topics are only published when asked for, and then
+  // batched with this device's other responses
+  auto shared = shared_ack_topics.find(topic);
+  if (shared != shared_ack_topics.end()) {
+    if (ack_requested)
+      AddSharedAck(shared->second, std::move(response));
+    else
+      RemoveUnacked();
     return;
   }
 
-  // Clean up any past responses
-  for (auto it = responses.begin(); it != responses.end() && it->GetSent();) {
-    ESP_LOGI(TAG, "Removing sent response '%s' from responses queue", it->GetId().c_str());
-    it = responses.erase(it);
+  // Hand the response to the publish task. The queue holds RESPONSES_MAX
+  // responses, so a burst of messages can't exhaust the heap.
+  if (!responses.Post(std::move(response))) {
+    std::string prefix = FormatString(
+      "Unable to queue response for send because %d responses are already queued", (int) RESPONSES_MAX);
+    ESP_LOGE(TAG, "%s", response.CreateErrorMessage(prefix).c_str());
+    RemoveUnacked();
   }
+}
 
-  // Add new response to responses queue. Limit size of queue since entries are later
-  // placed on task stack which is limited to TASK_STACK_DEPTH bytes.
-  if (responses.size() < RESPONSES_MAX) {
-    responses.push_back(response);
-  } else {
-    std::string prefix = FormatString(
-      "Unable to queue response for send because response queue has reached max size %d", RESPONSES_MAX);
+// Holds `response` to a shared topic, to be published to `ack_topic` with the
+// others that arrive before the ack window ends
+void IndyMqtt::AddSharedAck(const std::string& ack_topic, MqttResponse&& response) {
+  if (xSemaphoreTake(shared_acks_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire shared acks mutex to add response");
+    RemoveUnacked();
+    return;
+  }
+  std::vector<MqttResponse>& acks = shared_acks[ack_topic];
+  bool first = acks.empty();
+  bool full = acks.size() >= SHARED_ACKS_MAX;
+  if (!full)
+    acks.push_back(std::move(response));
+  if (xSemaphoreGive(shared_acks_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release shared acks mutex after adding response");
+
+  if (full) {
+    std::string prefix = FormatString("Dropped response because %d are waiting for %s",
+      (int) SHARED_ACKS_MAX, ack_topic.c_str());
     ESP_LOGE(TAG, "%s", response.CreateErrorMessage(prefix).c_str());
+    RemoveUnacked();
+  } else if (first && !PublishSharedAcksLater(ack_topic).IsStarted()) {
+    PublishSharedAcks(ack_topic);
+  }
+}
+
+// Publishes the responses held for `ack_topic` once the ack window, and a
+// random part of the spread, have passed. The random part keeps a fleet's
+// batches from reaching the broker at once.
+IndyCoroutine IndyMqtt::PublishSharedAcksLater(std::string ack_topic) {
+  uint32_t wait_ms = SHARED_ACK_WINDOW_MS + esp_random() % (SHARED_ACK_SPREAD_MS + 1);
+  co_await IndyDelay(pdMS_TO_TICKS(wait_ms));
+  PublishSharedAcks(ack_topic);
+}
+
+// Hands this device's responses held for `ack_topic` to the publish task as
+// one message
+void IndyMqtt::PublishSharedAcks(const std::string& ack_topic) {
+  std::vector<MqttResponse> acks;
+  if (xSemaphoreTake(shared_acks_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire shared acks mutex to publish responses");
+    return;
+  }
+  acks.swap(shared_acks[ack_topic]);
+  if (xSemaphoreGive(shared_acks_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release shared acks mutex after publishing responses");
+  if (acks.empty())
+    return;
+
+  // Create the content, with the host and each response
+  cJSON *content_json = cJSON_CreateObject();
+  cJSON_AddStringToObject(content_json, "host", HOSTNAME);
+  cJSON *acks_json = cJSON_AddArrayToObject(content_json, "acks");
+  for (MqttResponse& ack : acks)
+    cJSON_AddItemToArray(acks_json, ack.CreateJson());
+  char *content_str = cJSON_PrintUnformatted(content_json);
+  MqttResponse response = MqttResponse(MQTT_OK);
+  response.SetTopic(ack_topic);
+  response.SetContent(content_str);
+  cJSON_Delete(content_json);
+  cJSON_free(content_str);
+
+  // The one publish now stands for every response that was held
+  for (size_t ii = 1; ii < acks.size(); ii++)
+    RemoveUnacked();
+  if (!responses.Post(std::move(response))) {
+    ESP_LOGE(TAG, "Unable to queue %d responses for %s", (int) acks.size(), ack_topic.c_str());
+    RemoveUnacked();
   }
+}
 
-  // Release the responses mutex
-  if (xSemaphoreGive(responses_mutex) != pdTRUE)
-    ESP_LOGE(TAG, "%s", response.CreateErrorMessage("Failed to release reponses mutex").c_str());
+// Handles the MQTT_EVENT_PUBLISHED event, sent when the broker acknowledges a response
+void IndyMqtt::HandleMqttPublished(int message_id) {
+  RemoveUnacked();
+}
 
-  // Notify task that there's a response to publish
-  publish_task.TaskNotifyGive();
+// Counts a response that's waiting to be published
+void IndyMqtt::AddUnacked() {
+  if (xSemaphoreTake(unacked_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire unacked mutex to add response");
+    return;
+  }
+  if (unacked_count++ == 0)
+    publish_events.Clear(PUBLISHED_BIT);
+  if (xSemaphoreGive(unacked_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release unacked mutex after adding response");
+}
+
+// Stops counting a response, once it's been published or won't be
+void IndyMqtt::RemoveUnacked() {
+  if (xSemaphoreTake(unacked_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire unacked mutex to remove response");
+    return;
+  }
+  if (unacked_count > 0 && --unacked_count == 0)
+    publish_events.Set(PUBLISHED_BIT);
+  if (xSemaphoreGive(unacked_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release unacked mutex after removing response");
 }
 
 // Returns an error message for the response, that is `prefix` followed by the
@@ -295,15 +360,22 @@ void MqttResponse::AddContentToJson(cJSON *json) {
   }
 }
 
-// Returns the JSON for this response. Should only be called once if content is
-// not null, since content ownership is given to json and cleaned up.
-std::string MqttResponse::Marshal() {
-  // Create JSON
+// Returns the JSON for this response
+cJSON* MqttResponse::CreateJson() {
   cJSON *json = cJSON_CreateObject();
   cJSON_AddStringToObject(json, "id", id.c_str());
   cJSON_AddNumberToObject(json, "status_code", status_code);
   cJSON_AddStringToObject(json, "message", message.c_str());
+  if (latency_ms >= 0)
+    cJSON_AddNumberToObject(json, "latency_ms", latency_ms);
   AddContentToJson(json);
+  return json;
+}
+
+// Returns the JSON for this response, as a string
+std::string MqttResponse::Marshal() {
+  // Create JSON
+  cJSON *json = CreateJson();
 
   // Create string
   char *json_str = cJSON_Print(json);
@@ -311,7 +383,7 @@ std::string MqttResponse::Marshal() {
 
   // Clean up
   cJSON_Delete(json);
-  free(json_str);
+  cJSON_free(json_str);
 
   return result;
 }
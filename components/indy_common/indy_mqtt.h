@@ -3,8 +3,8 @@
 
 #include <cJSON.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
-#include <mqtt_client.h>
 
 #include <functional>
 #include <string>
@@ -12,9 +12,14 @@
 #include <memory>
 #include <vector>
 
+#include "indy_config.h"
+#include "indy_coroutine.h"
 #include "indy_json.h"
 #include "indy_util.h"
 #include "indy_task.h"
+#include "indy_work_queue.h"
+
+struct esp_mqtt_client;
 
 // Status codes returned with response
 enum MqttStatusCode {
@@ -38,10 +43,16 @@ class MqttResponse {
 
   void SetContent(const std::string& content) { this->content = content; }
 
-  bool GetSent() { return sent; }
-  void SetSent(bool sent) { this->sent = sent; }
+  // Topic to publish the response to, if not the device's ack topic
+  std::string GetTopic() { return topic; }
+  void SetTopic(const std::string& topic) { this->topic = topic; }
+
+  // Milliseconds from when the message was sent to when it was handled, if
+  // the message said when it was sent
+  void SetLatency(int64_t latency_ms) { this->latency_ms = latency_ms; }
 
   std::string Marshal();
+  cJSON* CreateJson();  // Caller owns returned memory
 
   bool IsOk() { return status_code == MQTT_OK; }
 
@@ -52,8 +63,8 @@ class MqttResponse {
   MqttStatusCode status_code = MQTT_NULL;
   std::string message = "";
   std::string content = "";
-
-  bool sent = false;
+  std::string topic = "";
+  int64_t latency_ms = -1;
 
   void AddContentToJson(cJSON *json);
 };
@@ -65,34 +76,90 @@ class IndyMqtt {
 
   // MQTT event handlers
   void HandleMqttConnected();
+  void HandleMqttDisconnected();
   void HandleMqttData(const std::string& topic, const std::string& data);
+  void HandleMqttPublished(int message_id);
+
+  // Network event handler
+  void HandleNetworkConnected();
+
+  // Waits for every response to messages received so far to be published and
+  // acknowledged by the broker. co_await returns nonzero if they were, or 0 if
+  // `timeout` passed first.
+  IndyWait WaitForResponsesPublished(TickType_t timeout) { return publish_events.Wait(PUBLISHED_BIT, false, timeout); }
 
   // Connected handlers
   using ConnectedHandler = std::function<void()>;
   void RegisterConnectedHandler(const ConnectedHandler& handler) { connectedHandlers.push_back(handler); }
 
+  // Disconnected handlers
+  using DisconnectedHandler = std::function<void()>;
+  void RegisterDisconnectedHandler(const DisconnectedHandler& handler) { disconnectedHandlers.push_back(handler); }
+
   // Subscriptions
   using DataHandler = std::function<MqttResponse(const cJSON*, JsonParser* parser)>;
   void SubscribeToTopic(const char* topic, const DataHandler& handler);
+  void UnsubscribeFromTopic(const char* topic);
+
+  // Subscriptions to topics shared by many devices, such as group topics. A
+  // response is only published when the message header has "ack": true, and
+  // then batched with this device's other responses for `ack_topic` handled
+  // within SHARED_ACK_WINDOW_MS. Each device publishes its own batch after a
+  // random delay, so acks from a fleet are spread out rather than combined.
+  void SubscribeToSharedTopic(const char* topic, const char* ack_topic, const DataHandler& handler);
 
  private:
   // MQTT client handle
-  esp_mqtt_client_handle_t client;
+  esp_mqtt_client* client = nullptr;
+
+  // MQTT client operations, which are implemented by indy_mqtt_client.cc on
+  // the ESP32 and indy_mqtt_client_host.cc on Linux hosts
+  void StartClient();
+  bool ClientSubscribe(const char* topic, int qos);
+  bool ClientUnsubscribe(const char* topic);
+  int ClientPublish(const char* topic, const std::string& data, int qos);
+  void ClientReconnect();
 
   // Handlers for MQTT_EVENT_DATA events
   std::map<std::string, std::vector<DataHandler>> dataHandlers;
 
+  // Ack topics of shared topics, by shared topic
+  std::map<std::string, std::string> shared_ack_topics;
+
+  // This device's responses to shared topics waiting to be published as one
+  // batch, by ack topic
+  static const size_t SHARED_ACKS_MAX = 16;
+  std::map<std::string, std::vector<MqttResponse>> shared_acks;
+  SemaphoreHandle_t shared_acks_mutex = nullptr;
+  StaticSemaphore_t shared_acks_mutex_buffer;
+  void AddSharedAck(const std::string& ack_topic, MqttResponse&& response);
+  void PublishSharedAcks(const std::string& ack_topic);
+  IndyCoroutine PublishSharedAcksLater(std::string ack_topic);
+
   // Handlers for the connected event
   std::vector<ConnectedHandler> connectedHandlers;
 
+  // Handlers for the disconnected event
+  std::vector<DisconnectedHandler> disconnectedHandlers;
+
   // Publish task
-  IndyTask publish_task = IndyTask("PublishTask");
+  IndyTask publish_task = IndyTask("PublishTask", PUBLISH_TASK_CONFIG);
   static void PublishTaskFunction(void *arg);
 
-  // Responses to send back to publisher
-  SemaphoreHandle_t responses_mutex;
-  std::vector<MqttResponse> responses;
-  MqttResponse GenerateMqttResponse(const std::string& topic, const std::string& data);
+  // Responses to send back to publisher, which are handed to the publish task
+  static const UBaseType_t RESPONSES_MAX = 32;
+  IndyWorkQueue<MqttResponse, RESPONSES_MAX> responses{&publish_task};
+
+  // Responses not yet acknowledged by the broker, counted from when their
+  // message is received. PUBLISHED_BIT is set when there are none.
+  static const EventBits_t PUBLISHED_BIT = BIT0;
+  IndyAwaitableEvents publish_events;
+  uint32_t unacked_count = 0;
+  SemaphoreHandle_t unacked_mutex = nullptr;
+  StaticSemaphore_t unacked_mutex_buffer;
+  void AddUnacked();
+  void RemoveUnacked();
+  MqttResponse GenerateMqttResponse(const std::string& topic, const std::string& data, bool* ack_requested);
   void PublishResponses();
 };
 
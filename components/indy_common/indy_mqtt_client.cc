@@ -0,0 +1,146 @@
+#include "indy_mqtt.h"
+
+#include <esp_log.h>
+#include <mqtt_client.h>
+
+#include <cstring>
+#include <string>
+
+#include "indy_config.h"
+
+// ESP32 MQTT client, using the ESP-MQTT service
+
+// Code is based on example code from
+// [ESP-MQTT SSL Sample application](https://github.com/espressif/esp-idf/tree/v5.1.1/examples/protocols/mqtt/ssl)
+
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+
+// The root cert used to create TLS client connections, from the file main/elias_alexan_org.pem
+extern const uint8_t indy_pem_start[]  asm("_binary_elias_alexan_org_pem_start");
+extern const uint8_t indy_pem_end[]    asm("_binary_elias_alexan_org_pem_end");
+
+namespace {
+  const char *TAG = "indy_mqtt";
+}
+
+// Handles events generated by the MQTT service
+static void MqttEventHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+  esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t) event_data;
+  IndyMqtt *indy_mqtt = reinterpret_cast<IndyMqtt*>(handler_args);
+  switch ((esp_mqtt_event_id_t) event_id) {
+  case MQTT_EVENT_CONNECTED:
+    ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+    indy_mqtt->HandleMqttConnected();
+    break;
+  case MQTT_EVENT_DISCONNECTED:
+    ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+    indy_mqtt->HandleMqttDisconnected();
+    break;
+  case MQTT_EVENT_SUBSCRIBED:
+    ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+    break;
+  case MQTT_EVENT_UNSUBSCRIBED:
+    ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
+    break;
+  case MQTT_EVENT_PUBLISHED:
+    ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+    indy_mqtt->HandleMqttPublished(event->msg_id);
+    break;
+  case MQTT_EVENT_DATA:
+    {
+      std::string topic(event->topic, event->topic_len);
+      ESP_LOGI(TAG, "MQTT_EVENT_DATA for topic %s", topic.c_str());
+      indy_mqtt->HandleMqttData(topic, std::string(event->data, event->data_len));
+    }
+    break;
+  case MQTT_EVENT_ERROR:
+    ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+    if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+      ESP_LOGI(TAG, "Last error code reported from esp-tls: 0x%x", event->error_handle->esp_tls_last_esp_err);
+      ESP_LOGI(TAG, "Last tls stack error number: 0x%x", event->error_handle->esp_tls_stack_err);
+      ESP_LOGI(TAG, "Last captured errno : %d (%s)",  event->error_handle->esp_transport_sock_errno,
+               strerror(event->error_handle->esp_transport_sock_errno));
+    } else if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+      ESP_LOGI(TAG, "Connection refused error: 0x%x", event->error_handle->connect_return_code);
+    } else {
+      ESP_LOGW(TAG, "Unknown error type: 0x%x", event->error_handle->error_type);
+    }
+    break;
+  default:
+    ESP_LOGI(TAG, "Other event id:%d", event->event_id);
+    break;
+  }
+}
+
+// Configures and starts the MQTT client
+void IndyMqtt::StartClient() {
+  // Configure the MQTT client
+  const esp_mqtt_client_config_t config = {
+    .broker = {
+      .address = {
+        .uri = MQTT_BROKER,
+      },
+      .verification = {
+        .certificate = (const char *) indy_pem_start
+      },
+    },
+    .credentials = {
+      .username = MQTT_USER,
+      .client_id = HOSTNAME,
+      .authentication = {
+        .password = MQTT_PASSWORD,
+      },
+     },
+  };
+  client = esp_mqtt_client_init(&config);
+  if (client == nullptr) {
+    ESP_LOGE(TAG, "Initialize client failed");
+    abort();
+  }
+
+  // Register the MQTT event handler
+  ESP_ERROR_CHECK(esp_mqtt_client_register_event(
+    client, (esp_mqtt_event_id_t) ESP_EVENT_ANY_ID, MqttEventHandler, this));
+
+  // Start the MQTT client
+  ESP_ERROR_CHECK(esp_mqtt_client_start(client));
+}
+
+// Subscribes the client to `topic`. Returns `false` if the subscribe failed.
+bool IndyMqtt::ClientSubscribe(const char* topic, int qos) {
+  int result = esp_mqtt_client_subscribe(client, topic, qos);
+  if (result == -2) {
+    ESP_LOGE(TAG, "Susbcribe to %s failed: full outbox", topic);
+    return false;
+  } else if (result <= 0) {
+    ESP_LOGE(TAG, "Susbcribe to %s failed: return code %d", topic, result);
+    return false;
+  }
+  return true;
+}
+
+// Unsubscribes the client from `topic`. Returns `false` if the unsubscribe
+// failed.
+bool IndyMqtt::ClientUnsubscribe(const char* topic) {
+  int result = esp_mqtt_client_unsubscribe(client, topic);
+  if (result <= 0) {
+    ESP_LOGE(TAG, "Unsubscribe from %s failed: return code %d", topic, result);
+    return false;
+  }
+  return true;
+}
+
+// Publishes `data` to `topic`. Returns the message id, or -1 if the publish
+// failed and -2 if the outbox is full.
+int IndyMqtt::ClientPublish(const char* topic, const std::string& data, int qos) {
+  return esp_mqtt_client_publish(client, topic, data.c_str(), data.length(), qos, false);
+}
+
+// Reconnects the client if it's waiting to reconnect, and so has lost its
+// connection. Does nothing if the client hasn't started.
+void IndyMqtt::ClientReconnect() {
+  if (client == nullptr)
+    return;
+  if (esp_mqtt_client_reconnect(client) == ESP_OK)
+    ESP_LOGI(TAG, "Reconnecting");
+}
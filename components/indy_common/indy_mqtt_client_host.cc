@@ -0,0 +1,43 @@
+#include "indy_mqtt.h"
+
+#include <esp_log.h>
+
+#include <string>
+
+// Host MQTT client, which doesn't connect to a broker. Subscribes always
+// succeed and published messages are logged and acknowledged straight away.
+
+namespace {
+  const char *TAG = "indy_mqtt";
+
+  int next_message_id = 1;
+}
+
+// Starts the host client, which is connected straight away
+void IndyMqtt::StartClient() {
+  ESP_LOGI(TAG, "Using host MQTT client");
+  HandleMqttConnected();
+}
+
+// Subscribes the client to `topic`. Always succeeds.
+bool IndyMqtt::ClientSubscribe(const char* topic, int qos) {
+  return true;
+}
+
+// Unsubscribes the client from `topic`. Always succeeds.
+bool IndyMqtt::ClientUnsubscribe(const char* topic) {
+  return true;
+}
+
+// Logs `data` for `topic`, and returns a message id
+int IndyMqtt::ClientPublish(const char* topic, const std::string& data, int qos) {
+  ESP_LOGI(TAG, "Host publish to %s: %s", topic, data.c_str());
+  int message_id = next_message_id++;
+  if (qos > 0)
+    HandleMqttPublished(message_id);
+  return message_id;
+}
+
+// Does nothing, since the host client never loses its connection
+void IndyMqtt::ClientReconnect() {
+}
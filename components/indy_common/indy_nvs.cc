@@ -3,6 +3,7 @@
 #include <esp_log.h>
 #include <nvs_flash.h>
 
+#include <cstring>
 #include <vector>
 
 #include "indy_util.h"
@@ -34,9 +35,101 @@ IndyNvs::~IndyNvs() {
   nvs_close(handle);
 }
 
+// Returns the NVS operations since boot
+IndyNvsStats IndyNvs::GetStats() {
+  return stats;
+}
+
+// Loads the values for all `keys` that are found in NVS into the struct
+// `values`, with one pass over the entries in NVS. Values for keys that
+// aren't found are left as is. Returns the number of keys found.
+int IndyNvs::LoadAll(const IndyNvsKey* keys, size_t key_count, void* values) {
+  uint8_t* values_bytes = reinterpret_cast<uint8_t*>(values);
+  int found_count = 0;
+
+  // Visit each entry in NVS
+  nvs_iterator_t iterator = nullptr;
+  esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, NVS_NAMESPACE, NVS_TYPE_ANY, &iterator);
+  while (err == ESP_OK) {
+    nvs_entry_info_t info;
+    nvs_entry_info(iterator, &info);
+
+    // Load the value if this is one of the keys
+    for (size_t ii = 0; ii < key_count; ii++) {
+      const IndyNvsKey& key = keys[ii];
+      if (strcmp(info.key, key.name) != 0)
+        continue;
+      if (LoadValue(key, info.type, values_bytes)) {
+        *reinterpret_cast<bool*>(values_bytes + key.found_offset) = true;
+        found_count++;
+      }
+      break;
+    }
+
+    err = nvs_entry_next(&iterator);
+  }
+  nvs_release_iterator(iterator);
+  if (err != ESP_ERR_NVS_NOT_FOUND)
+    ESP_LOGE(TAG, "Error iterating over NVS: %s", esp_err_to_name(err));
+
+  ESP_LOGI(TAG, "Loaded %d of %d keys", found_count, key_count);
+  return found_count;
+}
+
+// Loads the value for `key`, which has NVS type `type`, into the struct `values`.
+// Returns `false` if the value couldn't be loaded.
+bool IndyNvs::LoadValue(const IndyNvsKey& key, nvs_type_t type, uint8_t* values) {
+  stats.reads++;
+  void* value = values + key.value_offset;
+  esp_err_t err = ESP_ERR_INVALID_ARG;
+  switch (key.type) {
+    case IndyNvsType::BOOL:
+      if (type == NVS_TYPE_I8) {
+        int8_t result = 0;
+        err = nvs_get_i8(handle, key.name, &result);
+        if (err == ESP_OK)
+          *reinterpret_cast<bool*>(value) = result == 1;
+      }
+      break;
+    case IndyNvsType::INT:
+      if (type == NVS_TYPE_I32)
+        err = nvs_get_i32(handle, key.name, reinterpret_cast<int32_t*>(value));
+      break;
+    case IndyNvsType::TIME:
+      if (type == NVS_TYPE_I64) {
+        int64_t result = 0;
+        err = nvs_get_i64(handle, key.name, &result);
+        if (err == ESP_OK)
+          *reinterpret_cast<time_t*>(value) = (time_t) result;
+      }
+      break;
+    case IndyNvsType::STRING:
+      if (type == NVS_TYPE_STR) {
+        size_t length = key.value_size;
+        err = nvs_get_str(handle, key.name, reinterpret_cast<char*>(value), &length);
+      }
+      break;
+    case IndyNvsType::BLOB:
+      if (type == NVS_TYPE_BLOB) {
+        size_t length = key.value_size;
+        err = nvs_get_blob(handle, key.name, value, &length);
+        if (err == ESP_OK && length != key.value_size)
+          err = ESP_ERR_NVS_INVALID_LENGTH;
+      }
+      break;
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error loading '%s': %s", key.name, esp_err_to_name(err));
+    return false;
+  }
+  ESP_LOGD(TAG, "Loaded '%s'", key.name);
+  return true;
+}
+
 // Commits changes
 void IndyNvs::Commit() {
   ESP_LOGI(TAG, "Committing changes to NVS");
+  stats.commits++;
   esp_err_t err = nvs_commit(handle);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error committing to NVS: %s", esp_err_to_name(err));
@@ -46,6 +139,7 @@ void IndyNvs::Commit() {
 // Erases all values from NVS
 void IndyNvs::Reset() {
   ESP_LOGI(TAG, "Resetting");
+  stats.erases++;
   esp_err_t err = nvs_flash_erase();
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error erasing flash: %s", esp_err_to_name(err));
@@ -55,6 +149,7 @@ void IndyNvs::Reset() {
 // Stores boolean `value` to `key`
 void IndyNvs::WriteBool(const char* key, bool value) {
   ESP_LOGI(TAG, "Writing bool '%s': %d", key, value);
+  stats.writes++;
   esp_err_t err = nvs_set_i8(handle, key, value);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error writing to NVS: %s", esp_err_to_name(err));
@@ -67,6 +162,7 @@ void IndyNvs::WriteBool(const char* key, bool value) {
 bool IndyNvs::ReadBool(const char* key, bool* result) {
   // Read the value
   int8_t value = false;
+  stats.reads++;
   esp_err_t err = nvs_get_i8(handle, key, &value);
   if (err != ESP_OK) {
     if (err == ESP_ERR_NVS_NOT_FOUND) {
@@ -102,6 +198,7 @@ bool IndyNvs::ReadBool(const char* key) {
 // Stores `time` to `key`
 void IndyNvs::WriteTime(const char* key, time_t time) {
   ESP_LOGI(TAG, "Writing time '%s': %" PRId64, key, (int64_t) time);
+  stats.writes++;
   esp_err_t err = nvs_set_i64(handle, key, (int64_t) time);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error writing time: %s", esp_err_to_name(err));
@@ -113,6 +210,7 @@ void IndyNvs::WriteTime(const char* key, time_t time) {
 // `NULL_TIME` if there was an error or `key` was not found.
 bool IndyNvs::ReadTime(const char* key, time_t* result) {
   time_t time;
+  stats.reads++;
   esp_err_t err = nvs_get_i64(handle, key,  reinterpret_cast<int64_t*>(&time));
   if (err != ESP_OK) {
     if (err == ESP_ERR_NVS_NOT_FOUND) {
@@ -139,6 +237,7 @@ time_t IndyNvs::ReadTime(const char* key) {
 // Stores integer `value` to `key`
 void IndyNvs::WriteInt(const char* key, int32_t value) {
   ESP_LOGI(TAG, "Writing int '%s': %" PRIi32, key, value);
+  stats.writes++;
   esp_err_t err = nvs_set_i32(handle, key, value);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error writing int: %s", esp_err_to_name(err));
@@ -149,6 +248,7 @@ void IndyNvs::WriteInt(const char* key, int32_t value) {
 // the read was successful, or `false` otherwise. Default for `result` is
 // `0` if there was an error or `key` was not found.
 bool IndyNvs::ReadInt(const char* key, int32_t* result) {
+  stats.reads++;
   esp_err_t err = nvs_get_i32(handle, key, result);
   if (err != ESP_OK) {
     if (err == ESP_ERR_NVS_NOT_FOUND) {
@@ -174,6 +274,7 @@ int32_t IndyNvs::ReadInt(const char* key) {
 // Stores string `value` to `key`
 void IndyNvs::WriteString(const char* key, const char* value) {
   ESP_LOGI(TAG, "Writing string '%s': %s", key, value);
+  stats.writes++;
   esp_err_t err = nvs_set_str(handle, key, value);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error writing string: %s", esp_err_to_name(err));
@@ -186,6 +287,7 @@ void IndyNvs::WriteString(const char* key, const char* value) {
 bool IndyNvs::ReadString(const char* key, std::string* result) {
   // Determine buffer length needed
   size_t length;
+  stats.reads++;
   esp_err_t err = nvs_get_str(handle, key, nullptr, &length);
   if (err != ESP_OK) {
     if (err == ESP_ERR_NVS_NOT_FOUND) {
@@ -217,3 +319,36 @@ std::string IndyNvs::ReadString(const char* key) {
   ReadString(key, &result);
   return result;
 }
+
+// Stores `length` bytes of `value` to `key`
+void IndyNvs::WriteBlob(const char* key, const void* value, size_t length) {
+  ESP_LOGI(TAG, "Writing blob '%s': %d bytes", key, length);
+  stats.writes++;
+  esp_err_t err = nvs_set_blob(handle, key, value, length);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error writing blob: %s", esp_err_to_name(err));
+  }
+}
+
+// Reads blob found at `key` into `result`, which is `length` bytes long.
+// Returns `true` if the read was successful and the blob was exactly `length`
+// bytes, or `false` otherwise.
+bool IndyNvs::ReadBlob(const char* key, void* result, size_t length) {
+  size_t read_length = length;
+  stats.reads++;
+  esp_err_t err = nvs_get_blob(handle, key, result, &read_length);
+  if (err != ESP_OK) {
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+      ESP_LOGI(TAG, "No value found for blob '%s'", key);
+    } else {
+      ESP_LOGE(TAG, "Error reading blob '%s': %s", key, esp_err_to_name(err));
+    }
+    return false;
+  }
+  if (read_length != length) {
+    ESP_LOGE(TAG, "Read blob '%s' is %d bytes but expected %d", key, read_length, length);
+    return false;
+  }
+  ESP_LOGI(TAG, "Read blob '%s': %d bytes", key, read_length);
+  return true;
+}
@@ -1,17 +1,60 @@
 #ifndef COMPONENTS_INDY_COMMON_INDY_NVS_H_
 #define COMPONENTS_INDY_COMMON_INDY_NVS_H_
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <nvs_flash.h>
+#include <sdkconfig.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
+#include <map>
 #include <string>
+#include <vector>
 
-// Manages ESP32 NVS (non-volatile storage)
+// Identifies the type of value saved to an NVS key
+enum class IndyNvsType {
+  BOOL,    // bool, saved as i8
+  INT,     // int32_t
+  TIME,    // time_t, saved as i64
+  STRING,  // Null terminated char array
+  BLOB,    // Fixed size struct or array
+};
+
+// Describes a key saved to NVS, and where IndyNvs::LoadAll puts its value in a
+// struct of values. Create with INDY_NVS_KEY.
+struct IndyNvsKey {
+  const char* name;
+  IndyNvsType type;
+  size_t value_offset;  // Offset of the value field in the struct
+  size_t value_size;    // Size of the value field in the struct
+  size_t found_offset;  // Offset of the bool set to true when the key is found
+};
+
+// Creates an IndyNvsKey for `field` in `values_type`, which also needs to have
+// a bool `field`_found
+#define INDY_NVS_KEY(values_type, name, type, field) IndyNvsKey { \
+  name, type, offsetof(values_type, field), sizeof(values_type::field), offsetof(values_type, field##_found) }
+
+// Counts NVS operations, to measure flash traffic
+struct IndyNvsStats {
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+  uint32_t commits = 0;
+  uint32_t erases = 0;
+};
+
+// Manages ESP32 NVS (non-volatile storage). On Linux hosts values are kept in
+// memory instead, and saved on commit to the file named by the environment
+// variable INDY_NVS_PATH, if it's set.
 class IndyNvs {
  public:
   void Setup();
   ~IndyNvs();
 
+  int LoadAll(const IndyNvsKey* keys, size_t key_count, void* values);
+
   bool ReadBool(const char* key, bool* result);
   bool ReadBool(const char* key);
   void WriteBool(const char* key, bool value);
@@ -28,12 +71,41 @@ class IndyNvs {
   std::string ReadString(const char* key);
   void WriteString(const char* key, const char* value);
 
+  bool ReadBlob(const char* key, void* result, size_t length);
+  void WriteBlob(const char* key, const void* value, size_t length);
+
   void Commit();
 
   void Reset();
 
+  IndyNvsStats GetStats();
+
  private:
+  IndyNvsStats stats;
+
+#if CONFIG_IDF_TARGET_LINUX
+  // Values, by key
+  struct Entry {
+    nvs_type_t type;
+    std::vector<uint8_t> data;
+  };
+  std::map<std::string, Entry> entries;
+  std::string path;
+  bool Get(const char* key, nvs_type_t type, void* value, size_t length);
+  void Set(const char* key, nvs_type_t type, const void* value, size_t length);
+  void LoadFile();
+  void SaveFile();
+
+  // Mutex guarding entries and stats, since NVS is used from several tasks
+  SemaphoreHandle_t mutex = nullptr;
+  StaticSemaphore_t mutex_buffer;
+  bool Lock();
+  bool Unlock();
+#else
   nvs_handle_t handle = 0;
+#endif
+
+  bool LoadValue(const IndyNvsKey& key, nvs_type_t type, uint8_t* values);
 };
 
 #endif  // COMPONENTS_INDY_COMMON_INDY_NVS_H_
@@ -0,0 +1,342 @@
+#include "indy_nvs.h"
+
+#include <esp_log.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "indy_config.h"
+#include "indy_rtos.h"
+#include "indy_util.h"
+
+// Host version of IndyNvs, which keeps values in memory and optionally saves
+// them to a file on commit. Operations are counted in `stats` the same way as
+// on the ESP32, so flash traffic can be measured without hardware. The values
+// and stats are guarded by a mutex, since NVS is used from several tasks.
+
+namespace {
+  const char *TAG = "indy_nvs";
+  const char *PATH_ENV_VAR = "INDY_NVS_PATH";
+}
+
+// Sets up host NVS, loading values saved to the INDY_NVS_PATH file if there is one
+void IndyNvs::Setup() {
+  mutex = IndyRtos::CreateMutex(&mutex_buffer);
+  if (mutex == nullptr) {
+    ESP_LOGE(TAG, "Create NVS mutex failed");
+    abort();
+  }
+
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to set up");
+    return;
+  }
+  const char* env_path = getenv(PATH_ENV_VAR);
+  if (env_path != nullptr) {
+    path = env_path;
+    LoadFile();
+  }
+  ESP_LOGI(TAG, "Using host NVS with %zu values", entries.size());
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after setting up");
+}
+
+IndyNvs::~IndyNvs() {
+}
+
+// Loads values from the file at `path`. Each value is saved as its key, a
+// one byte type, a four byte length, and then its data. Caller must hold the
+// lock.
+void IndyNvs::LoadFile() {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    ESP_LOGI(TAG, "No NVS file found at %s", path.c_str());
+    return;
+  }
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  uint8_t type;
+  uint32_t length;
+  while (fread(key, sizeof(key), 1, file) == 1 && fread(&type, sizeof(type), 1, file) == 1 &&
+      fread(&length, sizeof(length), 1, file) == 1) {
+    Entry entry = { (nvs_type_t) type, std::vector<uint8_t>(length) };
+    if (length > 0 && fread(entry.data.data(), length, 1, file) != 1)
+      break;
+    key[NVS_KEY_NAME_MAX_SIZE - 1] = '\0';
+    entries[key] = entry;
+  }
+  fclose(file);
+}
+
+// Commits changes, by saving values to the file at `path` if there is one
+void IndyNvs::Commit() {
+  ESP_LOGI(TAG, "Committing changes to NVS");
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to commit");
+    return;
+  }
+  stats.commits++;
+  if (!path.empty())
+    SaveFile();
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after committing");
+}
+
+// Saves values to the file at `path`, in the format LoadFile reads. Caller
+// must hold the lock.
+void IndyNvs::SaveFile() {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Error opening NVS file %s", path.c_str());
+    return;
+  }
+  for (const auto& [name, entry] : entries) {
+    char key[NVS_KEY_NAME_MAX_SIZE] = {};
+    strncpy(key, name.c_str(), sizeof(key) - 1);
+    uint8_t type = entry.type;
+    uint32_t length = entry.data.size();
+    fwrite(key, sizeof(key), 1, file);
+    fwrite(&type, sizeof(type), 1, file);
+    fwrite(&length, sizeof(length), 1, file);
+    fwrite(entry.data.data(), length, 1, file);
+  }
+  fclose(file);
+}
+
+// Erases all values
+void IndyNvs::Reset() {
+  ESP_LOGI(TAG, "Resetting");
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to reset");
+    return;
+  }
+  stats.erases++;
+  entries.clear();
+  if (!path.empty())
+    remove(path.c_str());
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after resetting");
+}
+
+// Returns the NVS operations since boot
+IndyNvsStats IndyNvs::GetStats() {
+  IndyNvsStats result;
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to get stats");
+    return result;
+  }
+  result = stats;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after getting stats");
+  return result;
+}
+
+bool IndyNvs::Lock() {
+  // Acquire mutex
+  return xSemaphoreTake(mutex, MAX_WAIT) == pdTRUE;
+}
+
+bool IndyNvs::Unlock() {
+  // Release mutex
+  return xSemaphoreGive(mutex) == pdTRUE;
+}
+
+// Copies the value for `key` to `value`, which is `length` bytes long.
+// Returns `false` if there's no value for `key` with type `type` and length `length`.
+bool IndyNvs::Get(const char* key, nvs_type_t type, void* value, size_t length) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to read '%s'", key);
+    return false;
+  }
+  stats.reads++;
+  auto it = entries.find(key);
+  bool found = it != entries.end() && it->second.type == type && it->second.data.size() == length;
+  if (found)
+    memcpy(value, it->second.data.data(), length);
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after reading '%s'", key);
+  return found;
+}
+
+// Saves the `length` bytes in `value` to `key`
+void IndyNvs::Set(const char* key, nvs_type_t type, const void* value, size_t length) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(value);
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to write '%s'", key);
+    return;
+  }
+  stats.writes++;
+  entries[key] = Entry { type, std::vector<uint8_t>(bytes, bytes + length) };
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after writing '%s'", key);
+}
+
+// Loads the values for all `keys` that are found into the struct `values`.
+// Returns the number of keys found.
+int IndyNvs::LoadAll(const IndyNvsKey* keys, size_t key_count, void* values) {
+  // Find the type of each key that has a value. The lock isn't held while
+  // loading, since each read takes it.
+  std::vector<std::pair<const IndyNvsKey*, nvs_type_t>> found_keys;
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to load keys");
+    return 0;
+  }
+  for (size_t ii = 0; ii < key_count; ii++) {
+    auto it = entries.find(keys[ii].name);
+    if (it != entries.end())
+      found_keys.emplace_back(&keys[ii], it->second.type);
+  }
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after finding keys");
+
+  uint8_t* values_bytes = reinterpret_cast<uint8_t*>(values);
+  int found_count = 0;
+  for (const auto& [key, type] : found_keys) {
+    if (LoadValue(*key, type, values_bytes)) {
+      *reinterpret_cast<bool*>(values_bytes + key->found_offset) = true;
+      found_count++;
+    }
+  }
+  ESP_LOGI(TAG, "Loaded %d of %zu keys", found_count, key_count);
+  return found_count;
+}
+
+// Loads the value for `key`, which has NVS type `type`, into the struct `values`.
+// Returns `false` if the value couldn't be loaded.
+bool IndyNvs::LoadValue(const IndyNvsKey& key, nvs_type_t type, uint8_t* values) {
+  void* value = values + key.value_offset;
+  bool loaded = false;
+  switch (key.type) {
+    case IndyNvsType::BOOL:
+      loaded = ReadBool(key.name, reinterpret_cast<bool*>(value));
+      break;
+    case IndyNvsType::INT:
+      loaded = ReadInt(key.name, reinterpret_cast<int32_t*>(value));
+      break;
+    case IndyNvsType::TIME:
+      loaded = ReadTime(key.name, reinterpret_cast<time_t*>(value));
+      break;
+    case IndyNvsType::STRING: {
+      std::string string;
+      loaded = type == NVS_TYPE_STR && ReadString(key.name, &string) && string.size() < key.value_size;
+      if (loaded)
+        memcpy(value, string.c_str(), string.size() + 1);
+      break;
+    }
+    case IndyNvsType::BLOB:
+      loaded = Get(key.name, NVS_TYPE_BLOB, value, key.value_size);
+      break;
+  }
+  if (!loaded)
+    ESP_LOGE(TAG, "Error loading '%s'", key.name);
+  return loaded;
+}
+
+// Stores boolean `value` to `key`
+void IndyNvs::WriteBool(const char* key, bool value) {
+  int8_t byte = value;
+  Set(key, NVS_TYPE_I8, &byte, sizeof(byte));
+}
+
+// Reads boolean found at `key` and saves it to `result`. Returns `true` if
+// the read was successful, or `false` otherwise.
+bool IndyNvs::ReadBool(const char* key, bool* result) {
+  int8_t byte = 0;
+  bool found = Get(key, NVS_TYPE_I8, &byte, sizeof(byte));
+  *result = found && byte == 1;
+  return found;
+}
+
+// Returns boolean found at `key`, or `false` if not found
+bool IndyNvs::ReadBool(const char* key) {
+  bool result;
+  ReadBool(key, &result);
+  return result;
+}
+
+// Stores `time` to `key`
+void IndyNvs::WriteTime(const char* key, time_t time) {
+  int64_t value = time;
+  Set(key, NVS_TYPE_I64, &value, sizeof(value));
+}
+
+// Reads time found at `key` and saves it to `result`. Returns `true` if the
+// read was successful, or `false` otherwise.
+bool IndyNvs::ReadTime(const char* key, time_t* result) {
+  int64_t value;
+  bool found = Get(key, NVS_TYPE_I64, &value, sizeof(value));
+  *result = found ? (time_t) value : NULL_TIME;
+  return found;
+}
+
+// Returns time found at `key`, or `NULL_TIME` if not found
+time_t IndyNvs::ReadTime(const char* key) {
+  time_t result;
+  ReadTime(key, &result);
+  return result;
+}
+
+// Stores integer `value` to `key`
+void IndyNvs::WriteInt(const char* key, int32_t value) {
+  Set(key, NVS_TYPE_I32, &value, sizeof(value));
+}
+
+// Reads integer found at `key` and saves it to `result`. Returns `true` if
+// the read was successful, or `false` otherwise.
+bool IndyNvs::ReadInt(const char* key, int32_t* result) {
+  bool found = Get(key, NVS_TYPE_I32, result, sizeof(*result));
+  if (!found)
+    *result = 0;
+  return found;
+}
+
+// Returns integer found at `key`, or `0` if not found
+int32_t IndyNvs::ReadInt(const char* key) {
+  int32_t result;
+  ReadInt(key, &result);
+  return result;
+}
+
+// Stores string `value` to `key`
+void IndyNvs::WriteString(const char* key, const char* value) {
+  Set(key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+// Reads string found at `key` and saves it to `result`. Returns `true` if
+// the read was successful, or `false` otherwise.
+bool IndyNvs::ReadString(const char* key, std::string* result) {
+  *result = "";
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to read '%s'", key);
+    return false;
+  }
+  stats.reads++;
+  auto it = entries.find(key);
+  bool found = it != entries.end() && it->second.type == NVS_TYPE_STR;
+  if (found)
+    *result = std::string(reinterpret_cast<const char*>(it->second.data.data()));
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after reading '%s'", key);
+  return found;
+}
+
+// Returns string found at `key`, or `""` if not found
+std::string IndyNvs::ReadString(const char* key) {
+  std::string result;
+  ReadString(key, &result);
+  return result;
+}
+
+// Stores `length` bytes of `value` to `key`
+void IndyNvs::WriteBlob(const char* key, const void* value, size_t length) {
+  Set(key, NVS_TYPE_BLOB, value, length);
+}
+
+// Reads blob found at `key` into `result`, which is `length` bytes long.
+// Returns `true` if the read was successful, or `false` otherwise.
+bool IndyNvs::ReadBlob(const char* key, void* result, size_t length) {
+  return Get(key, NVS_TYPE_BLOB, result, length);
+}
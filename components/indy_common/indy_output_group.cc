@@ -0,0 +1,63 @@
+#include "indy_output_group.h"
+
+#include <driver/gpio.h>
+#include <esp_log.h>
+#include <soc/gpio_reg.h>
+#include <soc/soc.h>
+
+namespace {
+  const char *TAG = "indy_output_group";
+}
+
+// Adds `pin` to the group and returns its bit, or 0 for GPIO_NUM_NC
+uint32_t IndyOutputGroup::AddPin(gpio_num_t pin) {
+  if (pin == GPIO_NUM_NC)
+    return 0;
+  if (pin_count == PINS_MAX) {
+    ESP_LOGE(TAG, "Too many pins in output group");
+    abort();
+  }
+  pins[pin_count] = pin;
+  gpio_mask |= 1ULL << pin;
+  return 1U << pin_count++;
+}
+
+// Sets up the GPIOs for digital output, all starting low
+void IndyOutputGroup::Setup() {
+  if (gpio_mask == 0)
+    return;
+
+  // Configure pins for output.
+  gpio_config_t io_conf;
+  io_conf.intr_type = GPIO_INTR_DISABLE;         // Disable interrupt
+  io_conf.mode = GPIO_MODE_OUTPUT;               // Set as output mode
+  io_conf.pin_bit_mask = gpio_mask;              // Bitmask of the pins
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;  // Disable pull-down
+  io_conf.pull_up_en = GPIO_PULLUP_DISABLE;      // Disable pull-up
+  ESP_ERROR_CHECK(gpio_config(&io_conf));
+  Write(0, (1ULL << pin_count) - 1);
+}
+
+// Sets the pins with bits in `high` high, and the pins with bits in `low` low.
+// GPIOs 0-31 and 32-39 are in separate banks, and each bank has registers that
+// set and clear any of its outputs in one write, so pins in the same bank
+// change within a few cycles of each other.
+void IndyOutputGroup::Write(uint32_t high, uint32_t low) {
+  uint64_t set_mask = 0;
+  uint64_t clear_mask = 0;
+  for (int ii = 0; ii < pin_count; ii++) {
+    uint32_t bit = 1U << ii;
+    if (high & bit)
+      set_mask |= 1ULL << pins[ii];
+    else if (low & bit)
+      clear_mask |= 1ULL << pins[ii];
+  }
+  if ((uint32_t) set_mask != 0)
+    REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t) set_mask);
+  if ((uint32_t) clear_mask != 0)
+    REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t) clear_mask);
+  if ((uint32_t) (set_mask >> 32) != 0)
+    REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t) (set_mask >> 32));
+  if ((uint32_t) (clear_mask >> 32) != 0)
+    REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t) (clear_mask >> 32));
+}
@@ -0,0 +1,32 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_OUTPUT_GROUP_H_
+#define COMPONENTS_INDY_COMMON_INDY_OUTPUT_GROUP_H_
+
+#include <array>
+#include <cstdint>
+
+#include "indy_gpio.h"
+
+// Manages a group of ESP32 GPIOs used for digital output, such as the relays
+// and LEDs of several switch channels. Pins are identified by the bit AddPin
+// returns, and any number of them change together with one call to Write.
+class IndyOutputGroup {
+ public:
+  static const int PINS_MAX = 32;
+
+  // Adds `pin` to the group and returns its bit, or 0 for GPIO_NUM_NC. Call before Setup.
+  uint32_t AddPin(gpio_num_t pin);
+
+  void Setup();
+
+  // Sets the pins with bits in `high` high, and the pins with bits in `low` low
+  void Write(uint32_t high, uint32_t low);
+
+ private:
+  std::array<gpio_num_t, PINS_MAX> pins = {};
+  int pin_count = 0;
+
+  // GPIO masks of all pins, for configuring them
+  uint64_t gpio_mask = 0;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_OUTPUT_GROUP_H_
@@ -0,0 +1,44 @@
+#include "indy_output_group.h"
+
+#include <esp_log.h>
+
+#include "indy_host_gpio.h"
+
+// Host version of IndyOutputGroup, which sets the levels of simulated pins
+
+namespace {
+  const char *TAG = "indy_output_group";
+}
+
+// Adds `pin` to the group and returns its bit, or 0 for GPIO_NUM_NC
+uint32_t IndyOutputGroup::AddPin(gpio_num_t pin) {
+  if (pin == GPIO_NUM_NC)
+    return 0;
+  if (pin_count == PINS_MAX) {
+    ESP_LOGE(TAG, "Too many pins in output group");
+    abort();
+  }
+  pins[pin_count] = pin;
+  gpio_mask |= 1ULL << pin;
+  return 1U << pin_count++;
+}
+
+// Sets up the simulated pins for output, all starting low
+void IndyOutputGroup::Setup() {
+  IndyHostGpio::GetInstance().SetLevels(0, gpio_mask);
+}
+
+// Sets the pins with bits in `high` high, and the pins with bits in `low` low,
+// all at the same time
+void IndyOutputGroup::Write(uint32_t high, uint32_t low) {
+  uint64_t set_mask = 0;
+  uint64_t clear_mask = 0;
+  for (int ii = 0; ii < pin_count; ii++) {
+    uint32_t bit = 1U << ii;
+    if (high & bit)
+      set_mask |= 1ULL << pins[ii];
+    else if (low & bit)
+      clear_mask |= 1ULL << pins[ii];
+  }
+  IndyHostGpio::GetInstance().SetLevels(set_mask, clear_mask);
+}
@@ -0,0 +1,221 @@
+#include "indy_peer.h"
+
+#include <arpa/inet.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "indy_config.h"
+#include "indy_task_manager.h"
+
+namespace {
+  const char *TAG = "indy_peer";
+
+  const uint16_t MESSAGE_MAGIC = 0x5049;  // "IP"
+  const uint8_t MESSAGE_VERSION = 1;
+
+  // Interface to multicast on. Linux hosts use loopback, so two instances on
+  // one host can follow each other.
+#if CONFIG_IDF_TARGET_LINUX
+  const char* const INTERFACE_ADDRESS = "127.0.0.1";
+#else
+  const char* const INTERFACE_ADDRESS = "0.0.0.0";
+#endif
+}
+
+// Joins the multicast group and starts the send and receive tasks. Peers are
+// optional, so a failure is logged and the device carries on without them.
+void IndyPeer::Setup() {
+  boot_id = esp_random();
+  if (!OpenSocket())
+    return;
+
+  outgoing.Setup();
+  send_task.CreateTask(SendTaskFunction, this);
+  receive_task.CreateTask(ReceiveTaskFunction, this);
+  receive_task.TaskNotifyGive();  // Start receiving
+  atomic_store(&started, true);
+  ESP_LOGI(TAG, "Joined %s:%d", PEER_MULTICAST_ADDRESS, PEER_PORT);
+}
+
+// Opens the socket and joins the multicast group. Returns `false` if that
+// failed.
+bool IndyPeer::OpenSocket() {
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    ESP_LOGE(TAG, "Create socket failed: errno %d", errno);
+    return false;
+  }
+
+  // Let other instances on a Linux host bind the same port
+  int reuse = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  // Bind to the port
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(PEER_PORT);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  bool ok = bind(sock, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0;
+
+  // Join the group, and keep datagrams to it on the LAN
+  struct ip_mreq membership = {};
+  membership.imr_multiaddr.s_addr = inet_addr(PEER_MULTICAST_ADDRESS);
+  membership.imr_interface.s_addr = inet_addr(INTERFACE_ADDRESS);
+  struct in_addr interface = membership.imr_interface;
+  uint8_t ttl = 1;
+  uint8_t loop = 1;
+  ok = ok &&
+    setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) == 0 &&
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) == 0 &&
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == 0 &&
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == 0;
+
+  // Time out receives, so the receive task sees when it's time to end
+  struct timeval timeout = {};
+  timeout.tv_sec = PEER_RECEIVE_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (PEER_RECEIVE_TIMEOUT_MS % 1000) * 1000;
+  ok = ok && setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+
+  if (!ok) {
+    ESP_LOGE(TAG, "Join %s:%d failed: errno %d", PEER_MULTICAST_ADDRESS, PEER_PORT, errno);
+    close(sock);
+    sock = -1;
+    return false;
+  }
+
+  group_address.sin_family = AF_INET;
+  group_address.sin_port = htons(PEER_PORT);
+  group_address.sin_addr.s_addr = membership.imr_multiaddr.s_addr;
+  return true;
+}
+
+// Sends peers the new state of switch `channel`. Doesn't block, so it can be
+// called from a timer callback. Does nothing until Setup has joined the group.
+void IndyPeer::Send(int channel, bool on) {
+  if (!atomic_load(&started))
+    return;
+
+  Message message = {};
+  message.magic = htons(MESSAGE_MAGIC);
+  message.version = MESSAGE_VERSION;
+  message.channel = (uint8_t) channel;
+  message.on = on ? 1 : 0;
+  message.boot_id = htonl(boot_id);
+  message.seq = htonl(atomic_fetch_add(&next_seq, 1));
+  strncpy(message.host, HOSTNAME, HOST_SIZE - 1);
+  if (!outgoing.Post(std::move(message)))
+    atomic_fetch_add(&send_failures, 1);
+}
+
+// Sends the queued datagrams, each PEER_SEND_COUNT times
+void IndyPeer::SendTaskFunction(void *arg) {
+  IndyPeer* peer = reinterpret_cast<IndyPeer*>(arg);
+  peer->outgoing.Drain([peer](Message& message) {
+    for (int ii = 0; ii < PEER_SEND_COUNT; ii++) {
+      if (ii > 0)
+        vTaskDelay(pdMS_TO_TICKS(PEER_REPEAT_MS));
+      ssize_t result = sendto(peer->sock, &message, sizeof(message), 0,
+        reinterpret_cast<struct sockaddr*>(&peer->group_address), sizeof(peer->group_address));
+      atomic_fetch_add(result == sizeof(message) ? &peer->sent : &peer->send_failures, 1);
+    }
+  });
+}
+
+void IndyPeer::ReceiveTaskFunction(void *arg) {
+  reinterpret_cast<IndyPeer*>(arg)->Receive();
+}
+
+// Receives datagrams and calls the state handlers, until the task manager
+// says it's time to end
+void IndyPeer::Receive() {
+  Message message;
+  while (!IndyTaskManager::GetInstance().Exiting()) {
+    ssize_t length = recv(sock, &message, sizeof(message), 0);
+    if (length < 0) {
+      // Wait before trying again, unless the receive timed out
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        vTaskDelay(pdMS_TO_TICKS(PEER_RECEIVE_TIMEOUT_MS));
+      continue;
+    }
+    int64_t start_time = esp_timer_get_time();
+
+    // Check the datagram. This device's own datagrams, and repeats, are dropped.
+    message.magic = ntohs(message.magic);
+    if (length != sizeof(message) || message.magic != MESSAGE_MAGIC || message.version != MESSAGE_VERSION) {
+      atomic_fetch_add(&invalid, 1);
+      continue;
+    }
+    message.boot_id = ntohl(message.boot_id);
+    message.seq = ntohl(message.seq);
+    if (message.boot_id == boot_id)
+      continue;
+    if (IsRepeat(message)) {
+      atomic_fetch_add(&repeats, 1);
+      continue;
+    }
+    atomic_fetch_add(&received, 1);
+
+    // Call state handlers, and time how long the outputs took to change. The
+    // log waits until after, so it doesn't delay the change.
+    message.host[HOST_SIZE - 1] = '\0';
+    IndyPeerState state = { message.host, message.channel, message.on != 0 };
+    int64_t change_time = 0;
+    for (const StateHandler& handler : handlers) {
+      int64_t handler_change_time = handler(state);
+      if (handler_change_time > change_time)
+        change_time = handler_change_time;
+    }
+    if (change_time != 0) {
+      portENTER_CRITICAL(&processing_latency_spinlock);
+      processing_latency.Add((uint32_t) (change_time - start_time));
+      portEXIT_CRITICAL(&processing_latency_spinlock);
+    }
+    ESP_LOGI(TAG, "%s turned switch %d %s", state.host, state.channel, state.on ? "on" : "off");
+  }
+}
+
+// Returns whether `message` was already received, or is older than one that
+// was. Otherwise records it as the latest from its sender, replacing the
+// sender heard from least recently if there's no room.
+bool IndyPeer::IsRepeat(const Message& message) {
+  Sender* oldest = &senders[0];
+  for (Sender& sender : senders) {
+    if (sender.receive_time != 0 && sender.boot_id == message.boot_id) {
+      if ((int32_t) (message.seq - sender.seq) <= 0)
+        return true;
+      sender.seq = message.seq;
+      sender.receive_time = esp_timer_get_time();
+      return false;
+    }
+    if (sender.receive_time < oldest->receive_time)
+      oldest = &sender;
+  }
+  oldest->boot_id = message.boot_id;
+  oldest->seq = message.seq;
+  oldest->receive_time = esp_timer_get_time();
+  return false;
+}
+
+// Returns JSON with datagrams sent and received, and how long received
+// datagrams took to change an output
+cJSON* IndyPeer::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddBoolToObject(json, "started", atomic_load(&started));
+  cJSON_AddNumberToObject(json, "sent", atomic_load(&sent));
+  cJSON_AddNumberToObject(json, "send_failures", atomic_load(&send_failures));
+  cJSON_AddNumberToObject(json, "received", atomic_load(&received));
+  cJSON_AddNumberToObject(json, "repeats", atomic_load(&repeats));
+  cJSON_AddNumberToObject(json, "invalid", atomic_load(&invalid));
+  portENTER_CRITICAL(&processing_latency_spinlock);
+  IndyHistogram processing_latency_copy = processing_latency;
+  portEXIT_CRITICAL(&processing_latency_spinlock);
+  cJSON_AddItemToObject(json, "processing_us", processing_latency_copy.CreateJson());
+  return json;
+}
@@ -0,0 +1,102 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_PEER_H_
+#define COMPONENTS_INDY_COMMON_INDY_PEER_H_
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "indy_config.h"
+#include "indy_histogram.h"
+#include "indy_task.h"
+#include "indy_work_queue.h"
+
+// A switch state change received from a peer
+struct IndyPeerState {
+  const char* host;  // Only valid during the handler call
+  int channel;
+  bool on;
+};
+
+// Shares switch state changes with other devices on the LAN as small UDP
+// multicast datagrams, so a switch can follow another without a round trip
+// through the MQTT broker. Multicast over wifi isn't acknowledged, so each
+// change is sent PEER_SEND_COUNT times, and receivers drop the repeats by
+// sequence number. Datagrams are received on a task of their own, which calls
+// the state handlers straight away.
+class IndyPeer {
+ public:
+  void Setup();
+
+  void Send(int channel, bool on);
+
+  // State handlers, called on the receive task. Each returns when it changed
+  // an output, in microseconds since boot, or 0 if it didn't.
+  using StateHandler = std::function<int64_t(const IndyPeerState&)>;
+  void RegisterStateHandler(const StateHandler& handler) { handlers.push_back(handler); }
+
+  cJSON* CreateJson();  // Caller owns returned memory
+
+ private:
+  // A datagram. Multi-byte fields are in network byte order on the wire, and
+  // converted to host order on receive.
+  static const size_t HOST_SIZE = 32;
+  struct Message {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t channel;
+    uint8_t on;
+    uint8_t reserved[3];
+    uint32_t boot_id;       // Random for each boot, so devices can tell their own datagrams
+    uint32_t seq;           // Counts the sender's changes
+    char host[HOST_SIZE];   // Null terminated
+  };
+  static_assert(sizeof(Message) == 48, "Peer datagrams should be 48 bytes");
+
+  int sock = -1;
+  struct sockaddr_in group_address = {};
+  uint32_t boot_id = 0;
+  atomic_uint next_seq = ATOMIC_VAR_INIT(1);
+  atomic_bool started = ATOMIC_VAR_INIT(false);
+  bool OpenSocket();
+
+  // Send task, and the datagrams queued for it. Send never blocks, so changes
+  // can be sent from the button's debounce timer.
+  IndyTask send_task = IndyTask("PeerSendTask", PEER_SEND_TASK_CONFIG);
+  IndyWorkQueue<Message, 8> outgoing{&send_task};
+  static void SendTaskFunction(void *arg);
+
+  // Receive task
+  IndyTask receive_task = IndyTask("PeerReceiveTask", PEER_RECEIVE_TASK_CONFIG);
+  static void ReceiveTaskFunction(void *arg);
+  void Receive();
+  bool IsRepeat(const Message& message);
+
+  // The last sequence number received from each sender, so repeats and late
+  // datagrams are dropped. Only used on the receive task.
+  struct Sender {
+    uint32_t boot_id;
+    uint32_t seq;
+    int64_t receive_time;  // Microseconds since boot
+  };
+  static const size_t SENDERS_MAX = 16;
+  std::array<Sender, SENDERS_MAX> senders = {};
+
+  std::vector<StateHandler> handlers;
+
+  // Stats, updated on the send and receive tasks and read for status
+  atomic_uint sent = ATOMIC_VAR_INIT(0);
+  atomic_uint send_failures = ATOMIC_VAR_INIT(0);
+  atomic_uint received = ATOMIC_VAR_INIT(0);
+  atomic_uint repeats = ATOMIC_VAR_INIT(0);
+  atomic_uint invalid = ATOMIC_VAR_INIT(0);
+  IndyHistogram processing_latency;  // From receiving a datagram to an output changing, in microseconds
+  portMUX_TYPE processing_latency_spinlock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_PEER_H_
@@ -0,0 +1,142 @@
+#include "indy_rtos.h"
+
+#include <esp_log.h>
+
+#include "indy_config.h"
+#include "indy_memory.h"
+
+namespace {
+  const char *TAG = "indy_rtos";
+
+#ifdef INDY_STATIC_ALLOCATION
+  const bool STATIC_ALLOCATION = true;
+
+  // Task stacks. Stacks are only allocated during setup, so they're never freed.
+  alignas(16) uint8_t stack_pool[INDY_TASK_STACK_POOL_SIZE];
+  size_t stack_pool_used = 0;
+#else
+  const bool STATIC_ALLOCATION = false;
+#endif
+
+  // Drop in free heap while creating objects, in bytes
+  uint32_t heap_used = 0;
+  uint32_t object_count = 0;
+}
+
+// Creates a mutex
+SemaphoreHandle_t IndyRtos::CreateMutex(StaticSemaphore_t* buffer) {
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+#ifdef INDY_STATIC_ALLOCATION
+  SemaphoreHandle_t handle = xSemaphoreCreateMutexStatic(buffer);
+#else
+  SemaphoreHandle_t handle = xSemaphoreCreateMutex();
+#endif
+  RecordHeapUsed(free_heap);
+  return handle;
+}
+
+// Creates a counting semaphore
+SemaphoreHandle_t IndyRtos::CreateCounting(
+    UBaseType_t max_count, UBaseType_t initial_count, StaticSemaphore_t* buffer) {
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+#ifdef INDY_STATIC_ALLOCATION
+  SemaphoreHandle_t handle = xSemaphoreCreateCountingStatic(max_count, initial_count, buffer);
+#else
+  SemaphoreHandle_t handle = xSemaphoreCreateCounting(max_count, initial_count);
+#endif
+  RecordHeapUsed(free_heap);
+  return handle;
+}
+
+// Creates a queue of `length` items of `item_size` bytes. `storage` needs to
+// be at least `length` * `item_size` bytes.
+QueueHandle_t IndyRtos::CreateQueue(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer) {
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+#ifdef INDY_STATIC_ALLOCATION
+  QueueHandle_t handle = xQueueCreateStatic(length, item_size, storage, buffer);
+#else
+  QueueHandle_t handle = xQueueCreate(length, item_size);
+#endif
+  RecordHeapUsed(free_heap);
+  return handle;
+}
+
+// Creates an event group
+EventGroupHandle_t IndyRtos::CreateEventGroup(StaticEventGroup_t* buffer) {
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+#ifdef INDY_STATIC_ALLOCATION
+  EventGroupHandle_t handle = xEventGroupCreateStatic(buffer);
+#else
+  EventGroupHandle_t handle = xEventGroupCreate();
+#endif
+  RecordHeapUsed(free_heap);
+  return handle;
+}
+
+// Creates a software timer
+TimerHandle_t IndyRtos::CreateTimer(const char* name, TickType_t period, UBaseType_t auto_reload, void* id,
+    TimerCallbackFunction_t callback, StaticTimer_t* buffer) {
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+#ifdef INDY_STATIC_ALLOCATION
+  TimerHandle_t handle = xTimerCreateStatic(name, period, auto_reload, id, callback, buffer);
+#else
+  TimerHandle_t handle = xTimerCreate(name, period, auto_reload, id, callback);
+#endif
+  RecordHeapUsed(free_heap);
+  return handle;
+}
+
+// Creates a task pinned to `core`. Returns nullptr if the task couldn't be created.
+TaskHandle_t IndyRtos::CreateTask(TaskFunction_t function, const char* name, uint32_t stack_depth, void* parameters,
+    UBaseType_t priority, BaseType_t core, StaticTask_t* buffer) {
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+  TaskHandle_t handle = nullptr;
+#ifdef INDY_STATIC_ALLOCATION
+  uint8_t* stack = AllocateStack(stack_depth);
+  if (stack != nullptr) {
+    handle = xTaskCreateStaticPinnedToCore(function, name, stack_depth, parameters, priority,
+      reinterpret_cast<StackType_t*>(stack), buffer, core);
+  }
+#else
+  xTaskCreatePinnedToCore(function, name, stack_depth, parameters, priority, &handle, core);
+#endif
+  RecordHeapUsed(free_heap);
+  return handle;
+}
+
+#ifdef INDY_STATIC_ALLOCATION
+// Returns `stack_depth` bytes from the stack pool, or nullptr if the pool is used up
+uint8_t* IndyRtos::AllocateStack(uint32_t stack_depth) {
+  size_t size = (stack_depth + 15) & ~static_cast<size_t>(15);  // Keep stacks 16 byte aligned
+  if (stack_pool_used + size > sizeof(stack_pool)) {
+    ESP_LOGE(TAG, "Task stack pool has %d bytes left but %" PRIu32 " are needed. Increase INDY_TASK_STACK_POOL_SIZE.",
+      (int) (sizeof(stack_pool) - stack_pool_used), stack_depth);
+    return nullptr;
+  }
+  uint8_t* stack = stack_pool + stack_pool_used;
+  stack_pool_used += size;
+  return stack;
+}
+#endif
+
+// Counts the drop in free heap since `free_heap_before`
+void IndyRtos::RecordHeapUsed(uint32_t free_heap_before) {
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+  if (free_heap_before > free_heap)
+    heap_used += free_heap_before - free_heap;
+  object_count++;
+}
+
+// Returns JSON with whether objects are allocated statically, and the heap
+// and stack pool they use
+cJSON* IndyRtos::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddBoolToObject(json, "static", STATIC_ALLOCATION);
+  cJSON_AddNumberToObject(json, "objects", object_count);
+  cJSON_AddNumberToObject(json, "heap_bytes", heap_used);
+#ifdef INDY_STATIC_ALLOCATION
+  cJSON_AddNumberToObject(json, "stack_pool_bytes", sizeof(stack_pool));
+  cJSON_AddNumberToObject(json, "stack_pool_used", stack_pool_used);
+#endif
+  return json;
+}
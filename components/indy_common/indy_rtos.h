@@ -0,0 +1,38 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_RTOS_H_
+#define COMPONENTS_INDY_COMMON_INDY_RTOS_H_
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Creates FreeRTOS objects. When INDY_STATIC_ALLOCATION is set they're
+// created in the storage passed in, which callers keep in objects that live
+// in .bss, and task stacks come from a pool in .bss. Otherwise they're created
+// on the heap and the storage is unused. Either way, the drop in free heap
+// while creating objects is counted, so the heap saved can be reported.
+class IndyRtos {
+ public:
+  static SemaphoreHandle_t CreateMutex(StaticSemaphore_t* buffer);
+  static SemaphoreHandle_t CreateCounting(UBaseType_t max_count, UBaseType_t initial_count, StaticSemaphore_t* buffer);
+  static QueueHandle_t CreateQueue(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer);
+  static EventGroupHandle_t CreateEventGroup(StaticEventGroup_t* buffer);
+  static TimerHandle_t CreateTimer(const char* name, TickType_t period, UBaseType_t auto_reload, void* id,
+    TimerCallbackFunction_t callback, StaticTimer_t* buffer);
+  static TaskHandle_t CreateTask(TaskFunction_t function, const char* name, uint32_t stack_depth, void* parameters,
+    UBaseType_t priority, BaseType_t core, StaticTask_t* buffer);
+
+  static cJSON* CreateJson();  // Caller owns returned memory
+
+ private:
+  static uint8_t* AllocateStack(uint32_t stack_depth);
+  static void RecordHeapUsed(uint32_t free_heap_before);
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_RTOS_H_
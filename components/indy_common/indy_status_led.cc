@@ -0,0 +1,110 @@
+#include "indy_status_led.h"
+
+#include <esp_log.h>
+
+#include "indy_config.h"
+#include "indy_rtos.h"
+
+namespace {
+  const char *TAG = "indy_status_led";
+
+  // Frequency of the steady patterns, which is too fast to see flicker, and
+  // slow enough for the LEDC clock to also reach the 1 Hz blinks
+  const uint32_t STEADY_HZ = 500;
+}
+
+// PWM settings of each pattern, in the order of IndyLedPattern
+const std::array<IndyStatusLed::PatternConfig, IndyStatusLed::PATTERN_COUNT> IndyStatusLed::PATTERNS = {{
+  { "off", STEADY_HZ, 0, true },
+  { "on", STEADY_HZ, 100, true },
+  { "glow", STEADY_HZ, 5, true },
+  { "blip", 1, 5, false },
+  { "blink_slow", 1, 50, false },
+  { "blink_fast", 4, 50, false },
+}};
+
+// Creates the mutex, and starts driving the LED with the LED off
+void IndyStatusLed::Setup() {
+  mutex = IndyRtos::CreateMutex(&mutex_buffer);
+  if (mutex == nullptr) {
+    ESP_LOGE(TAG, "Create status LED mutex failed");
+    abort();
+  }
+  if (pin != GPIO_NUM_NC)
+    StartPin();
+}
+
+// Sets device state `condition` to `value`, and updates the pattern to match
+void IndyStatusLed::SetCondition(bool* condition, bool value) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to set status");
+    return;
+  }
+  *condition = value;
+  Update();
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after setting status");
+}
+
+// Sets whether the switch is on, and updates the pattern to match
+void IndyStatusLed::SetSwitchOn(bool on) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to set switch");
+    return;
+  }
+  switch_on = on;
+  Update();
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after setting switch");
+}
+
+// Returns the pattern for the device state. Caller holds the lock.
+IndyLedPattern IndyStatusLed::SelectPattern() const {
+  if (!wifi_connected)
+    return IndyLedPattern::BLINK_FAST;
+  if (!mqtt_connected)
+    return IndyLedPattern::BLINK_SLOW;
+  if (!time_synced)
+    return IndyLedPattern::BLIP;
+  if (switch_on)
+    return IndyLedPattern::ON;
+  return schedule_active ? IndyLedPattern::OFF : IndyLedPattern::GLOW;
+}
+
+// Shows the pattern for the device state, if it's changed. Caller holds the lock.
+void IndyStatusLed::Update() {
+  IndyLedPattern next = SelectPattern();
+  if (next == pattern)
+    return;
+  if (pin != GPIO_NUM_NC)
+    ShowPattern(PATTERNS[static_cast<int>(pattern)], PATTERNS[static_cast<int>(next)]);
+  ESP_LOGI(TAG, "Status LED pattern changed from %s to %s",
+    PATTERNS[static_cast<int>(pattern)].name, PATTERNS[static_cast<int>(next)].name);
+  pattern = next;
+  changes++;
+}
+
+// Returns JSON with the pattern shown, and counts of changes to it
+cJSON* IndyStatusLed::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to create status LED JSON");
+    return json;
+  }
+  cJSON_AddStringToObject(json, "pattern", PATTERNS[static_cast<int>(pattern)].name);
+  cJSON_AddNumberToObject(json, "changes", changes);
+  cJSON_AddNumberToObject(json, "fades", fades);
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after creating status LED JSON");
+  return json;
+}
+
+bool IndyStatusLed::Lock() {
+  // Acquire mutex
+  return xSemaphoreTake(mutex, MAX_WAIT) == pdTRUE;
+}
+
+bool IndyStatusLed::Unlock() {
+  // Release mutex
+  return xSemaphoreGive(mutex) == pdTRUE;
+}
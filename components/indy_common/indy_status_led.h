@@ -0,0 +1,89 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_STATUS_LED_H_
+#define COMPONENTS_INDY_COMMON_INDY_STATUS_LED_H_
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <array>
+#include <cstdint>
+
+#include "indy_gpio.h"
+
+// Patterns shown by the status LED. Each is a PWM frequency and duty cycle, so
+// once one is set the LED shows it without any CPU work.
+enum class IndyLedPattern {
+  OFF,
+  ON,
+  GLOW,        // Dim, while the switch is off and its schedule isn't running
+  BLIP,        // A short flash every second, while time hasn't synced
+  BLINK_SLOW,  // Once a second, while MQTT is disconnected
+  BLINK_FAST,  // Four times a second, while wifi is disconnected
+  COUNT
+};
+
+// Manages an LED that shows the state of the device. While the device is
+// connected and time has synced it shows whether the switch is on, and
+// otherwise it blinks to show what's missing. The LED is driven by the LEDC
+// peripheral, which blinks it and fades it between on and off in hardware, so
+// the CPU only does work when the pattern changes.
+class IndyStatusLed {
+ public:
+  explicit IndyStatusLed(gpio_num_t pin) : pin(pin) {}
+
+  void Setup();
+
+  // Device state, which selects the pattern
+  void SetWifiConnected(bool connected) { SetCondition(&wifi_connected, connected); }
+  void SetMqttConnected(bool connected) { SetCondition(&mqtt_connected, connected); }
+  void SetTimeSynced(bool synced) { SetCondition(&time_synced, synced); }
+  void SetScheduleActive(bool active) { SetCondition(&schedule_active, active); }
+
+  // Shows whether the switch is on. Can wait for a fade that's still running.
+  void SetSwitchOn(bool on);
+
+  cJSON* CreateJson();  // Caller owns returned memory
+
+ private:
+  gpio_num_t pin;
+
+  // Device state, guarded by the mutex
+  bool wifi_connected = false;
+  bool mqtt_connected = false;
+  bool time_synced = false;
+  bool schedule_active = false;
+  bool switch_on = false;
+  void SetCondition(bool* condition, bool value);
+
+  // Pattern shown, guarded by the mutex
+  IndyLedPattern pattern = IndyLedPattern::OFF;
+  IndyLedPattern SelectPattern() const;
+  void Update();
+
+  // PWM settings of each pattern
+  struct PatternConfig {
+    const char* name;
+    uint32_t frequency_hz;
+    uint32_t duty_percent;
+    bool fades;  // Whether changes between patterns that fade are faded
+  };
+  static const int PATTERN_COUNT = static_cast<int>(IndyLedPattern::COUNT);
+  static const std::array<PatternConfig, PATTERN_COUNT> PATTERNS;
+
+  // Driving the pin, which is implemented by indy_status_led_pin.cc on the
+  // ESP32 and indy_status_led_pin_host.cc on Linux hosts. Caller holds the lock.
+  void StartPin();
+  void ShowPattern(const PatternConfig& from, const PatternConfig& to);
+
+  // Mutex for locking device state and the pattern
+  SemaphoreHandle_t mutex = nullptr;
+  StaticSemaphore_t mutex_buffer;
+  bool Lock();
+  bool Unlock();
+
+  // Stats
+  uint32_t changes = 0;      // Pattern changes
+  uint32_t fades = 0;        // Changes that were faded
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_STATUS_LED_H_
@@ -0,0 +1,80 @@
+#include "indy_status_led.h"
+
+#include <driver/ledc.h>
+#include <esp_log.h>
+
+#include "indy_config.h"
+
+// ESP32 status LED, driven by a channel of the LEDC peripheral. Blinks are PWM
+// at a few hertz, and fades are run by the LEDC's hardware fade, which only
+// interrupts once at the end.
+
+namespace {
+  const char *TAG = "indy_status_led";
+
+  const ledc_mode_t LEDC_MODE = LEDC_LOW_SPEED_MODE;
+  const ledc_timer_t LEDC_TIMER = LEDC_TIMER_0;
+  const ledc_channel_t LEDC_CHANNEL = LEDC_CHANNEL_0;
+
+  // Clock and duty resolution. Every pattern shares one timer, so its clock
+  // is fixed rather than picked for the first frequency set. With the 1 MHz
+  // REF_TICK and 10 bits, the divider is 1MHz / (f * 1024), which stays in the
+  // hardware's range of 1 to 1023 from the blinks' 1 Hz to the steady
+  // patterns' 500 Hz. The 80 MHz APB clock would need a divider of 78125 at
+  // 1 Hz.
+  const ledc_clk_cfg_t CLOCK = LEDC_USE_REF_TICK;
+  const ledc_timer_bit_t DUTY_RESOLUTION = LEDC_TIMER_10_BIT;
+
+  // Returns the LEDC duty for `percent`
+  uint32_t ToDuty(uint32_t percent) {
+    return ((1U << DUTY_RESOLUTION) * percent) / 100;
+  }
+}
+
+// Configures the LEDC timer and channel for the pin, with the LED off
+void IndyStatusLed::StartPin() {
+  ledc_timer_config_t timer_conf = {};
+  timer_conf.speed_mode = LEDC_MODE;
+  timer_conf.duty_resolution = DUTY_RESOLUTION;
+  timer_conf.timer_num = LEDC_TIMER;
+  timer_conf.freq_hz = PATTERNS[static_cast<int>(pattern)].frequency_hz;
+  timer_conf.clk_cfg = CLOCK;
+  ESP_ERROR_CHECK(ledc_timer_config(&timer_conf));
+
+  ledc_channel_config_t channel_conf = {};
+  channel_conf.gpio_num = pin;
+  channel_conf.speed_mode = LEDC_MODE;
+  channel_conf.channel = LEDC_CHANNEL;
+  channel_conf.intr_type = LEDC_INTR_DISABLE;
+  channel_conf.timer_sel = LEDC_TIMER;
+  channel_conf.duty = 0;
+  channel_conf.hpoint = 0;
+  ESP_ERROR_CHECK(ledc_channel_config(&channel_conf));
+
+  // Install fades
+  ESP_ERROR_CHECK(ledc_fade_func_install(0));
+}
+
+// Shows pattern `to` in place of `from`. Steady patterns fade into each
+// other. Starting a fade, or setting the duty and frequency, waits for any
+// fade that's still running.
+void IndyStatusLed::ShowPattern(const PatternConfig& from, const PatternConfig& to) {
+  uint32_t duty = ToDuty(to.duty_percent);
+  if (from.fades && to.fades && from.frequency_hz == to.frequency_hz && STATUS_LED_FADE_MS > 0) {
+    esp_err_t err = ledc_set_fade_time_and_start(LEDC_MODE, LEDC_CHANNEL, duty, STATUS_LED_FADE_MS, LEDC_FADE_NO_WAIT);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to start status LED fade: %s", esp_err_to_name(err));
+      return;
+    }
+    fades++;
+    return;
+  }
+  esp_err_t err = ledc_set_duty_and_update(LEDC_MODE, LEDC_CHANNEL, duty, 0);
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Failed to set status LED duty: %s", esp_err_to_name(err));
+  if (from.frequency_hz != to.frequency_hz) {
+    err = ledc_set_freq(LEDC_MODE, LEDC_TIMER, to.frequency_hz);
+    if (err != ESP_OK)
+      ESP_LOGE(TAG, "Failed to set status LED frequency: %s", esp_err_to_name(err));
+  }
+}
@@ -0,0 +1,17 @@
+#include "indy_status_led.h"
+
+#include "indy_host_gpio.h"
+
+// Host status LED, which is a simulated pin. Simulated pins have no PWM, so
+// the pin is high for patterns that light the LED at least half the time, and
+// fades are instant.
+
+// Starts the simulated pin low
+void IndyStatusLed::StartPin() {
+  IndyHostGpio::GetInstance().SetLevel(pin, 0);
+}
+
+// Shows pattern `to` in place of `from`
+void IndyStatusLed::ShowPattern(const PatternConfig& from, const PatternConfig& to) {
+  IndyHostGpio::GetInstance().SetLevel(pin, to.duty_percent >= 50 ? 1 : 0);
+}
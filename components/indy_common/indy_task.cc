@@ -1,15 +1,20 @@
 #include "indy_task.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
+#include "indy_config.h"
+#include "indy_dispatcher.h"
+#include "indy_rtos.h"
 #include "indy_task_manager.h"
 
 namespace {
   const char *TAG = "indy_task";
 }
 
-// Creates an instance of IndyTask with the given task `name`
-IndyTask::IndyTask(const char* const name) {
+// Creates an instance of IndyTask with the given task `name`, that will be
+// run as described by `config`
+IndyTask::IndyTask(const std::string& name, const IndyTaskConfig& config) : config(config) {
   this->name = name;
 
   // Register this task
@@ -17,37 +22,95 @@ IndyTask::IndyTask(const char* const name) {
   task_manager->RegisterTask(this);
 }
 
-// Creates the FreeRTOS task for this IndyTask. Work will be done by `function`
-// which will be passed `parameters`.
-void IndyTask::CreateTask(TaskFunction_t function, void* const parameters) {
-  ESP_LOGI(TAG, "Creating %s", name.c_str());
+IndyTask::~IndyTask() {
+  task_manager->UnregisterTask(this);
+}
 
+// Creates the FreeRTOS task for this IndyTask, or adds it to the dispatcher.
+// Work will be done by `function` which will be passed `parameters`.
+void IndyTask::CreateTask(TaskFunction_t function, void* const parameters) {
   task_function = function;
   task_parameters = parameters;
 
+  // Have the dispatcher do the work
+  if (USE_TASK_DISPATCHER && config.dispatch) {
+    dispatched = true;
+    IndyDispatcher::GetInstance().AddTask(this);
+    return;
+  }
+
   // Start the task
-  const uint32_t TASK_STACK_DEPTH = 8192;
-  UBaseType_t PRIORITY = 1;
-  BaseType_t err = xTaskCreate(TaskLoop, name.c_str(), TASK_STACK_DEPTH, this, PRIORITY, &handle);
-  assert(err == pdPASS);
+  running_bit = task_manager->AddRunningTask(name.c_str());
+  handle = CreateFreeRtosTask(TaskLoop, name.c_str(), config, this, &task_buffer);
 }
 
-// Sends the task a notification that work is ready to do
+// Creates a FreeRTOS task named `name` that runs `function`, with the stack
+// size, priority and core given by `config`. Returns the task's handle.
+TaskHandle_t IndyTask::CreateFreeRtosTask(TaskFunction_t function, const char* name, const IndyTaskConfig& config,
+    void* const parameters, StaticTask_t* buffer) {
+  // Single core builds can only run tasks on core 0
+  BaseType_t core = config.core < portNUM_PROCESSORS ? config.core : tskNO_AFFINITY;
+  ESP_LOGI(TAG, "Creating %s with stack %" PRIu32 ", priority %d, core %d",
+    name, config.stack_depth, config.priority, core);
+
+  TaskHandle_t handle = IndyRtos::CreateTask(
+    function, name, config.stack_depth, parameters, config.priority, core, buffer);
+  if (handle == nullptr) {
+    ESP_LOGE(TAG, "Create %s failed", name);
+    abort();
+  }
+  return handle;
+}
+
+// Sends the task a notification that work is ready to do. Notifications that
+// arrive before the work is started are combined.
 void IndyTask::TaskNotifyGive() {
-  xTaskNotifyGive(handle);
+  RecordNotifyTime();
+  if (dispatched) {
+    if (!atomic_exchange(&pending, true))
+      IndyDispatcher::GetInstance().Post(this);
+    return;
+  }
+  if (handle != nullptr)
+    xTaskNotifyGive(handle);
 }
 
 // Sends the task a notification from an ISR that work is ready to do
 void IndyTask::TaskNotifyGiveFromISR() {
+  RecordNotifyTime();
+  if (dispatched) {
+    if (!atomic_exchange(&pending, true))
+      IndyDispatcher::GetInstance().PostFromISR(this);
+    return;
+  }
   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
   vTaskNotifyGiveFromISR(handle, &xHigherPriorityTaskWoken);
   portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
+// Does the task's work. Called by the dispatcher.
+void IndyTask::RunTaskFunction() {
+  atomic_store(&pending, false);
+  RecordLatency();
+  task_function(task_parameters);
+}
+
+// Records when a notification was sent, unless one is already waiting
+void IndyTask::RecordNotifyTime() {
+  unsigned int expected = 0;
+  atomic_compare_exchange_strong(&notify_time, &expected, (unsigned int) esp_timer_get_time());
+}
+
+// Records the time since the first waiting notification was sent
+void IndyTask::RecordLatency() {
+  unsigned int sent = atomic_exchange(&notify_time, 0);
+  if (sent != 0)
+    latency.Add((uint32_t) esp_timer_get_time() - sent);
+}
+
 // Calls the task's function each time there's a notification that work is
 // ready, and ends when the task manager says it's time to end
 void IndyTask::TaskLoop(void *arg) {
-  IndyTaskManager::GetInstance().IncrementRunningTaskCount();
   IndyTask* task = reinterpret_cast<IndyTask*>(arg);
   while (1) {
     // Wait for work
@@ -56,14 +119,13 @@ void IndyTask::TaskLoop(void *arg) {
     // Do work unless exiting
     if (IndyTaskManager::GetInstance().Exiting())
       break;
+    task->RecordLatency();
     task->task_function(task->task_parameters);
     if (IndyTaskManager::GetInstance().Exiting())
       break;
   }
 
   // End task
-  IndyTaskManager::GetInstance().DecrementRunningTaskCount();
+  task->task_manager->EndRunningTask(task->running_bit);
   vTaskDelete(nullptr);
 }
-
-
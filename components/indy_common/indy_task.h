@@ -2,36 +2,88 @@
 #define COMPONENTS_INDY_COMMON_INDY_TASK_H_
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 #include <freertos/task.h>
+#include <stdatomic.h>
 
+#include <cstdint>
 #include <string>
 
+#include "indy_histogram.h"
+
 class IndyTaskManager;
+class IndyWorkQueueStats;
+
+// Describes how to run the FreeRTOS task for an IndyTask
+struct IndyTaskConfig {
+  uint32_t stack_depth;  // Stack size in bytes
+  UBaseType_t priority;
+  BaseType_t core;       // Core to pin the task to, or tskNO_AFFINITY
+  bool dispatch;         // Whether the IndyDispatcher may do the work, when USE_TASK_DISPATCHER is set
+};
 
-// Represents a task for registration with the IndyTaskManager
+// Represents a task for registration with the IndyTaskManager. The task's work
+// is done either by its own FreeRTOS task, or by the IndyDispatcher when
+// USE_TASK_DISPATCHER is set.
 class IndyTask {
  public:
-  explicit IndyTask(const char* const name);
+  IndyTask(const std::string& name, const IndyTaskConfig& config);
+  ~IndyTask();
 
   std::string GetName() { return name; }
+  const IndyTaskConfig& GetConfig() const { return config; }
+  bool IsDispatched() const { return dispatched; }
 
   void CreateTask(TaskFunction_t function, void* const parameters);
+  static TaskHandle_t CreateFreeRtosTask(TaskFunction_t function, const char* name, const IndyTaskConfig& config,
+    void* const parameters, StaticTask_t* buffer);
 
   void TaskNotifyGive();
   void TaskNotifyGiveFromISR();
 
-  bool IsRunning() { return handle != nullptr; }
+  bool IsRunning() { return handle != nullptr || dispatched; }
+  TaskHandle_t GetHandle() const { return handle; }
+  EventBits_t GetRunningBit() const { return running_bit; }
+
+  // The queue of work items posted to this task, if it has one
+  void SetWorkQueue(const IndyWorkQueueStats* work_queue) { this->work_queue = work_queue; }
+  const IndyWorkQueueStats* GetWorkQueue() const { return work_queue; }
+
+  void RunTaskFunction();
+
+  // Time from notification to the start of work, in microseconds
+  const IndyHistogram& GetLatency() const { return latency; }
+
+  // Least free stack since the task started, in bytes
+  uint32_t GetStackHighWaterMark() { return handle != nullptr ? uxTaskGetStackHighWaterMark(handle) : 0; }
 
  private:
   IndyTaskManager* task_manager;
 
   std::string name;
+  IndyTaskConfig config;
 
   TaskHandle_t handle = nullptr;
+  StaticTask_t task_buffer;
+  EventBits_t running_bit = 0;  // Set by the task manager when the task ends
 
   TaskFunction_t task_function = nullptr;
   void* task_parameters = nullptr;
 
+  const IndyWorkQueueStats* work_queue = nullptr;
+
+  // Whether work is done by the dispatcher, and whether there's an event
+  // queued with the dispatcher for this task
+  bool dispatched = false;
+  atomic_bool pending = ATOMIC_VAR_INIT(false);
+
+  // When the first notification since work last started was sent, as the low
+  // 32 bits of microseconds since boot, or 0 if there hasn't been one
+  atomic_uint notify_time = ATOMIC_VAR_INIT(0);
+  IndyHistogram latency;
+  void RecordNotifyTime();
+  void RecordLatency();
+
   static void TaskLoop(void *arg);
 };
 
@@ -1,10 +1,17 @@
 #include "indy_task_manager.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+
+#include <cinttypes>
+#include <vector>
 
 #include "freertos/portmacro.h"
 #include "indy_config.h"
+#include "indy_dispatcher.h"
+#include "indy_rtos.h"
 #include "indy_task.h"
+#include "indy_work_queue.h"
 
 namespace {
   const char *TAG = "indy_task_manager";
@@ -13,42 +20,54 @@ namespace {
 // Sets up this IndyTaskManager
 IndyTaskManager::IndyTaskManager() {
   // Create mutex
-  mutex = xSemaphoreCreateMutex();
+  mutex = IndyRtos::CreateMutex(&mutex_buffer);
   if (mutex == nullptr) {
     ESP_LOGE(TAG, "Create task manager mutex failed");
     abort();
   }
 
-  // Create running task count
-  const UBaseType_t MAX_TASKS = 10;
-  running_tasks_count = xSemaphoreCreateCounting(MAX_TASKS, 0);
-  if (running_tasks_count == nullptr) {
-    ESP_LOGE(TAG, "Create running tasks count semaphore failed");
+  // Create the event group tasks set bits in when they end
+  ended_tasks = IndyRtos::CreateEventGroup(&ended_tasks_buffer);
+  if (ended_tasks == nullptr) {
+    ESP_LOGE(TAG, "Create ended tasks event group failed");
     abort();
   }
 }
 
-// Tells tasks to end and then waits for tasks to end
-void IndyTaskManager::Exit() {
+// Tells tasks to end and then waits for them to end. Returns `false` if
+// tasks didn't end within MAX_WAIT.
+bool IndyTaskManager::Exit() {
   // Tell tasks to end
   ESP_LOGI(TAG, "Ending tasks");
+  int64_t start_time = esp_timer_get_time();
   atomic_store(&exiting, true);
-  Lock();
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to end tasks");
+    return false;
+  }
   for (auto& task : tasks)
     task->TaskNotifyGive();
-  Unlock();
 
-  // Wait for tasks to end
-  TickType_t wait_ticks = pdMS_TO_TICKS(100);
-  for (TickType_t tick_count = 0;
-      tick_count < MAX_WAIT && uxSemaphoreGetCount(running_tasks_count) > 0;
-      tick_count += wait_ticks) {
-    vTaskDelay(wait_ticks);
+  // Don't wait for the calling task, which can't end while it's waiting
+  EventBits_t bits_to_wait_for = running_bits;
+  TaskHandle_t current_task = xTaskGetCurrentTaskHandle();
+  for (auto& task : tasks) {
+    if (task->GetHandle() == current_task)
+      bits_to_wait_for &= ~task->GetRunningBit();
   }
-  if (uxSemaphoreGetCount(running_tasks_count) == 0)
-    ESP_LOGI(TAG, "Tasks ended");
+  if (USE_TASK_DISPATCHER && IndyDispatcher::GetInstance().GetHandle() == current_task)
+    bits_to_wait_for &= ~IndyDispatcher::GetInstance().GetRunningBit();
+  Unlock();
+
+  // Wait for every running task to set its bit
+  bool ended = bits_to_wait_for == 0 ||
+    (xEventGroupWaitBits(ended_tasks, bits_to_wait_for, pdFALSE, pdTRUE, MAX_WAIT) & bits_to_wait_for) ==
+      bits_to_wait_for;
+  if (ended)
+    ESP_LOGI(TAG, "Tasks ended in %" PRId64 " us", esp_timer_get_time() - start_time);
   else
     ESP_LOGE(TAG, "Timed out waiting for tasks to end");
+  return ended;
 }
 
 // Registers `task` with the task manager
@@ -66,6 +85,103 @@ void IndyTaskManager::RegisterTask(IndyTask* task) {
   }
 }
 
+// Removes `task` from the task manager
+void IndyTaskManager::UnregisterTask(IndyTask* task) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to unregister %s", task->GetName().c_str());
+    return;
+  }
+  std::erase(tasks, task);
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after unregistering %s", task->GetName().c_str());
+}
+
+// Gives the FreeRTOS task `name`, which is about to start, a bit that it sets
+// when it ends. Returns the bit, or 0 if every bit is in use, in which case
+// Exit won't wait for the task.
+EventBits_t IndyTaskManager::AddRunningTask(const char* name) {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to add running task %s", name);
+    return 0;
+  }
+  EventBits_t free_bits = TASK_BITS & ~running_bits;
+  EventBits_t bit = free_bits & (~free_bits + 1);  // Lowest free bit
+  if (bit != 0) {
+    xEventGroupClearBits(ended_tasks, bit);
+    running_bits |= bit;
+  }
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after adding running task %s", name);
+  if (bit == 0)
+    ESP_LOGE(TAG, "No bits left for running task %s, so exit won't wait for it", name);
+  return bit;
+}
+
+// Records that the task that was given `bit` has ended
+void IndyTaskManager::EndRunningTask(EventBits_t bit) {
+  if (bit == 0)
+    return;
+  xEventGroupSetBits(ended_tasks, bit);
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to end running task");
+    return;
+  }
+  running_bits &= ~bit;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after ending running task");
+}
+
+// Returns JSON describing each task, and the time it takes to start work
+// after it's notified
+cJSON* IndyTaskManager::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to create tasks JSON");
+    return json;
+  }
+  for (auto& task : tasks) {
+    const IndyTaskConfig& config = task->GetConfig();
+    cJSON* task_json = cJSON_AddObjectToObject(json, task->GetName().c_str());
+    cJSON_AddNumberToObject(task_json, "stack", config.stack_depth);
+    cJSON_AddNumberToObject(task_json, "priority", config.priority);
+    if (config.core != tskNO_AFFINITY)
+      cJSON_AddNumberToObject(task_json, "core", config.core);
+    cJSON_AddBoolToObject(task_json, "dispatched", task->IsDispatched());
+    cJSON_AddItemToObject(task_json, "latency_us", task->GetLatency().CreateJson());
+    if (task->GetWorkQueue() != nullptr)
+      cJSON_AddItemToObject(task_json, "queue", task->GetWorkQueue()->CreateJson());
+  }
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after creating tasks JSON");
+  return json;
+}
+
+// Returns JSON with the stack size and least free stack of each FreeRTOS task
+// created for an IndyTask, and of the dispatcher task
+cJSON* IndyTaskManager::CreateStacksJson() {
+  cJSON* json = cJSON_CreateObject();
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to create stacks JSON");
+    return json;
+  }
+  for (auto& task : tasks) {
+    if (task->IsDispatched() || !task->IsRunning())
+      continue;
+    cJSON* task_json = cJSON_AddObjectToObject(json, task->GetName().c_str());
+    cJSON_AddNumberToObject(task_json, "stack", task->GetConfig().stack_depth);
+    cJSON_AddNumberToObject(task_json, "stack_free_min", task->GetStackHighWaterMark());
+  }
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after creating stacks JSON");
+
+  if (USE_TASK_DISPATCHER) {
+    cJSON* dispatcher_json = cJSON_AddObjectToObject(json, "DispatcherTask");
+    cJSON_AddNumberToObject(dispatcher_json, "stack", DISPATCHER_TASK_CONFIG.stack_depth);
+    cJSON_AddNumberToObject(dispatcher_json, "stack_free_min", IndyDispatcher::GetInstance().GetStackHighWaterMark());
+  }
+  return json;
+}
+
 bool IndyTaskManager::Lock() {
   // Acquire mutex
   return xSemaphoreTake(mutex, MAX_WAIT) == pdTRUE;
@@ -75,13 +191,3 @@ bool IndyTaskManager::Unlock() {
   // Release mutex
   return xSemaphoreGive(mutex) == pdTRUE;
 }
-
-void IndyTaskManager::IncrementRunningTaskCount() {
-  if (xSemaphoreGive(running_tasks_count) != pdTRUE)
-    ESP_LOGE(TAG, "Failed to increment running task count");
-}
-
-void IndyTaskManager::DecrementRunningTaskCount() {
-  if (xSemaphoreTake(running_tasks_count, MAX_WAIT) != pdTRUE)
-    ESP_LOGE(TAG, "Failed to decrement running task count");
-}
@@ -1,7 +1,9 @@
 #ifndef COMPONENTS_INDY_COMMON_INDY_TASK_MANAGER_H_
 #define COMPONENTS_INDY_COMMON_INDY_TASK_MANAGER_H_
 
+#include <cJSON.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 #include <freertos/semphr.h>
 #include <stdatomic.h>
 
@@ -9,7 +11,9 @@
 
 class IndyTask;
 
-// Manages tasks so that they're shut down cleanly
+// Manages tasks so that they're shut down cleanly. Each running FreeRTOS task
+// has a bit in an event group that it sets when it ends, so Exit returns as
+// soon as the last task has ended.
 class IndyTaskManager {
  public:
   static IndyTaskManager& GetInstance() {
@@ -18,21 +22,33 @@ class IndyTaskManager {
   }
 
   void RegisterTask(IndyTask* task);
-  void IncrementRunningTaskCount();
-  void DecrementRunningTaskCount();
+  void UnregisterTask(IndyTask* task);
 
-  void Exit();
+  EventBits_t AddRunningTask(const char* name);
+  void EndRunningTask(EventBits_t bit);
+
+  bool Exit();
   bool Exiting() { return atomic_load(&exiting); }
 
+  cJSON* CreateJson();  // Caller owns returned memory
+  cJSON* CreateStacksJson();  // Caller owns returned memory
+
  private:
     IndyTaskManager();
 
     // Tasks
     std::vector<IndyTask*> tasks;
-    SemaphoreHandle_t running_tasks_count;
+
+    // Running FreeRTOS tasks, with a bit each in `ended_tasks` that's set when
+    // the task ends. Event groups have 24 bits for tasks.
+    static const EventBits_t TASK_BITS = 0x00FFFFFF;
+    EventBits_t running_bits = 0;
+    EventGroupHandle_t ended_tasks;
+    StaticEventGroup_t ended_tasks_buffer;
 
     // Mutex for locking task manager
     SemaphoreHandle_t mutex;
+    StaticSemaphore_t mutex_buffer;
     bool Lock();
     bool Unlock();
 
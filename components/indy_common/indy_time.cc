@@ -3,8 +3,11 @@
 #include <string.h>
 
 #include <esp_log.h>
+#include <sdkconfig.h>
+#if !CONFIG_IDF_TARGET_LINUX
 #include <esp_sntp.h>
 #include <esp_netif_sntp.h>
+#endif
 
 #include "indy_config.h"
 
@@ -13,6 +16,7 @@ namespace {
   IndyTime *indy_time;  // This is a global since esp_sntp_time_cb_t doesn't have callback data.
 }
 
+#if !CONFIG_IDF_TARGET_LINUX
 // SNTP code is based on example code from
 // [Example: using LwIP SNTP module and time functions](https://github.com/espressif/esp-idf/tree/release/v5.1/examples/protocols/sntp)
 
@@ -21,27 +25,31 @@ void time_sync_notification_cb(struct timeval *tv) {
   ESP_LOGI(TAG, "SNTP time has synced");
   indy_time->HandleSntpTimeSync();
 }
+#endif
 
 // Notifies listeners that the system time has synced with SNTP, and stops the SNTP service
 void IndyTime::HandleSntpTimeSync() {
-  // Notify handlers that time has been synced
+  // Notify handlers and waiting coroutines that time has been synced
   for (const TimeSyncedHandler& handler : handlers) {
     handler();
   }
+  events.Set(SYNCED_BIT);
 
   // Stop SNTP
+#if !CONFIG_IDF_TARGET_LINUX
   ESP_LOGI(TAG, "Stopping SNTP");
   esp_netif_sntp_deinit();
+#endif
 }
 
-// Sets up this IndyTime. The `handler` will called when time has been synced with the SNTP server.
-void IndyTime::Setup(const TimeSyncedHandler& handler) {
+// Sets up this IndyTime. Use WaitForSync to wait for time to be synced with the SNTP server.
+void IndyTime::Setup() {
   indy_time = this;
 
-  // Register handler
-  RegisterTimeInitializedHandler(handler);
-
-  // Start the SNTP service
+  // Start the SNTP service. Linux hosts already have the time set.
+#if CONFIG_IDF_TARGET_LINUX
+  HandleSntpTimeSync();
+#else
   if (USE_SNTP) {
     ESP_LOGI(TAG, "Starting SNTP");
     esp_sntp_config_t config = {
@@ -58,6 +66,7 @@ void IndyTime::Setup(const TimeSyncedHandler& handler) {
     };
     esp_netif_sntp_init(&config);
   }
+#endif
 
   ESP_LOGI(TAG, "Setup completed");
 }
@@ -6,22 +6,31 @@
 #include <string>
 #include <vector>
 
+#include "indy_coroutine.h"
+
 class IndyTime {
  public:
   // Time synced handlers
   using TimeSyncedHandler = std::function<void()>;
   void RegisterTimeInitializedHandler(const TimeSyncedHandler& handler) { handlers.push_back(handler); }
 
-  void Setup(const TimeSyncedHandler& handler);
+  void Setup();
 
   void HandleSntpTimeSync();
 
+  // Waits for time to sync with the SNTP server
+  IndyWait WaitForSync() { return events.Wait(SYNCED_BIT); }
+
   static std::string FormatTime(time_t time);
   static std::string FormatCurrentTime();
 
  private:
   // Time synced handlers
   std::vector<TimeSyncedHandler> handlers;
+
+  // Time synced event
+  static const EventBits_t SYNCED_BIT = BIT0;
+  IndyAwaitableEvents events;
 };
 
 #endif  // COMPONENTS_INDY_COMMON_INDY_TIME_H_
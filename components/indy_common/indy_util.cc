@@ -12,6 +12,9 @@
 
 const time_t NULL_TIME = -1;
 
+// Times before this, the start of 2023, are from before time synced
+const time_t TIME_SYNCED_MIN = 1672531200;
+
 // Returns a formatted string using the printf-style `format` string
 std::string FormatString(const char* format, ...) {
   // Determine buffer length needed
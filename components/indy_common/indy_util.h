@@ -7,6 +7,7 @@
 #include <string>
 
 extern const time_t NULL_TIME;
+extern const time_t TIME_SYNCED_MIN;
 
 std::string FormatString(const char* format, ...);
 std::string FormatString2(const char* context, const char* format, ...);
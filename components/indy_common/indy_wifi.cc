@@ -3,11 +3,16 @@
 #include <string.h>
 
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/event_groups.h>
+
+#include <algorithm>
+#include <cinttypes>
 
 #include "indy_config.h"
+#include "indy_rtos.h"
 #include "indy_util.h"
 
 // Code is based on example code from
@@ -16,71 +21,172 @@
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 
 namespace {
-  int connect_retry_num = 0;
-
-  // FreeRTOS event group to signal when we are connected
-  EventGroupHandle_t wifi_event_group;
-  const EventBits_t WIFI_CONNECTED_BIT = BIT0;  // We are connected to the AP with an IP
-  const EventBits_t WIFI_FAIL_BIT      = BIT1;  // We failed to connect after the maximum amount of retries
-
   const char *TAG = "indy_wifi";
+
+  // NVS key for the access point that last gave a connection
+  const char* const CACHED_AP_KEY = "wifi_ap";
 }  // namespace
 
 // Wifi settings
-#define WIFI_MAXIMUM_RETRY  5
 #define WIFI_SCAN_AUTH_MODE_THRESHOLD WIFI_AUTH_WPA2_PSK
 
 // Handles wifi events
-static void WifiEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+void IndyWifi::EventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+  IndyWifi* wifi = reinterpret_cast<IndyWifi*>(arg);
   if (event_base ==  WIFI_EVENT) {
     switch (event_id) {
       case WIFI_EVENT_STA_START:
-        ESP_LOGI(TAG, "Connecting to wifi");
-        esp_wifi_connect();
+        ESP_LOGI(TAG, "Connecting to wifi%s", wifi->cached_ap_configured ? " using cached access point" : "");
+        wifi->Connect();
         break;
-      case WIFI_EVENT_STA_DISCONNECTED:
+      case WIFI_EVENT_STA_CONNECTED: {
+        wifi_event_sta_connected_t* event = reinterpret_cast<wifi_event_sta_connected_t*>(event_data);
+        memcpy(wifi->connected_ap.bssid, event->bssid, sizeof(wifi->connected_ap.bssid));
+        wifi->connected_ap.channel = event->channel;
+        break;
+      }
+      case WIFI_EVENT_STA_DISCONNECTED: {
         ESP_LOGI(TAG, "Wifi disconnected");
-        if (connect_retry_num < WIFI_MAXIMUM_RETRY) {
-          ESP_LOGI(TAG, "Attempting to reconnect to wifi");
-          connect_retry_num++;
-          esp_wifi_connect();
+        bool was_connected = wifi->connected;
+        if (was_connected) {
+          wifi->disconnect_time = esp_timer_get_time();
+          wifi->disconnects++;
+          wifi->HandleConnectionChange(false);
+        }
+        if (!was_connected && wifi->using_cached_ap) {
+          // An attempt with the cached access point failed. It may have moved
+          // or gone, so scan for another straight away.
+          ESP_LOGI(TAG, "Connecting to cached access point failed. Scanning for access points.");
+          wifi->cached_ap_failures++;
+          wifi->UseFullScan();
+          wifi->Connect();
         } else {
-          xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
+          wifi->ScheduleReconnect();
         }
         break;
+      }
     }
   } else if (event_base == IP_EVENT) {
     switch (event_id) {
-      case IP_EVENT_STA_GOT_IP:
+      case IP_EVENT_STA_GOT_IP: {
         ip_event_got_ip_t* event =  reinterpret_cast<ip_event_got_ip_t*>(event_data);
         ESP_LOGI(TAG, "Wifi connected and got IP " IPSTR, IP2STR(&event->ip_info.ip));
-        connect_retry_num = 0;
-        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        int64_t now = esp_timer_get_time();
+        if (wifi->ip_time == 0) {
+          wifi->ip_time = now;
+          wifi->first_ip_from_cache = wifi->using_cached_ap;
+          ESP_LOGI(TAG, "Got IP %" PRId64 " us after boot, %s", now,
+            wifi->using_cached_ap ? "using the cached access point" : "after scanning");
+        } else if (wifi->disconnect_time != 0) {
+          wifi->reconnect_us = now - wifi->disconnect_time;
+          wifi->reconnect_total_us += wifi->reconnect_us;
+          wifi->reconnects++;
+          ESP_LOGI(TAG, "Reconnected in %" PRId64 " us after %" PRIu32 " attempts", wifi->reconnect_us,
+            wifi->reconnect_attempt);
+        }
+        wifi->disconnect_time = 0;
+        wifi->reconnect_attempt = 0;
+        wifi->SaveConnectedAp();
+        wifi->HandleConnectionChange(true);
         break;
+      }
     }
   }
 }
 
+// Starts the reconnect timer for the next attempt. The backoff doubles with
+// each attempt up to WIFI_RECONNECT_MAX_MS, and jitter takes off up to half.
+void IndyWifi::ScheduleReconnect() {
+  uint32_t backoff_ms = WIFI_RECONNECT_MAX_MS;
+  if (reconnect_attempt < 16)
+    backoff_ms = std::min(WIFI_RECONNECT_MAX_MS, WIFI_RECONNECT_MIN_MS << reconnect_attempt);
+  uint32_t delay_ms = backoff_ms - esp_random() % (backoff_ms / 2 + 1);
+  reconnect_attempt++;
+  reconnect_attempts++;
+  ESP_LOGI(TAG, "Reconnect attempt %" PRIu32 " in %" PRIu32 " ms", reconnect_attempt, delay_ms);
+  TickType_t ticks = std::max<TickType_t>(pdMS_TO_TICKS(delay_ms), 1);
+  if (xTimerChangePeriod(reconnect_timer, ticks, 0) != pdPASS)
+    ESP_LOGE(TAG, "Failed to start reconnect timer");
+}
+
+// Starts a reconnect attempt once its backoff has passed
+void IndyWifi::ReconnectTimerCallback(TimerHandle_t timer) {
+  ESP_LOGI(TAG, "Attempting to reconnect to wifi");
+  reinterpret_cast<IndyWifi*>(pvTimerGetTimerID(timer))->Connect();
+}
+
+// Starts a connect attempt, noting whether it's made with the cached access
+// point, so only failures of those attempts fall back to a full scan
+void IndyWifi::Connect() {
+  using_cached_ap = cached_ap_configured;
+  esp_wifi_connect();
+}
+
+// Stops connecting to the cached access point, so the next connection scans
+// for the access point with the best signal
+void IndyWifi::UseFullScan() {
+  cached_ap_configured = false;
+  wifi_config_t wifi_config;
+  ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+  wifi_config.sta.bssid_set = false;
+  wifi_config.sta.channel = 0;
+  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+}
+
+// Saves the access point of the current connection to NVS, if it's changed,
+// and connects straight to it from now on. The STA config is set again
+// whenever a full scan cleared it, even if the access point is unchanged.
+void IndyWifi::SaveConnectedAp() {
+  bool changed = memcmp(&connected_ap, &cached_ap, sizeof(cached_ap)) != 0;
+  if (changed) {
+    ESP_LOGI(TAG, "Caching access point on channel %d", connected_ap.channel);
+    cached_ap = connected_ap;
+    nvs->WriteBlob(CACHED_AP_KEY, &cached_ap, sizeof(cached_ap));
+    nvs->Commit();
+  }
+  if (!changed && cached_ap_configured)
+    return;
+
+  // Later reconnects go straight to this access point
+  cached_ap_configured = true;
+  wifi_config_t wifi_config;
+  ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+  memcpy(wifi_config.sta.bssid, cached_ap.bssid, sizeof(cached_ap.bssid));
+  wifi_config.sta.bssid_set = true;
+  wifi_config.sta.channel = cached_ap.channel;
+  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+}
+
 // Copies string from `source` to `dest` of size `dest_size`.
 static void CopyString(uint8_t *dest, uint dest_size, const char *source) {
   strncpy(reinterpret_cast<char *>(dest), source, dest_size - 1);
   dest[dest_size - 1] = '\0';  // Make sure dest is null-terminated
 }
 
-// Sets up wifi
-void IndyWifi::Setup() {
+// Sets up wifi and starts connecting. Use WaitForConnection to wait for the
+// connection. The cached access point is read from and saved to `nvs`.
+void IndyWifi::Setup(IndyNvs* nvs) {
+  this->nvs = nvs;
+
+  // Create the timer for reconnect backoff
+  reconnect_timer = IndyRtos::CreateTimer("WifiReconnect", 1, pdFALSE, this, ReconnectTimerCallback,
+    &reconnect_timer_buffer);
+  if (reconnect_timer == nullptr) {
+    ESP_LOGE(TAG, "Create reconnect timer failed");
+    abort();
+  }
+
   // Initialize the TCP/IP stack
   ESP_ERROR_CHECK(esp_netif_init());
 
   // Initialize event handling
-  wifi_event_group = xEventGroupCreate();
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   esp_event_handler_instance_t instance_any_id;
   esp_event_handler_instance_t instance_got_ip;
   ESP_ERROR_CHECK(esp_event_handler_instance_register(
-    WIFI_EVENT, ESP_EVENT_ANY_ID, &WifiEventHandler, NULL, &instance_any_id));
+    WIFI_EVENT, ESP_EVENT_ANY_ID, &EventHandler, this, &instance_any_id));
   ESP_ERROR_CHECK(esp_event_handler_instance_register(
-    IP_EVENT, IP_EVENT_STA_GOT_IP, &WifiEventHandler, NULL, &instance_got_ip));
+    IP_EVENT, IP_EVENT_STA_GOT_IP, &EventHandler, this, &instance_got_ip));
 
   // Create the default STA
   esp_netif_create_default_wifi_sta();
@@ -99,24 +205,39 @@ void IndyWifi::Setup() {
   };
   CopyString(wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid), WIFI_SSID);
   CopyString(wifi_config.sta.password, sizeof(wifi_config.sta.password), WIFI_PASSWORD);
+
+  // Connect straight to the access point that last gave a connection, on its
+  // channel, rather than scanning every channel
+  if (nvs->ReadBlob(CACHED_AP_KEY, &cached_ap, sizeof(cached_ap)) && cached_ap.channel != 0) {
+    memcpy(wifi_config.sta.bssid, cached_ap.bssid, sizeof(cached_ap.bssid));
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = cached_ap.channel;
+    cached_ap_configured = true;
+  } else {
+    cached_ap = {};
+  }
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
   ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
 
   // Start wifi
   ESP_ERROR_CHECK(esp_wifi_start());
 
-  // Wait until either the connection is established or the maximum number of
-  // attempts tried
-  EventBits_t bits = xEventGroupWaitBits(
-    wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
-  if (bits & WIFI_CONNECTED_BIT) {
-    ESP_LOGI(TAG, "connected to ap SSID:%s", wifi_config.sta.ssid);
-  } else if (bits & WIFI_FAIL_BIT) {
-    ESP_LOGI(TAG, "Failed to connect to SSID:%s", wifi_config.sta.ssid);
-  } else {
-    ESP_LOGE(TAG, "Unexpected event");
-  }
-
   ESP_LOGI(TAG, "Setup completed");
 }
 
+// Returns JSON with when the first IP was received, whether the cached access
+// point was used for it, and reconnect counts and times
+cJSON* IndyWifi::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddBoolToObject(json, "connected", connected);
+  cJSON_AddNumberToObject(json, "ip_us", ip_time);
+  cJSON_AddBoolToObject(json, "ip_from_cached_ap", first_ip_from_cache);
+  cJSON_AddNumberToObject(json, "cached_ap_failures", cached_ap_failures);
+  cJSON_AddNumberToObject(json, "disconnects", disconnects);
+  cJSON_AddNumberToObject(json, "reconnects", reconnects);
+  cJSON_AddNumberToObject(json, "reconnect_attempts", reconnect_attempts);
+  cJSON_AddNumberToObject(json, "reconnect_us", reconnect_us);
+  cJSON_AddNumberToObject(json, "mean_reconnect_us", reconnects > 0 ? reconnect_total_us / reconnects : 0);
+  return json;
+}
+
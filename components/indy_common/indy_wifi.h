@@ -1,9 +1,97 @@
 #ifndef COMPONENTS_INDY_COMMON_INDY_WIFI_H_
 #define COMPONENTS_INDY_COMMON_INDY_WIFI_H_
 
+#include <cJSON.h>
+#include <esp_event.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "indy_coroutine.h"
+#include "indy_nvs.h"
+
+// Manages the wifi connection. The access point that last gave a connection
+// is saved to NVS, so later connections go straight to it on its channel
+// without scanning, and fall back to a full scan if that fails. When the
+// connection is lost, reconnection is retried forever, with capped exponential
+// backoff and jitter between attempts.
 class IndyWifi {
  public:
-  void Setup();
+  void Setup(IndyNvs* nvs);
+
+  // Connection events. At most one of these is set.
+  static const EventBits_t CONNECTED_BIT = BIT0;     // We are connected to the AP with an IP
+  static const EventBits_t DISCONNECTED_BIT = BIT1;  // We lost the connection and are reconnecting
+
+  // Waits for wifi to connect. co_await returns the connection events.
+  IndyWait WaitForConnection() { return events.Wait(CONNECTED_BIT); }
+
+  // Waits for the connection to be lost. co_await returns the connection events.
+  IndyWait WaitForDisconnection() { return events.Wait(DISCONNECTED_BIT); }
+
+  // Connection handlers, which are called on the event loop task when the
+  // connection is made and when it's lost
+  using ConnectionHandler = std::function<void(bool connected)>;
+  void RegisterConnectionHandler(const ConnectionHandler& handler) { connectionHandlers.push_back(handler); }
+
+  cJSON* CreateJson();  // Caller owns returned memory
+
+ private:
+  IndyAwaitableEvents events;
+  std::vector<ConnectionHandler> connectionHandlers;
+  bool connected = false;
+
+  // Sets the connection events and calls the connection handlers. Shared by
+  // ESP32 and Linux host builds.
+  void HandleConnectionChange(bool connected) {
+    this->connected = connected;
+    events.Clear(connected ? DISCONNECTED_BIT : CONNECTED_BIT);
+    events.Set(connected ? CONNECTED_BIT : DISCONNECTED_BIT);
+    for (const ConnectionHandler& handler : connectionHandlers)
+      handler(connected);
+  }
+
+  IndyNvs* nvs = nullptr;
+
+  // The access point that last gave a connection, as saved to NVS
+  struct CachedAp {
+    uint8_t bssid[6];
+    uint8_t channel;  // 0 if there's no cached access point
+    uint8_t reserved;
+  };
+  CachedAp cached_ap = {};
+  CachedAp connected_ap = {};  // The access point of the current connection
+  bool cached_ap_configured = false;  // Whether the STA config connects straight to the cached access point
+  bool using_cached_ap = false;       // Whether the current connect attempt was made with the cached access point
+  uint32_t cached_ap_failures = 0;
+  void Connect();
+  void UseFullScan();
+  void SaveConnectedAp();
+
+  // Reconnection, with the timer that starts each attempt after its backoff
+  TimerHandle_t reconnect_timer = nullptr;
+  StaticTimer_t reconnect_timer_buffer;
+  uint32_t reconnect_attempt = 0;  // Attempts since the connection was lost
+  void ScheduleReconnect();
+  static void ReconnectTimerCallback(TimerHandle_t timer);
+
+  // Connection timing, in microseconds since boot
+  int64_t ip_time = 0;            // When the first IP was received
+  int64_t disconnect_time = 0;    // When the connection was last lost
+  int64_t reconnect_us = 0;       // Time taken by the last reconnect
+  int64_t reconnect_total_us = 0; // Time taken by all reconnects
+  bool first_ip_from_cache = false;
+
+  // Reconnection stats
+  uint32_t disconnects = 0;
+  uint32_t reconnects = 0;
+  uint32_t reconnect_attempts = 0;
+
+  static void EventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 };
 
 #endif  // COMPONENTS_INDY_COMMON_INDY_WIFI_H_
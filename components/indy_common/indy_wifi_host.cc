@@ -0,0 +1,24 @@
+#include "indy_wifi.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+namespace {
+  const char *TAG = "indy_wifi";
+}
+
+// Sets up wifi. Linux hosts use the host's network, which is already connected.
+void IndyWifi::Setup(IndyNvs* nvs) {
+  this->nvs = nvs;
+  ESP_LOGI(TAG, "Using host network");
+  ip_time = esp_timer_get_time();
+  HandleConnectionChange(true);
+}
+
+// Returns JSON with when the host network was first used
+cJSON* IndyWifi::CreateJson() {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddBoolToObject(json, "connected", connected);
+  cJSON_AddNumberToObject(json, "ip_us", ip_time);
+  return json;
+}
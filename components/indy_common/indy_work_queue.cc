@@ -0,0 +1,23 @@
+#include "indy_work_queue.h"
+
+#include <cJSON.h>
+
+// Records that an item was posted, leaving `depth` items waiting
+void IndyWorkQueueStats::RecordPost(UBaseType_t depth) {
+  this->depth = depth;
+  atomic_fetch_add(&posted, 1);
+  unsigned int max = atomic_load(&max_depth);
+  while (depth > max && !atomic_compare_exchange_weak(&max_depth, &max, depth)) {
+  }
+}
+
+// Returns JSON with the queue's capacity, depth, and counts of posted and dropped items
+cJSON* IndyWorkQueueStats::CreateJson() const {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "capacity", capacity);
+  cJSON_AddNumberToObject(json, "depth", depth);
+  cJSON_AddNumberToObject(json, "max_depth", atomic_load(&max_depth));
+  cJSON_AddNumberToObject(json, "posted", atomic_load(&posted));
+  cJSON_AddNumberToObject(json, "dropped", atomic_load(&dropped));
+  return json;
+}
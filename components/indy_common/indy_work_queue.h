@@ -0,0 +1,128 @@
+#ifndef COMPONENTS_INDY_COMMON_INDY_WORK_QUEUE_H_
+#define COMPONENTS_INDY_COMMON_INDY_WORK_QUEUE_H_
+
+#include <cJSON.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <stdatomic.h>
+
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "indy_rtos.h"
+#include "indy_task.h"
+
+// Counts the work passed through an IndyWorkQueue, independent of its item type
+class IndyWorkQueueStats {
+ public:
+  explicit IndyWorkQueueStats(UBaseType_t capacity) : capacity(capacity) {}
+
+  cJSON* CreateJson() const;  // Caller owns returned memory
+
+ protected:
+  void RecordPost(UBaseType_t depth);
+  void RecordDrop() { atomic_fetch_add(&dropped, 1); }
+
+  UBaseType_t capacity;
+  UBaseType_t depth = 0;  // Items waiting when last posted to or drained
+  atomic_uint posted = ATOMIC_VAR_INIT(0);
+  atomic_uint dropped = ATOMIC_VAR_INIT(0);
+  atomic_uint max_depth = ATOMIC_VAR_INIT(0);
+};
+
+// A bounded queue of work items of type `T` for an IndyTask. Producers post
+// items, which notifies the task, and the task's function drains them. Items
+// are moved into one of `CAPACITY` slots owned by the queue, and only pointers
+// to slots pass through the FreeRTOS queues, so items aren't copied on the way
+// to the task, and no heap is used. When every slot is in use, posts are
+// dropped and counted. Items posted from an ISR must be trivially copyable.
+template <typename T, UBaseType_t CAPACITY>
+class IndyWorkQueue : public IndyWorkQueueStats {
+ public:
+  explicit IndyWorkQueue(IndyTask* task) : IndyWorkQueueStats(CAPACITY), task(task) { task->SetWorkQueue(this); }
+
+  // Creates the queues. Call before posting.
+  void Setup() {
+    free_slots = IndyRtos::CreateQueue(CAPACITY, sizeof(T*), free_slots_storage, &free_slots_buffer);
+    work = IndyRtos::CreateQueue(CAPACITY, sizeof(T*), work_storage, &work_buffer);
+    if (free_slots == nullptr || work == nullptr) {
+      ESP_LOGE("indy_work_queue", "Create %s work queue failed", task->GetName().c_str());
+      abort();
+    }
+    for (UBaseType_t ii = 0; ii < CAPACITY; ii++) {
+      T* slot = reinterpret_cast<T*>(slots[ii]);
+      xQueueSend(free_slots, &slot, 0);
+    }
+  }
+
+  // Moves `item` to the queue and notifies the task. Returns `false` if the
+  // queue is full, in which case `item` is dropped and left unchanged.
+  bool Post(T&& item) {
+    T* slot;
+    if (xQueueReceive(free_slots, &slot, 0) != pdTRUE) {
+      RecordDrop();
+      return false;
+    }
+    new (slot) T(std::move(item));
+    xQueueSend(work, &slot, 0);  // Can't fail, since there are only CAPACITY slots
+    RecordPost(uxQueueMessagesWaiting(work));
+    task->TaskNotifyGive();
+    return true;
+  }
+
+  // Copies `item` to the queue from an ISR and notifies the task. Returns
+  // `false` if the queue is full and `item` was dropped.
+  bool PostFromISR(const T& item) {
+    static_assert(std::is_trivially_copyable<T>::value, "Items posted from an ISR must be trivially copyable");
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    T* slot;
+    if (xQueueReceiveFromISR(free_slots, &slot, &xHigherPriorityTaskWoken) != pdTRUE) {
+      RecordDrop();
+      return false;
+    }
+    *slot = item;
+    xQueueSendFromISR(work, &slot, &xHigherPriorityTaskWoken);
+    RecordPost(uxQueueMessagesWaitingFromISR(work));
+    task->TaskNotifyGiveFromISR();
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    return true;
+  }
+
+  // Calls `handler` with each queued item, in the order they were posted, and
+  // then frees its slot. Call from the task's function. Returns the number of
+  // items handled.
+  template <typename Handler>
+  UBaseType_t Drain(const Handler& handler) {
+    UBaseType_t count = 0;
+    T* slot;
+    while (xQueueReceive(work, &slot, 0) == pdTRUE) {
+      handler(*slot);
+      slot->~T();
+      xQueueSend(free_slots, &slot, 0);
+      count++;
+    }
+    depth = 0;
+    return count;
+  }
+
+ private:
+  IndyTask* task;
+
+  // Item storage, and queues of free slots and of slots with work
+  alignas(T) uint8_t slots[CAPACITY][sizeof(T)];
+  QueueHandle_t free_slots = nullptr;
+  StaticQueue_t free_slots_buffer;
+  uint8_t free_slots_storage[CAPACITY * sizeof(T*)];
+  QueueHandle_t work = nullptr;
+  StaticQueue_t work_buffer;
+  uint8_t work_storage[CAPACITY * sizeof(T*)];
+
+  // Prevent copy and assignment since the queues hold pointers into `slots`.
+  IndyWorkQueue(const IndyWorkQueue&) = delete;
+  IndyWorkQueue& operator=(const IndyWorkQueue&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_COMMON_INDY_WORK_QUEUE_H_
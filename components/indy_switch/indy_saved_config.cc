@@ -0,0 +1,85 @@
+#include "indy_saved_config.h"
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "indy_switch_nvs.h"
+#include "indy_util.h"
+
+namespace {
+  const char *TAG = "indy_saved_config";
+
+  const int SECONDS_PER_MINUTE = 60;
+}
+
+// Creates an IndySavedConfig with no fields set
+IndySavedConfig::IndySavedConfig() {
+  memset(&data, 0, sizeof(data));
+  data.version = VERSION;
+}
+
+// Loads the configuration from `loaded`, which was read from NVS. Returns
+// `false` if it's not valid.
+bool IndySavedConfig::Load(const Data& loaded) {
+  if (loaded.version != VERSION) {
+    ESP_LOGE(TAG, "Saved config is version %d but expected %d", loaded.version, VERSION);
+    return false;
+  }
+  if (loaded.crc != ComputeCrc(loaded)) {
+    ESP_LOGE(TAG, "Saved config failed CRC check");
+    return false;
+  }
+  data = loaded;
+  data.timezone[TIMEZONE_SIZE - 1] = '\0';
+  return true;
+}
+
+// Saves the configuration to `nvs`
+void IndySavedConfig::Save(IndyNvs* nvs) {
+  data.crc = ComputeCrc(data);
+  nvs->WriteBlob(NVS_KEY_CONFIG, &data, sizeof(data));
+  nvs->Commit();
+}
+
+// Sets the timezone. Returns an error message if the timezone is too long to save.
+std::string IndySavedConfig::SetTimezone(const std::string& timezone) {
+  if (timezone.length() >= TIMEZONE_SIZE)
+    return FormatString("Timezone '%s' is longer than %d characters", timezone.c_str(), TIMEZONE_SIZE - 1);
+  memset(data.timezone, 0, sizeof(data.timezone));
+  memcpy(data.timezone, timezone.c_str(), timezone.length());
+  data.fields |= FIELD_TIMEZONE;
+  return "";
+}
+
+// Sets the random offset range, in minutes
+void IndySavedConfig::SetOffset(uint offset) {
+  data.offset = offset;
+  data.fields |= FIELD_OFFSET;
+}
+
+// Returns the sunrise and sunset times
+std::array<SunTimeOffsets, 12> IndySavedConfig::GetSunTimeOffsets() const {
+  std::array<SunTimeOffsets, 12> offsets;
+  for (size_t ii = 0; ii < offsets.size(); ii++) {
+    offsets[ii] = SunTimeOffsets(data.sunrise[ii] * SECONDS_PER_MINUTE, data.sunset[ii] * SECONDS_PER_MINUTE);
+  }
+  return offsets;
+}
+
+// Sets the sunrise and sunset times
+void IndySavedConfig::SetSunTimeOffsets(const std::array<SunTimeOffsets, 12>& offsets) {
+  for (size_t ii = 0; ii < offsets.size(); ii++) {
+    data.sunrise[ii] = offsets[ii].sunrise / SECONDS_PER_MINUTE;
+    data.sunset[ii] = offsets[ii].sunset / SECONDS_PER_MINUTE;
+  }
+  data.fields |= FIELD_SUNTIMES;
+}
+
+// Returns the CRC of `data`, computed over every field but the CRC itself
+uint32_t IndySavedConfig::ComputeCrc(const Data& data) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&data), offsetof(Data, crc));
+}
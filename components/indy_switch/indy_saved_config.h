@@ -0,0 +1,64 @@
+#ifndef COMPONENTS_INDY_SWITCH_INDY_SAVED_CONFIG_H_
+#define COMPONENTS_INDY_SWITCH_INDY_SAVED_CONFIG_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "indy_nvs.h"
+#include "indy_scheduler.h"
+
+// Holds the configuration that's changed at runtime and saved to NVS. It's
+// saved as a single versioned blob with a CRC, so it can be loaded with one
+// read and without parsing.
+class IndySavedConfig {
+ public:
+  static const size_t TIMEZONE_SIZE = 64;
+
+  // The configuration as stored in NVS
+  struct Data {
+    uint8_t version;
+    uint8_t fields;                 // Which fields have been set
+    uint16_t reserved;
+    uint32_t offset;                // Minutes
+    char timezone[TIMEZONE_SIZE];   // Null terminated
+    uint16_t sunrise[12];           // Minutes since midnight
+    uint16_t sunset[12];            // Minutes since midnight
+    uint32_t crc;                   // CRC32 of the fields above
+  };
+  static_assert(sizeof(Data) == 124, "Saved config should be 124 bytes");
+
+  IndySavedConfig();
+
+  bool Load(const Data& loaded);
+  void Save(IndyNvs* nvs);
+
+  // Timezone
+  bool HasTimezone() const { return (data.fields & FIELD_TIMEZONE) != 0; }
+  std::string GetTimezone() const { return std::string(data.timezone); }
+  std::string SetTimezone(const std::string& timezone);
+
+  // Random offset range
+  bool HasOffset() const { return (data.fields & FIELD_OFFSET) != 0; }
+  uint GetOffset() const { return data.offset; }
+  void SetOffset(uint offset);
+
+  // Sunrise and sunset times
+  bool HasSunTimeOffsets() const { return (data.fields & FIELD_SUNTIMES) != 0; }
+  std::array<SunTimeOffsets, 12> GetSunTimeOffsets() const;
+  void SetSunTimeOffsets(const std::array<SunTimeOffsets, 12>& offsets);
+
+ private:
+  static const uint8_t VERSION = 1;
+
+  // Which fields have been set
+  static const uint8_t FIELD_TIMEZONE = 1 << 0;
+  static const uint8_t FIELD_OFFSET = 1 << 1;
+  static const uint8_t FIELD_SUNTIMES = 1 << 2;
+
+  Data data;
+
+  static uint32_t ComputeCrc(const Data& data);
+};
+
+#endif  // COMPONENTS_INDY_SWITCH_INDY_SAVED_CONFIG_H_
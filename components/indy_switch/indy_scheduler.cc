@@ -14,6 +14,7 @@
 
 #include "indy_config.h"
 #include "indy_json.h"
+#include "indy_rtos.h"
 #include "indy_time.h"
 #include "indy_util.h"
 
@@ -25,10 +26,6 @@ namespace {
   const char *TAG = "indy_scheduler";
 }
 
-// NVS keys
-#define NVS_KEY_NEXT_ACTION      "nxtact"
-#define NVS_KEY_NEXT_ACTION_TIME "nxtact_time"
-
 // Returns `next_action` as a string
 const char* IndyScheduler::NextActionAsStr(NextActionEnum next_action) {
   switch (next_action) {
@@ -85,8 +82,19 @@ std::string ParseSunTime(const std::string& time_str, int* result) {
   return "";
 }
 
-// Parses the JSON `suntimes` that was parsed using `parser`, and stores results to sun_time_offsets
-std::string IndyScheduler::SetSuntimes(const JsonParser& parser, cJSON* suntimes) {
+// Returns the sun time `offset`, in seconds since midnight, formatted as
+// "HH:MM AM/PM". This is the inverse of ParseSunTime.
+std::string IndyScheduler::FormatSunTime(int offset) {
+  int hours, minutes;
+  ComputeHoursAndMinutes(offset, &hours, &minutes);
+  bool is_pm = hours > 12;
+  return FormatString("%d:%02d %s", is_pm ? hours - 12 : hours, minutes, is_pm ? "PM" : "AM");
+}
+
+// Parses the JSON `suntimes` that was parsed using `parser`, and stores results to `result`.
+// Returns an error message if there was an error.
+std::string IndyScheduler::ParseSuntimes(
+  const JsonParser& parser, cJSON* suntimes, std::array<SunTimeOffsets, 12>* result) {
   // Lookup month keys
   std::vector<std::string> month_keys = parser.LookupKeys(suntimes);
 
@@ -112,11 +120,11 @@ std::string IndyScheduler::SetSuntimes(const JsonParser& parser, cJSON* suntimes
 
     // Parse the times for this month
     int sunrise_offset, sunset_offset;
-    std::string sunrise_str = month_times.value[0];
+    const std::string& sunrise_str = month_times.value[0];
     std::string error = ParseSunTime(sunrise_str, &sunrise_offset);
     if (error.size() > 0)
       return error;
-    std::string sunset_str = month_times.value[1];
+    const std::string& sunset_str = month_times.value[1];
     error = ParseSunTime(sunset_str, &sunset_offset);
     if (error.size() > 0)
       return error;
@@ -126,7 +134,7 @@ std::string IndyScheduler::SetSuntimes(const JsonParser& parser, cJSON* suntimes
 
     // Save times for this month
     int month_index = month - 1;
-    new_offsets[month_index] = SunTimeOffsets(sunrise_offset, sunrise_str, sunset_offset, sunset_str);
+    new_offsets[month_index] = SunTimeOffsets(sunrise_offset, sunset_offset);
   }
 
   // Check that all months are set
@@ -135,17 +143,36 @@ std::string IndyScheduler::SetSuntimes(const JsonParser& parser, cJSON* suntimes
         return FormatString("Suntimes for month %d are not set", ii + 1);
   }
 
+  *result = new_offsets;
+  return "";
+}
+
+// Parses the JSON `suntimes` that was parsed using `parser`, and stores results to sun_time_offsets
+std::string IndyScheduler::SetSuntimes(const JsonParser& parser, cJSON* suntimes) {
+  std::array<SunTimeOffsets, 12> new_offsets;
+  std::string error = ParseSuntimes(parser, suntimes, &new_offsets);
+  if (error.size() > 0)
+    return error;
+
   // Save new times
   sun_time_offsets = new_offsets;
 
-  // Save copy of JSON version of suntimes
-  if (suntimes_json != nullptr)
-    cJSON_Delete(suntimes_json);
-  suntimes_json = JsonParser::CloneJSON(suntimes);
-
   return "";
 }
 
+// Returns the JSON version of the sunrise and sunset times, in the same form
+// accepted by SetSuntimes. Caller owns returned memory.
+cJSON* IndyScheduler::CreateSuntimesJson() {
+  cJSON* suntimes = cJSON_CreateObject();
+  for (size_t ii = 0; ii < sun_time_offsets.size(); ii++) {
+    cJSON* month_times = cJSON_CreateArray();
+    cJSON_AddItemToArray(month_times, cJSON_CreateString(FormatSunTime(sun_time_offsets[ii].sunrise).c_str()));
+    cJSON_AddItemToArray(month_times, cJSON_CreateString(FormatSunTime(sun_time_offsets[ii].sunset).c_str()));
+    cJSON_AddItemToObject(suntimes, FormatString("%d", ii + 1).c_str(), month_times);
+  }
+  return suntimes;
+}
+
 IndyScheduler::~IndyScheduler() {
   // Clean up timer
   if (next_action_timer != nullptr) {
@@ -154,12 +181,6 @@ IndyScheduler::~IndyScheduler() {
     }
     next_action_timer = nullptr;
   }
-
-  // Clean up JSON
-  if (suntimes_json != nullptr) {
-    cJSON_Delete(suntimes_json);
-    suntimes_json  = nullptr;
-  }
 }
 
 // Returns sun time as a time_t given:
@@ -184,6 +205,24 @@ time_t DetermineSunTime(const struct tm& now_tm, int current_offset, int sun_tim
   return suntime;
 }
 
+// Parses `time_str`, a time of day expressed as "HH:MM AM/PM", and stores the
+// next time it comes around to `result`. Returns an error message if there was
+// an error.
+std::string IndyScheduler::ParseTimeOfDay(const std::string& time_str, time_t* result) {
+  int offset;
+  std::string error = ParseSunTime(time_str, &offset);
+  if (error.size() > 0)
+    return error;
+
+  time_t now = time(nullptr);
+  struct tm now_tm;
+  if (localtime_r(&now, &now_tm) == nullptr)
+    return FormatString("Unable to convert time_t %lld to local time", (long long) now);
+  int current_offset = ComputeSeconds(now_tm.tm_hour, now_tm.tm_min, now_tm.tm_sec);
+  *result = DetermineSunTime(now_tm, current_offset, offset);
+  return "";
+}
+
 // Populates `suntimes` with next sunrise and sunset. Returns nullptr if there
 // was an error, or otherwise `suntimes`.
 SunTimes* IndyScheduler::DetermineSunTimes(SunTimes* suntimes) {
@@ -191,7 +230,7 @@ SunTimes* IndyScheduler::DetermineSunTimes(SunTimes* suntimes) {
   time_t now = time(nullptr);
   struct tm now_tm;
   if (localtime_r(&now, &now_tm) == nullptr) {
-    ESP_LOGE(TAG, "Unable to convert time_t %lld to local time", now);
+    ESP_LOGE(TAG, "Unable to convert time_t %lld to local time", (long long) now);
     return nullptr;
   }
 
@@ -211,12 +250,21 @@ SunTimes* IndyScheduler::DetermineSunTimes(SunTimes* suntimes) {
 }
 
 // Sets up IndyScheduer. System time and timezone must have been set first.
-void IndyScheduler::Setup(IndyNvs* nvs) {
+void IndyScheduler::Setup(IndyJournal* journal, int channel) {
+  // Create the mutex, to control access to the override and timer
+  mutex = IndyRtos::CreateMutex(&mutex_buffer);
+  if (mutex == nullptr) {
+    ESP_LOGE(TAG, "Create scheduler mutex failed");
+    abort();
+  }
+
   // Restore state
-  this->nvs = nvs;
-  next_action = (NextActionEnum) nvs->ReadInt(NVS_KEY_NEXT_ACTION);
+  this->journal = journal;
+  this->channel = channel;
+  IndyJournalState state = journal->GetState(channel);
+  next_action = (NextActionEnum) state.next_action;
   ESP_LOGI(TAG, "Restored next action is %s", NextActionAsStr());
-  next_action_time = nvs->ReadTime(NVS_KEY_NEXT_ACTION_TIME);
+  next_action_time = state.next_action_time;
   ESP_LOGI(TAG, "Restored next action time is %s", IndyTime::FormatTime(next_action_time).c_str());
 
   // Lookup sun times
@@ -252,21 +300,32 @@ void IndyScheduler::Setup(IndyNvs* nvs) {
   StartTimer();
 }
 
-// Starts the next action timer, which will expire when it's time for the next action
+// Starts the next action timer, which will expire when it's time for the next
+// action, or for the override to end if that's sooner
 void IndyScheduler::StartTimer() {
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to start timer");
+    return;
+  }
+
   // In how many seconds should the timer expire? Use 1 as minimum since
   // xTimerCreate ticks parameter must not be 0.
   time_t now = time(nullptr);
-  time_t seconds_until_target = std::max(next_action_time - now, (time_t) 1);
+  time_t target = next_action_time;
+  if (active_override.IsSet() && active_override.until < target)
+    target = active_override.until;
+  time_t seconds_until_target = std::max(target - now, (time_t) 1);
 
   // Create or change timer
   TickType_t ticks = seconds_until_target * configTICK_RATE_HZ;
   if (next_action_timer == nullptr) {
     // Create timer
     ESP_LOGI(TAG, "Creating timer");
-    next_action_timer = xTimerCreate("Next Action Timer", ticks, pdFALSE, this, TimerCallback);
+    next_action_timer = IndyRtos::CreateTimer(
+      "Next Action Timer", ticks, pdFALSE, this, TimerCallback, &next_action_timer_buffer);
     if (next_action_timer == nullptr) {
       ESP_LOGE(TAG, "Unable to create timer");
+      Unlock();
       return;
     }
   } else {
@@ -274,16 +333,20 @@ void IndyScheduler::StartTimer() {
     ESP_LOGI(TAG, "Changing timer period");
     if (xTimerChangePeriod(next_action_timer, ticks, 0) == pdFAIL) {
       ESP_LOGE(TAG, "Unable to change timer period");
+      Unlock();
       return;
     }
   }
 
   // Start timer
   ESP_LOGI(TAG, "Starting timer to expire in %lld second(s), at %s",
-    seconds_until_target, IndyTime::FormatTime(next_action_time).c_str());
+    (long long) seconds_until_target, IndyTime::FormatTime(target).c_str());
   if (xTimerStart(next_action_timer, 0) == pdFAIL)
     ESP_LOGE(TAG, "Unable to start timer");
   ESP_LOGI(TAG, "Timer started");
+
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after starting timer");
 }
 
 // Notifies the scheduler task that it's time for the next action. A task is
@@ -296,11 +359,124 @@ void IndyScheduler::TimerCallback(TimerHandle_t handle) {
   scheduler->task.TaskNotifyGive();
 }
 
-// Notifies scheduler that it's time for the next action
+// Notifies scheduler that it's time for the next action, or for the override to end
 void IndyScheduler::TaskFunction(void *arg) {
-  // Do next action
   IndyScheduler* scheduler = reinterpret_cast<IndyScheduler*>(arg);
-  scheduler->HandleNextActionTimerExpiry();
+  scheduler->HandleTimerExpiry();
+}
+
+// Ends the override if its time has come, and does the next action if its
+// time has come. When the override ends, the switch is set as the schedule
+// has it, unless the next action just set it.
+void IndyScheduler::HandleTimerExpiry() {
+  time_t now = time(nullptr);
+
+  // End the override
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to handle timer");
+    return;
+  }
+  bool resume = active_override.IsSet() && now >= active_override.until;
+  if (resume)
+    active_override = IndyOverride();
+  bool overriding = active_override.IsSet();
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after handling timer");
+
+  // Do the next action, or wait for it
+  bool action_due = now >= next_action_time;
+  if (action_due)
+    HandleNextActionTimerExpiry(overriding);
+  else
+    StartTimer();
+
+  if (resume && !action_due)
+    ResumeSchedule();
+}
+
+// Sets the switch as the schedule has it, which is the opposite of the next action
+void IndyScheduler::ResumeSchedule() {
+  if (next_action == NextActionEnum::NOOP)
+    return;
+  bool on = next_action == NextActionEnum::OFF;
+  ESP_LOGI(TAG, "Override ended. Resuming schedule with switch %s.", on ? "ON" : "OFF");
+  for (const NextActionHandler& handler : handlers)
+    handler(on);
+}
+
+// Holds the switch `on` until `until`, after which the schedule takes over
+// again. Returns an error message if there was an error.
+std::string IndyScheduler::SetOverride(bool on, time_t until) {
+  if (!IsActive())
+    return "Unable to override switch until time has synced and the schedule has started";
+  if (!Lock())
+    return "Unable to override switch";
+  active_override.on = on;
+  active_override.until = until;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after setting override");
+  ESP_LOGI(TAG, "Overriding schedule with switch %s until %s", on ? "ON" : "OFF", IndyTime::FormatTime(until).c_str());
+  StartTimer();
+  return "";
+}
+
+// Ends the override, if there is one, without changing the switch
+void IndyScheduler::ClearOverride() {
+  if (!IsActive())
+    return;
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to clear override");
+    return;
+  }
+  bool was_set = active_override.IsSet();
+  active_override = IndyOverride();
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after clearing override");
+  if (was_set)
+    StartTimer();
+}
+
+// Returns the override, which isn't set if there is none
+IndyOverride IndyScheduler::GetOverride() {
+  if (!IsActive())
+    return IndyOverride();
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to get override");
+    return IndyOverride();
+  }
+  IndyOverride result = active_override;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after getting override");
+  return result;
+}
+
+// Returns the next action. The lock is taken once the schedule is active,
+// since the scheduler task changes the next action.
+NextActionEnum IndyScheduler::GetNextAction() {
+  if (!IsActive())
+    return next_action;
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to get next action");
+    return NextActionEnum::NOOP;
+  }
+  NextActionEnum result = next_action;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after getting next action");
+  return result;
+}
+
+// Returns when the next action is due
+time_t IndyScheduler::GetNextActionTime() {
+  if (!IsActive())
+    return next_action_time;
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to get next action time");
+    return NULL_TIME;
+  }
+  time_t result = next_action_time;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after getting next action time");
+  return result;
 }
 
 // Randomizes `time` by +/- random_offset_range minutes
@@ -313,8 +489,8 @@ time_t IndyScheduler::RandomizeTime(time_t time) {
 }
 
 // Notifies listeners that it's time for the next action, and then schedules the
-// subsequent next action
-void IndyScheduler::HandleNextActionTimerExpiry() {
+// subsequent next action. Listeners aren't notified while `overriding`.
+void IndyScheduler::HandleNextActionTimerExpiry(bool overriding) {
   ESP_LOGI(TAG, "Handling timer expiry for next action %s", NextActionAsStr());
   ESP_LOGI(TAG, "The current time is %s", IndyTime::FormatTime(time(nullptr)).c_str());
 
@@ -326,8 +502,12 @@ void IndyScheduler::HandleNextActionTimerExpiry() {
 
   // Notify next action handlers
   bool on = next_action == NextActionEnum::ON;
-  for (const NextActionHandler& handler : handlers)
-    handler(on);
+  if (overriding) {
+    ESP_LOGI(TAG, "Skipping next action while the switch is overridden");
+  } else {
+    for (const NextActionHandler& handler : handlers)
+      handler(on);
+  }
 
   // Lookup sun times
   if (DetermineSunTimes(&current_sun_times) == nullptr) {
@@ -336,22 +516,32 @@ void IndyScheduler::HandleNextActionTimerExpiry() {
   }
 
   // Determine next action
-  if (on) {
-    next_action = NextActionEnum::OFF;
-    next_action_time = RandomizeTime(current_sun_times.sunrise);
-  } else {
-    next_action = NextActionEnum::ON;
-    next_action_time = RandomizeTime(current_sun_times.sunset);
+  NextActionEnum new_next_action = on ? NextActionEnum::OFF : NextActionEnum::ON;
+  time_t new_next_action_time = RandomizeTime(on ? current_sun_times.sunrise : current_sun_times.sunset);
+  if (!Lock()) {
+    ESP_LOGE(TAG, "Failed to acquire lock to set next action");
+    return;
   }
+  next_action = new_next_action;
+  next_action_time = new_next_action_time;
+  if (!Unlock())
+    ESP_LOGE(TAG, "Failed to release lock after setting next action");
   ESP_LOGI(TAG, "Scheduling next action %s for %s",
     NextActionAsStr(), IndyTime::FormatTime(next_action_time).c_str());
 
   // Save updated state to storage
-  nvs->WriteInt(NVS_KEY_NEXT_ACTION, (int32_t) next_action);
-  nvs->WriteTime(NVS_KEY_NEXT_ACTION_TIME, next_action_time);
-  nvs->Commit();
+  journal->WriteNextAction(channel, (int32_t) next_action, next_action_time);
 
   // Start timer
   StartTimer();
 }
 
+bool IndyScheduler::Lock() {
+  // Acquire mutex
+  return xSemaphoreTake(mutex, MAX_WAIT) == pdTRUE;
+}
+
+bool IndyScheduler::Unlock() {
+  // Release mutex
+  return xSemaphoreGive(mutex) == pdTRUE;
+}
@@ -3,6 +3,7 @@
 
 #include <cJSON.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/timers.h>
 
 #include <array>
@@ -10,22 +11,19 @@
 #include <string>
 #include <vector>
 
+#include "indy_config.h"
 #include "indy_json.h"
-#include "indy_nvs.h"
+#include "indy_journal.h"
 #include "indy_task.h"
 #include "indy_util.h"
 
 // Holds the time of sunrise and sunset in number of seconds since midnight
 struct SunTimeOffsets {
   int sunrise;
-  std::string sunrise_str;
-
   int sunset;
-  std::string sunset_str;
 
   SunTimeOffsets() : sunrise(-1), sunset(-1) {}
-  SunTimeOffsets(int sr, const std::string& sr_str, int ss, const  std::string& ss_str) :
-    sunrise(sr), sunrise_str(sr_str), sunset(ss), sunset_str(ss_str) {}
+  SunTimeOffsets(int sr, int ss) : sunrise(sr), sunset(ss) {}
 
   bool IsSet() const { return sunrise != -1 && sunset != -1; }
 };
@@ -46,69 +44,102 @@ enum class NextActionEnum {
   OFF = 2   // Turn switch off
 };
 
-// Manages the schedule for IndySwitch, to turn the switch on at sunset and off at sunrise
+// A manual command that holds the switch on or off until a time, after which
+// the schedule takes over again
+struct IndyOverride {
+  bool on = false;
+  time_t until = NULL_TIME;
+
+  bool IsSet() const { return until != NULL_TIME; }
+};
+
+// Manages the schedule for a channel of IndySwitch, to turn the channel on at
+// sunset and off at sunrise. An override holds the switch on or off until a
+// time, skipping any actions that come up meanwhile, and then sets the switch
+// as the schedule has it. Overrides share the next action timer.
 class IndyScheduler {
  public:
-  IndyScheduler(): task("SchedulerTask") {}
+  explicit IndyScheduler(const std::string& task_name): task(task_name, SCHEDULER_TASK_CONFIG) {}
   ~IndyScheduler();
 
-  bool IsActive() const { return nvs != nullptr; }
+  bool IsActive() const { return journal != nullptr; }
 
   // Configuring
   std::string SetSuntimes(const JsonParser& parser, cJSON* settings);
-  void Setup(IndyNvs* nvs);
+  static std::string ParseSuntimes(const JsonParser& parser, cJSON* suntimes, std::array<SunTimeOffsets, 12>* result);
+  void SetSunTimeOffsets(const std::array<SunTimeOffsets, 12>& offsets) { sun_time_offsets = offsets; }
+  void Setup(IndyJournal* journal, int channel);
 
   // Sunrise and sunset times
   SunTimes GetCurrentSunTimes() { return current_sun_times; }
-  std::array<SunTimeOffsets, 12> GetSunTimeOffsets() { return sun_time_offsets; }
-  cJSON* GetSuntimesJson() { return suntimes_json; }  // Scheduler still owns memory after call
+  const std::array<SunTimeOffsets, 12>& GetSunTimeOffsets() { return sun_time_offsets; }
+  bool HasSunTimeOffsets() { return sun_time_offsets[0].IsSet(); }
+  cJSON* CreateSuntimesJson();  // Caller owns returned memory
+  static std::string FormatSunTime(int offset);
 
   // Next action: what to do and when
   static const char* NextActionAsStr(NextActionEnum next_action);
   const char* NextActionAsStr();
-  NextActionEnum GetNextAction() { return next_action; }
-  time_t GetNextActionTime() { return next_action_time; }
+  NextActionEnum GetNextAction();
+  time_t GetNextActionTime();
 
   // Next action handlers, to notify listeners that a next action should happen
   using NextActionHandler = std::function<void(bool)>;
   void RegisterNextActionHandler(const NextActionHandler& handler) { handlers.push_back(handler); }
 
-  // Next action timer
-  void HandleNextActionTimerExpiry();
+  // Overrides
+  std::string SetOverride(bool on, time_t until);
+  void ClearOverride();
+  IndyOverride GetOverride();
+  static std::string ParseTimeOfDay(const std::string& time_str, time_t* result);
 
   // Random offset range
   uint GetRandomOffsetRange() { return random_offset_range; }
   void SetRandomOffsetRange(uint range) { random_offset_range = range; }
 
  private:
-  // Next action timer
+  // Next action timer, which also ends overrides
   TimerHandle_t next_action_timer = nullptr;
+  StaticTimer_t next_action_timer_buffer;
   static void TimerCallback(TimerHandle_t handle);
   void StartTimer();
+  void HandleTimerExpiry();
+  void HandleNextActionTimerExpiry(bool overriding);
 
   // Scheduler task
   IndyTask task;
   static void TaskFunction(void *arg);
 
-  // Storage
-  IndyNvs* nvs = nullptr;
+  // Storage, where state is saved for `channel`
+  IndyJournal* journal = nullptr;
+  int channel = 0;
 
   // Sunrise and sunset times
   SunTimes current_sun_times;
   std::array<SunTimeOffsets, 12> sun_time_offsets;
-  cJSON *suntimes_json = nullptr;
   SunTimes* DetermineSunTimes(SunTimes* suntimes);
 
   // Random offset range
   uint random_offset_range = 0;  // Minutes
   time_t RandomizeTime(time_t time);
 
-  // Next action: what to do and when
+  // Next action: what to do and when. Only changed on the scheduler task,
+  // once it's started, and guarded by the mutex for other tasks.
   NextActionEnum next_action = NextActionEnum::NOOP;
   time_t next_action_time = NULL_TIME;
 
   // Next action handlers
   std::vector<NextActionHandler> handlers;
+
+  // Override, guarded by the mutex
+  IndyOverride active_override;
+  void ResumeSchedule();
+
+  // Mutex for locking the override, the next action and the timer
+  SemaphoreHandle_t mutex = nullptr;
+  StaticSemaphore_t mutex_buffer;
+  bool Lock();
+  bool Unlock();
 };
 
 #endif  // COMPONENTS_INDY_SWITCH_INDY_SCHEDULER_H_
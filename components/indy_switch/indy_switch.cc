@@ -2,29 +2,55 @@
 
 #include <time.h>
 
+#include <esp_attr.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <FreeRTOSConfig.h>
-#include <soc/clk_tree_defs.h>
 
+#include <array>
+#include <cstdlib>
+#include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "cJSON.h"
+#include "indy_boot.h"
 #include "indy_config.h"
+#include "indy_coroutine.h"
+#include "indy_dispatcher.h"
 #include "indy_json.h"
+#include "indy_memory.h"
+#include "indy_rtos.h"
 #include "indy_scheduler.h"
+#include "indy_switch_nvs.h"
 #include "indy_task_manager.h"
 #include "indy_util.h"
 
 namespace {
   const char *TAG = "indy_switch";
-  const char *NVS_KEY_IS_ON = "is_on";
-  const char *NVS_KEY_CONFIG_TIMEZONE = "timezone";
-  const char *NVS_KEY_CONFIG_RANDOM_OFFSET_RANGE = "offset";
-  const char *NVS_KEY_CONFIG_SUNTIMES = "suntimes";
+
+  // Time taken by a restart command, from when it's received to esp_restart,
+  // and the part of that spent waiting for tasks to end. It's kept in RTC
+  // memory, which survives a software restart, so it can be reported after
+  // the restart.
+  struct RestartTiming {
+    uint32_t magic;
+    uint32_t join_us;
+    uint32_t total_us;
+  };
+  const uint32_t RESTART_TIMING_MAGIC = 0x52535452;
+  RTC_NOINIT_ATTR RestartTiming restart_timing;
+  RestartTiming last_restart_timing = {};
+
+  // The longest a restart waits for its response to be published
+  const int RESTART_PUBLISH_WAIT_MS = 2000;
+
+  // The longest a control command can override the schedule for
+  const int OVERRIDE_MINUTES_MAX = 24 * 60;
 }
 
 // Initial configuration, from the file main/initial_config.json
@@ -32,116 +58,468 @@ extern const uint8_t initial_config_start[]  asm("_binary_initial_config_json_st
 extern const uint8_t initial_config_end[]    asm("_binary_initial_config_json_end");
 
 void IndySwitch::Setup() {
+  // Take the timing of the restart command that led to this boot, if there was one
+  if (restart_timing.magic == RESTART_TIMING_MAGIC)
+    last_restart_timing = restart_timing;
+  restart_timing.magic = 0;
+
+  // Start tracking heap use by subsystem, and boot phases
+  IndyMemory& memory = IndyMemory::GetInstance();
+  memory.Setup();
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+  IndyBootTimeline& boot = IndyBootTimeline::GetInstance();
+  boot.Record(IndyBootPhase::SETUP_STARTED);
+
   // Create the is_on mutex, to control access to is_on
-  is_on_mutex = xSemaphoreCreateMutex();
+  is_on_mutex = IndyRtos::CreateMutex(&is_on_mutex_buffer);
   if (is_on_mutex == nullptr) {
     ESP_LOGE(TAG, "Create is on mutex failed");
     abort();
   }
 
-  // Setup the ESP32
-  nvs.Setup();
-  wifi.Setup();
-  mdns.Setup();
-  mqtt.Setup();
-  time.Setup([this]() { HandleTimeSynced(); });
-
-  // Setup peripherals
-  led.Setup();
-  button.Setup();
-  relay.Setup();
-
-  // Load configuration
-  LoadInitialConfig();  // Configuration flashed to device
-  LoadSavedConfig();    // Configuration set at runtime and saved to NVS
-
-  // Restore state
-  ESP_LOGI(TAG, "Restoring is on state");
-  SetSwitch(nvs.ReadBool(NVS_KEY_IS_ON));
-
-  // Register button press handler
-  button.RegisterButtonPressHandler([this]() {
-    ESP_LOGI(TAG, "Button press handler called");
-    ToggleSwitch();
-  });
+  // Create the actuator task, and a timer for each channel that wakes it when
+  // the channel's held command is due
+  actuator_task.CreateTask(ActuatorTaskFunction, this);
+  for (IndySwitchChannel& channel : channels) {
+    channel.actuator_timer = IndyRtos::CreateTimer("SwitchActuator", 1, pdFALSE, this, ActuatorTimerCallback,
+      &channel.actuator_timer_buffer);
+    if (channel.actuator_timer == nullptr) {
+      ESP_LOGE(TAG, "Create actuator timer failed");
+      abort();
+    }
+  }
 
-  // Register next action handler
-  scheduler.RegisterNextActionHandler([this](bool on) {
-    ESP_LOGI(TAG, "Register next action handler called");
-    SetSwitch(on);
-  });
+  // Load everything saved to NVS
+  int64_t nvs_start_time = esp_timer_get_time();
+  nvs.Setup();
+  memory.RecordSetup(IndyHeapTag::NVS, &free_heap);
+  std::unique_ptr<IndySwitchNvsValues> saved = std::make_unique<IndySwitchNvsValues>();
+  nvs.LoadAll(NVS_KEYS, sizeof(NVS_KEYS) / sizeof(NVS_KEYS[0]), saved.get());
+  ESP_LOGI(TAG, "Loading from NVS took %" PRId64 " us", esp_timer_get_time() - nvs_start_time);
+  boot.Record(IndyBootPhase::NVS_LOADED);
+
+  // Restore the relays first, so a power blip only turns them off for as long
+  // as it takes to read flash, and not while the network comes up
+  for (IndySwitchChannel& channel : channels) {
+    channel.relay_bit = outputs.AddPin(channel.config.relay);
+    if (channel.index != 0)
+      channel.led_bit = outputs.AddPin(channel.config.led);
+  }
+  outputs.Setup();
+  status_led.Setup();
+  memory.RecordSetup(IndyHeapTag::PERIPHERALS, &free_heap);
+  history.Setup(saved->history_found ? &saved->history : nullptr);
+  usage.Setup(saved->usage_found ? &saved->usage : nullptr);
+  RestoreState(*saved);
+  memory.RecordSetup(IndyHeapTag::JOURNAL, &free_heap);
+  boot.Record(IndyBootPhase::RELAY_RESTORED);
+
+  // Save the history and usage to NVS from time to time
+  if (!SaveRecords().IsStarted())
+    ESP_LOGE(TAG, "Start saving records failed");
+
+  // Watch each channel's button. A press toggles the channel straight from
+  // the button's debounce timer, with the journal task saving the new state.
+  // If that can't be done without blocking, the short press handler toggles
+  // it instead on the button task.
+  for (IndySwitchChannel& channel : channels) {
+    if (channel.config.button == GPIO_NUM_NC)
+      continue;
+    int index = channel.index;
+    if (JOURNAL_WRITE_ASYNC) {
+      channel.button.RegisterFastPressHandler([this, index](int64_t press_time) {
+        return ToggleSwitchFast(index, press_time);
+      });
+      channel.button.RegisterFastPressDoneHandler([this, index]() { FinishFastToggle(index); });
+    }
+    channel.button.RegisterGestureHandler(IndyButtonGesture::SHORT_PRESS, [this, index]() {
+      ESP_LOGI(TAG, "Button press handler called for channel %d", index);
+      ToggleSwitch(index);
+    });
+    channel.button.Setup();
+  }
+  memory.RecordSetup(IndyHeapTag::PERIPHERALS, &free_heap);
+
+  // Register next action handlers
+  for (IndySwitchChannel& channel : channels) {
+    int index = channel.index;
+    channel.scheduler.RegisterNextActionHandler([this, index](bool on) {
+      ESP_LOGI(TAG, "Next action handler called for channel %d", index);
+      RequestSwitch(index, on, IndySwitchSource::SCHEDULE);
+    });
+  }
 
-  // Create  MQTT topics
+  // Create  MQTT topics. The control topic without a channel number controls
+  // channel 0.
+  for (IndySwitchChannel& channel : channels) {
+    channel.control_topic = FormatString("indy-switch/%s/%d/control", HOSTNAME, channel.index);
+    channel.status_topic = FormatString("indy-switch/%s/%d/status/get", HOSTNAME, channel.index);
+  }
   control_topic = FormatString("indy-switch/%s/control", HOSTNAME);
   config_topic = FormatString("indy-switch/%s/config", HOSTNAME);
   status_topic = FormatString("indy-switch/%s/status/get", HOSTNAME);
   restart_topic = FormatString("indy-switch/%s/restart", HOSTNAME);
   reset_topic = FormatString("indy-switch/%s/reset", HOSTNAME);
+  memory_topic = FormatString("indy-switch/%s/memory/get", HOSTNAME);
+  history_topic = FormatString("indy-switch/%s/history/get", HOSTNAME);
 
-  // Register MQTT connected handler
+  // Register MQTT connected and disconnected handlers
   mqtt.RegisterConnectedHandler([this]() { HandleMqttConnected(); });
+  peer.RegisterStateHandler([this](const IndyPeerState& state) { return HandlePeerState(state); });
+  mqtt.RegisterDisconnectedHandler([this]() { status_led.SetMqttConnected(false); });
+
+  // Start the network, which runs as a coroutine while configuration loads
+  if (!SetupNetwork().IsStarted()) {
+    ESP_LOGE(TAG, "Start network setup failed");
+    abort();
+  }
+
+  // Load configuration. MQTT and the scheduler wait for it.
+  free_heap = IndyMemory::GetFreeHeap();
+  LoadInitialConfig();  // Configuration flashed to device
+  LoadSavedConfig(*saved);  // Configuration set at runtime and saved to NVS
+  saved.reset();
+  memory.RecordSetup(IndyHeapTag::CONFIG, &free_heap);
+  boot.Record(IndyBootPhase::CONFIG_LOADED);
+  boot_events.Set(CONFIG_LOADED_BIT);
+
+  ESP_LOGI(TAG, "Setup completed, with network setup continuing. Free heap is %" PRIu32 " bytes.", free_heap);
+}
+
+// Sets up the network, and then the scheduler once time has synced. Wifi and
+// mDNS start straight away. MQTT and SNTP both need a connection, so they start
+// together once wifi connects, and once configuration has loaded since MQTT
+// commands and the scheduler use it.
+IndyCoroutine IndySwitch::SetupNetwork() {
+  IndyMemory& memory = IndyMemory::GetInstance();
+  uint32_t free_heap = IndyMemory::GetFreeHeap();
+  IndyBootTimeline& boot = IndyBootTimeline::GetInstance();
+
+  // Start wifi, and mDNS which announces once wifi connects. When wifi
+  // reconnects, MQTT reconnects straight away. mDNS follows the connection
+  // itself, and SNTP only runs until time first syncs.
+  wifi.RegisterConnectionHandler([this](bool connected) {
+    status_led.SetWifiConnected(connected);
+    if (connected)
+      mqtt.HandleNetworkConnected();
+  });
+  wifi.Setup(&nvs);
+  memory.RecordSetup(IndyHeapTag::WIFI, &free_heap);
+  boot.Record(IndyBootPhase::WIFI_STARTED);
+  mdns.Setup();
+  memory.RecordSetup(IndyHeapTag::MDNS, &free_heap);
+  boot.Record(IndyBootPhase::MDNS_STARTED);
 
-  ESP_LOGI(TAG, "Setup completed");
+  // Wait for wifi to connect. Wifi keeps trying until it does.
+  co_await wifi.WaitForConnection();
+  ESP_LOGI(TAG, "Wifi connected");
+  boot.Record(IndyBootPhase::WIFI_CONNECTED);
+
+  // Start MQTT and SNTP, once configuration has loaded
+  co_await boot_events.Wait(CONFIG_LOADED_BIT);
+  free_heap = IndyMemory::GetFreeHeap();
+  mqtt.Setup();
+  memory.RecordSetup(IndyHeapTag::MQTT, &free_heap);
+  boot.Record(IndyBootPhase::MQTT_STARTED);
+  time.Setup();
+  memory.RecordSetup(IndyHeapTag::TIME, &free_heap);
+  boot.Record(IndyBootPhase::TIME_STARTED);
+
+  // Join peers on the LAN, and announce that this device is one
+  peer.Setup();
+  mdns.AddService(PEER_MDNS_SERVICE, PEER_MDNS_PROTO, PEER_PORT);
+  mdns.SetServiceTxt(PEER_MDNS_SERVICE, PEER_MDNS_PROTO, "group", PEER_MULTICAST_ADDRESS);
+  memory.RecordSetup(IndyHeapTag::PEER, &free_heap);
+  ESP_LOGI(TAG, "Network setup completed. Free heap is %" PRIu32 " bytes.", free_heap);
+
+  // Configure the scheduler once time has synced
+  co_await time.WaitForSync();
+  boot.Record(IndyBootPhase::TIME_SYNCED);
+  HandleTimeSynced();
+  boot.Record(IndyBootPhase::SCHEDULER_READY);
 }
 
 const char* SwitchStateAsStr(bool on) {
   return on ? "ON" : "OFF";
 }
 
-// Toggles switch on and off
-void IndySwitch::ToggleSwitch() {
-    ESP_LOGI(TAG, "Toggling switch");
-    SetSwitch(!is_on);
+// Sets the relay and LED of `channel` together, with one GPIO write
+void IndySwitch::WriteOutputs(const IndySwitchChannel& channel, bool on) {
+  uint32_t bits = channel.relay_bit | channel.led_bit;
+  if (on)
+    outputs.Write(bits, 0);
+  else
+    outputs.Write(0, bits);
 }
 
-// Sets switch on and off
-void IndySwitch::SetSwitch(bool on) {
-  // Acquire the mutex needed to change is on state
+// Toggles switch `channel` on and off
+void IndySwitch::ToggleSwitch(int channel) {
+    ESP_LOGI(TAG, "Toggling switch %d", channel);
+    SetSwitch(channel, !channels[channel].is_on);
+}
+
+// Toggles switch `channel` on and off from the button's debounce timer, for a
+// press that started at `press_time`. Returns `false` without waiting if
+// another change holds the is on mutex. The relay changes here, and the
+// journal write, status LED and log are finished on the button task by
+// FinishFastToggle, since the timer's task mustn't block. Only used when the
+// journal writes asynchronously.
+bool IndySwitch::ToggleSwitchFast(int channel, int64_t press_time) {
+  int64_t start_time = esp_timer_get_time();
+  if (xSemaphoreTake(is_on_mutex, 0) != pdTRUE) {
+    fast_path_misses++;
+    return false;
+  }
+
+  // The press is the latest command, so any held command is dropped
+  IndySwitchChannel& switch_channel = channels[channel];
+  if (switch_channel.pending) {
+    switch_channel.pending = false;
+    switch_channel.coalesced++;
+  }
+  Actuate(&switch_channel, !switch_channel.is_on, IndySwitchSource::BUTTON, start_time, true);
+  press_latency.Add(switch_channel.last_change_time - press_time);
+
+  // Release mutex
+  if (xSemaphoreGive(is_on_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release is on mutex");
+  return true;
+}
+
+// Finishes a change made by ToggleSwitchFast to `channel`: writes the state
+// to the journal, shows it on the status LED, logs it, and ends any override,
+// as SetSwitch does. Called on the button task.
+void IndySwitch::FinishFastToggle(int channel) {
+  channels[channel].scheduler.ClearOverride();
+
   if (xSemaphoreTake(is_on_mutex, MAX_WAIT) != pdTRUE) {
     ESP_LOGE(TAG, "Failed to acquire is on mutex");
     return;
   }
+  IndySwitchChannel& switch_channel = channels[channel];
+  if (switch_channel.unfinished) {
+    switch_channel.unfinished = false;
+    FinishActuate(switch_channel);
+    ESP_LOGI(TAG, "Button turned switch %d %s", channel, SwitchStateAsStr(switch_channel.is_on));
+  }
+  if (xSemaphoreGive(is_on_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release is on mutex");
+}
+
+// Sets switch `channel` on and off straight away, for a button press or a
+// peer switch the channel follows. The change is the latest command, so any
+// held command is dropped, and any override ends, so the end of the override
+// doesn't undo the change. `source` is where the change came from, for the
+// history. Returns when the relay changed, in microseconds since boot, or 0 if
+// it didn't.
+int64_t IndySwitch::SetSwitch(int channel, bool on, IndySwitchSource source) {
+  int64_t start_time = esp_timer_get_time();
+  channels[channel].scheduler.ClearOverride();
+
+  // Acquire the mutex needed to change is on state
+  if (xSemaphoreTake(is_on_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire is on mutex");
+    return 0;
+  }
 
-  // Is this a change?
-  const char* on_str = SwitchStateAsStr(on);
-  if (is_on == on) {
-    // No change is needed
-    ESP_LOGI(TAG, "Switch is %s", on_str);
+  IndySwitchChannel& switch_channel = channels[channel];
+  if (switch_channel.pending) {
+    switch_channel.pending = false;
+    switch_channel.coalesced++;
+  }
+  int64_t change_time = 0;
+  if (Actuate(&switch_channel, on, source, start_time))
+    change_time = switch_channel.last_change_time;
 
-    // Release mutex
-    if (xSemaphoreGive(is_on_mutex) != pdTRUE)
-      ESP_LOGE(TAG, "Failed to release is on mutex");
+  // Release mutex
+  if (xSemaphoreGive(is_on_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release is on mutex");
+  return change_time;
+}
 
+// Sets switch `channel` on and off for a command from MQTT or the schedule.
+// The first command after a quiet spell takes effect straight away. Commands
+// that follow within SWITCH_COALESCE_MS are held for the actuator task, and
+// only the last of them takes effect, once the window ends and the relay has
+// been on or off for SWITCH_MIN_DWELL_MS. So a flood of commands changes the relay
+// and journal a few times at most, and leaves the switch as the last command
+// asked. `source` is where the command came from, for the history.
+void IndySwitch::RequestSwitch(int channel, bool on, IndySwitchSource source) {
+  int64_t now = esp_timer_get_time();
+
+  // Acquire the mutex needed to change is on state
+  if (xSemaphoreTake(is_on_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire is on mutex");
     return;
   }
 
-  // Update peripherals
-  if (on) {
-    led.TurnOn();
-    relay.TurnOn();
+  // Take the command now if nothing's held and the relay can change, or else
+  // hold it for the actuator task. If the actuator timer can't start, the held
+  // command takes effect now.
+  IndySwitchChannel& switch_channel = channels[channel];
+  switch_channel.commands++;
+  if (!switch_channel.actuator_running && now >= GetActuateTime(switch_channel)) {
+    switch_channel.window_end_time = now + (int64_t) SWITCH_COALESCE_MS * 1000;
+    Actuate(&switch_channel, on, source, now);
   } else {
-    led.TurnOff();
-    relay.TurnOff();
+    if (switch_channel.pending)
+      switch_channel.coalesced++;
+    switch_channel.pending = true;
+    switch_channel.pending_on = on;
+    switch_channel.pending_source = source;
+    switch_channel.deferred++;
+    if (!switch_channel.actuator_running) {
+      switch_channel.actuator_running = StartActuatorTimer(switch_channel, now);
+      if (!switch_channel.actuator_running) {
+        ESP_LOGE(TAG, "Start actuator timer failed for switch %d", channel);
+        switch_channel.pending = false;
+        Actuate(&switch_channel, on, source, now);
+      }
+    }
   }
-  ESP_LOGI(TAG, "Turned switch %s", on_str);
-
-  // Store new state
-  is_on = on;
-  nvs.WriteBool(NVS_KEY_IS_ON, on);
-  nvs.Commit();
 
   // Release mutex
   if (xSemaphoreGive(is_on_mutex) != pdTRUE)
     ESP_LOGE(TAG, "Failed to release is on mutex");
 }
 
+// Starts the actuator timer of `channel`, to expire when its held command can
+// take effect. Returns `false` if the timer couldn't start. Caller must hold
+// the is on mutex.
+bool IndySwitch::StartActuatorTimer(const IndySwitchChannel& channel, int64_t now) {
+  int64_t wait_us = GetActuateTime(channel) - now;
+  TickType_t ticks = wait_us > 0 ? pdMS_TO_TICKS(wait_us / 1000) + 1 : 1;
+  return xTimerChangePeriod(channel.actuator_timer, ticks, 0) == pdPASS;
+}
+
+// Wakes the actuator task when a held command is due. A task is used so the
+// timer service task doesn't block.
+void IndySwitch::ActuatorTimerCallback(TimerHandle_t timer) {
+  reinterpret_cast<IndySwitch*>(pvTimerGetTimerID(timer))->actuator_task.TaskNotifyGive();
+}
+
+void IndySwitch::ActuatorTaskFunction(void *arg) {
+  reinterpret_cast<IndySwitch*>(arg)->RunActuator();
+}
+
+// Applies the command held for each channel once the coalescing window has
+// ended and the relay has dwelt long enough, and restarts the timer of any
+// channel that has longer to wait. A channel whose command a button press
+// dropped is left as is. Runs on the actuator task, on the control core.
+void IndySwitch::RunActuator() {
+  if (xSemaphoreTake(is_on_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire is on mutex");
+    actuator_task.TaskNotifyGive();  // Try again
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  for (IndySwitchChannel& switch_channel : channels) {
+    if (!switch_channel.actuator_running)
+      continue;
+    if (switch_channel.pending && now < GetActuateTime(switch_channel)) {
+      if (StartActuatorTimer(switch_channel, now))
+        continue;
+      ESP_LOGE(TAG, "Restart actuator timer failed for switch %d", switch_channel.index);
+    }
+    switch_channel.actuator_running = false;
+    if (switch_channel.pending) {
+      switch_channel.pending = false;
+      switch_channel.window_end_time = now + (int64_t) SWITCH_COALESCE_MS * 1000;
+      Actuate(&switch_channel, switch_channel.pending_on, switch_channel.pending_source, now);
+    }
+  }
+  if (xSemaphoreGive(is_on_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release is on mutex");
+}
+
+// Saves the history and usage to NVS every RECORDS_SAVE_MS, if they've
+// changed, so flash is written at most once per period rather than on every
+// change. Daylight saving changes are picked up at the same time.
+IndyCoroutine IndySwitch::SaveRecords() {
+  while (true) {
+    co_await IndyDelay(pdMS_TO_TICKS(RECORDS_SAVE_MS));
+    usage.UpdateUtcOffset();
+    history.Save(&nvs);
+    usage.Save(&nvs);
+  }
+}
+
+// Returns when a command can next change the relay of `channel`, in
+// microseconds since boot. Caller must hold the is on mutex.
+int64_t IndySwitch::GetActuateTime(const IndySwitchChannel& channel) const {
+  int64_t dwell_end_time = channel.last_change_time + (int64_t) SWITCH_MIN_DWELL_MS * 1000;
+  return channel.window_end_time > dwell_end_time ? channel.window_end_time : dwell_end_time;
+}
+
+// Turns the relay and LED of `channel` on or off, if they aren't already, and
+// saves the new state and adds it to the history and usage. `source` is where
+// the change came from, and `start_time` is when it was asked for. When `fast`
+// is set nothing here blocks, and the journal write, status LED and log are
+// left for FinishActuate, with the channel marked unfinished. Returns whether
+// the switch changed. Caller must hold the is on mutex.
+bool IndySwitch::Actuate(IndySwitchChannel* channel, bool on, IndySwitchSource source, int64_t start_time,
+    bool fast) {
+  // Is this a change?
+  if (channel->is_on == on) {
+    // No change is needed
+    if (!fast)
+      ESP_LOGI(TAG, "Switch %d is %s", channel->index, SwitchStateAsStr(on));
+    channel->unchanged++;
+    return false;
+  }
+
+  // Update the relay first, since that's what the user is waiting for
+  WriteOutputs(*channel, on);
+  channel->is_on = on;
+  channel->last_change_time = esp_timer_get_time();
+  channel->actuations++;
+  actuation_latency.Add(channel->last_change_time - start_time);
+  history.Add(channel->index, on, source);
+  usage.Record(channel->index, on);
+  peer.Send(channel->index, on);
+
+  if (fast) {
+    channel->unfinished = true;
+  } else {
+    channel->unfinished = false;
+    FinishActuate(*channel);
+    ESP_LOGI(TAG, "Turned switch %d %s", channel->index, SwitchStateAsStr(on));
+  }
+  return true;
+}
+
+// Saves the state of `channel` to the journal, which writes it to flash in the
+// background, and shows it on the status LED. Can block. Caller must hold the
+// is on mutex.
+void IndySwitch::FinishActuate(const IndySwitchChannel& channel) {
+  journal.WriteIsOn(channel.index, channel.is_on);
+  if (channel.index == 0)
+    status_led.SetSwitchOn(channel.is_on);
+}
+
 // Subscribes to MQTT topics
 void IndySwitch::HandleMqttConnected() {
   // Subscribe to control topic
   mqtt.SubscribeToTopic(
     control_topic.c_str(),
     [this](const cJSON* content, JsonParser* parser) -> MqttResponse {
-      return HandleControlMessage(content, parser); });
+      return HandleControlMessage(0, content, parser); });
+
+  // Subscribe to each channel's control and status topics
+  for (IndySwitchChannel& channel : channels) {
+    int index = channel.index;
+    mqtt.SubscribeToTopic(
+      channel.control_topic.c_str(),
+      [this, index](const cJSON* content, JsonParser* parser) -> MqttResponse {
+        return HandleControlMessage(index, content, parser); });
+    mqtt.SubscribeToTopic(
+      channel.status_topic.c_str(),
+      [this, index](const cJSON* content, JsonParser* parser) -> MqttResponse {
+        return HandleChannelStatusMessage(index, content, parser); });
+  }
+
+  // Subscribe to group control topics
+  SubscribeToGroups();
 
   // Subscribe to config topic
   mqtt.SubscribeToTopic(
@@ -160,25 +538,84 @@ void IndySwitch::HandleMqttConnected() {
     restart_topic.c_str(),
     [this](const cJSON* content, JsonParser* parser) -> MqttResponse {
       return HandleRestartMessage(content, parser); });
+
+  // Subscribe to memory topic
+  mqtt.SubscribeToTopic(
+    memory_topic.c_str(),
+    [this](const cJSON* content, JsonParser* parser) -> MqttResponse {
+      return HandleMemoryMessage(content, parser); });
+
+  // Subscribe to history topic
+  mqtt.SubscribeToTopic(
+    history_topic.c_str(),
+    [this](const cJSON* content, JsonParser* parser) -> MqttResponse {
+      return HandleHistoryMessage(content, parser); });
+
+  // MQTT commands can be handled now
+  status_led.SetMqttConnected(true);
+  IndyBootTimeline& boot = IndyBootTimeline::GetInstance();
+  boot.Record(IndyBootPhase::MQTT_READY);
+  ESP_LOGI(TAG, "MQTT ready %" PRId64 " us after boot. Relay was restored %" PRId64 " us after boot.",
+    boot.GetTime(IndyBootPhase::MQTT_READY), boot.GetTime(IndyBootPhase::RELAY_RESTORED));
 }
 
-// Handles MQTT data received from control topic, to turn switch on and off
-MqttResponse IndySwitch::HandleControlMessage(const cJSON* content, JsonParser* parser) {
+// Handles MQTT data received from a control topic, to turn switch `channel` on
+// and off. With a `duration` in minutes, or an `until` time of day, the switch
+// stays that way until then, and then the schedule takes over again.
+// Otherwise it stays that way until the next scheduled action.
+MqttResponse IndySwitch::HandleControlMessage(int channel, const cJSON* content, JsonParser* parser) {
   parser->SetTag(TAG);
 
   // Log message content
   char *content_str = cJSON_Print(content);
-  ESP_LOGI(TAG, "Received MQTT control data:\n%s", content_str);
-  free(content_str);
+  ESP_LOGI(TAG, "Received MQTT control data for switch %d:\n%s", channel, content_str);
+  cJSON_free(content_str);
 
   // Get switch_on message parameter
   JsonResult<bool> switch_on = parser->GetBool(content, "header", "switch_on");
   if (switch_on.is_error)
     return MqttResponse(MQTT_BAD_REQUEST, switch_on.message);
 
+  // Get the optional duration or until message parameter
+  const char* DURATION = "duration";
+  const char* UNTIL = "until";
+  time_t until = NULL_TIME;
+  for (const std::string& key : parser->LookupKeys(content)) {
+    if (key == DURATION) {
+      JsonResult<int> duration = parser->GetInt(content, "header", DURATION);
+      if (duration.is_error)
+        return MqttResponse(MQTT_BAD_REQUEST, duration.message);
+      if (duration.value <= 0 || duration.value > OVERRIDE_MINUTES_MAX)
+        return MqttResponse(MQTT_BAD_REQUEST,
+          FormatString("Duration needs to be between 1 and %d minutes", OVERRIDE_MINUTES_MAX));
+      if (until != NULL_TIME)
+        return MqttResponse(MQTT_BAD_REQUEST, "Only one of duration and until can be given");
+      until = ::time(nullptr) + duration.value * 60;
+    } else if (key == UNTIL) {
+      JsonResult<std::string> until_str = parser->GetString(content, "header", UNTIL);
+      if (until_str.is_error)
+        return MqttResponse(MQTT_BAD_REQUEST, until_str.message);
+      if (until != NULL_TIME)
+        return MqttResponse(MQTT_BAD_REQUEST, "Only one of duration and until can be given");
+      std::string error = IndyScheduler::ParseTimeOfDay(until_str.value, &until);
+      if (error.size() > 0)
+        return MqttResponse(MQTT_BAD_REQUEST, error);
+    }
+  }
+
+  // Override the schedule until then, or replace any override
+  IndyScheduler& scheduler = channels[channel].scheduler;
+  if (until != NULL_TIME) {
+    std::string error = scheduler.SetOverride(switch_on.value, until);
+    if (error.size() > 0)
+      return MqttResponse(MQTT_BAD_REQUEST, error);
+  } else {
+    scheduler.ClearOverride();
+  }
+
   // Turn switch on/off
-  ESP_LOGI(TAG, "HandleControlMessage is setting switch %s", SwitchStateAsStr(switch_on.value));
-  SetSwitch(switch_on.value);
+  ESP_LOGI(TAG, "HandleControlMessage is setting switch %d %s", channel, SwitchStateAsStr(switch_on.value));
+  RequestSwitch(channel, switch_on.value, IndySwitchSource::MQTT);
 
   return MqttResponse(MQTT_OK);
 }
@@ -190,7 +627,7 @@ MqttResponse IndySwitch::HandleConfigMessage(const cJSON* content, JsonParser* p
   // Log message content
   char *content_str = cJSON_Print(content);
   ESP_LOGI(TAG, "Received MQTT config data:\n%s", content_str);
-  free(content_str);
+  cJSON_free(content_str);
 
   // Find message settings
   const char* SETTINGS = "settings";
@@ -213,7 +650,7 @@ MqttResponse IndySwitch::HandleStatusMessage(const cJSON* message_content, JsonP
   // Log message content
   char *message_content_str = cJSON_Print(message_content);
   ESP_LOGI(TAG, "Received MQTT get status:\n%s", message_content_str);
-  free(message_content_str);
+  cJSON_free(message_content_str);
 
   // Create status JSON
   cJSON *status_json = cJSON_CreateObject();
@@ -221,7 +658,25 @@ MqttResponse IndySwitch::HandleStatusMessage(const cJSON* message_content, JsonP
   cJSON_AddStringToObject(status_json, "firmware",
     FormatString("indy_switch_%d.%d.%d_esp32.bin", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH).c_str());
   cJSON_AddStringToObject(status_json, "date", IndyTime::FormatCurrentTime().c_str());
+  IndyScheduler& scheduler = channels[0].scheduler;
+
+  // Copy the latencies, which are only updated under the is on mutex
+  IndyHistogram actuation_latency_copy;
+  IndyHistogram press_latency_copy;
+  bool is_on = false;
+  if (xSemaphoreTake(is_on_mutex, MAX_WAIT) == pdTRUE) {
+    actuation_latency_copy = actuation_latency;
+    press_latency_copy = press_latency;
+    is_on = channels[0].is_on;
+    if (xSemaphoreGive(is_on_mutex) != pdTRUE)
+      ESP_LOGE(TAG, "Failed to release is on mutex");
+  } else {
+    ESP_LOGE(TAG, "Failed to acquire is on mutex");
+  }
   cJSON_AddBoolToObject(status_json, "is_on", is_on);
+  cJSON_AddItemToObject(status_json, "actuation_latency_us", actuation_latency_copy.CreateJson());
+  cJSON_AddItemToObject(status_json, "press_latency_us", press_latency_copy.CreateJson());
+  cJSON_AddNumberToObject(status_json, "fast_path_misses", fast_path_misses);
   if (scheduler.IsActive()) {
     SunTimes sun_times = scheduler.GetCurrentSunTimes();
     cJSON_AddStringToObject(status_json, "sunrise",
@@ -234,7 +689,68 @@ MqttResponse IndySwitch::HandleStatusMessage(const cJSON* message_content, JsonP
     cJSON_AddStringToObject(status_json, "next_action_time",
       IndyTime::FormatTime(scheduler.GetNextActionTime()).c_str());
   }
-  cJSON_AddItemReferenceToObject(status_json, "suntimes", scheduler.GetSuntimesJson());
+  if (scheduler.HasSunTimeOffsets())
+    cJSON_AddItemToObject(status_json, "suntimes", scheduler.CreateSuntimesJson());
+
+  // Add the state of each channel
+  cJSON *channels_json = cJSON_AddArrayToObject(status_json, "channels");
+  for (IndySwitchChannel& channel : channels)
+    cJSON_AddItemToArray(channels_json, CreateChannelJson(channel));
+
+  // Add the channel controlled by each group
+  cJSON *groups_json = cJSON_AddObjectToObject(status_json, "groups");
+  for (const IndySwitchGroup& group : groups.Get())
+    cJSON_AddNumberToObject(groups_json, group.name.c_str(), group.channel);
+
+  // Add the peer switch each channel follows, and peer datagram stats
+  cJSON *follow_json = cJSON_AddObjectToObject(status_json, "follow");
+  for (const IndySwitchLeader& leader : leaders.Get()) {
+    cJSON_AddStringToObject(follow_json, std::to_string(leader.channel).c_str(),
+      FormatString("%s:%d", leader.host.c_str(), leader.leader_channel).c_str());
+  }
+  cJSON_AddItemToObject(status_json, "peer", peer.CreateJson());
+
+  // Add task stats
+  cJSON_AddItemToObject(status_json, "tasks", IndyTaskManager::GetInstance().CreateJson());
+
+  // Add dispatcher stats
+  if (USE_TASK_DISPATCHER)
+    cJSON_AddItemToObject(status_json, "dispatcher", IndyDispatcher::GetInstance().CreateJson());
+
+  // Add when each boot phase finished
+  cJSON_AddItemToObject(status_json, "boot", IndyBootTimeline::GetInstance().CreateJson());
+
+  // Add button gestures and latency
+  cJSON_AddItemToObject(status_json, "button", channels[0].button.CreateJson());
+
+  // Add status LED pattern
+  cJSON_AddItemToObject(status_json, "status_led", status_led.CreateJson());
+
+  // Add wifi connection timing
+  cJSON_AddItemToObject(status_json, "wifi", wifi.CreateJson());
+
+  // Add coroutine stats
+  cJSON_AddItemToObject(status_json, "coroutines", IndyCoroutineRuntime::GetInstance().CreateJson());
+
+  // Add time taken by the restart command that led to this boot
+  if (last_restart_timing.magic == RESTART_TIMING_MAGIC) {
+    cJSON *restart_json = cJSON_AddObjectToObject(status_json, "last_restart");
+    cJSON_AddNumberToObject(restart_json, "join_us", last_restart_timing.join_us);
+    cJSON_AddNumberToObject(restart_json, "total_us", last_restart_timing.total_us);
+  }
+
+  // Add flash traffic since boot
+  cJSON *storage_json = cJSON_AddObjectToObject(status_json, "storage");
+  IndyNvsStats nvs_stats = nvs.GetStats();
+  cJSON *nvs_json = cJSON_AddObjectToObject(storage_json, "nvs");
+  cJSON_AddNumberToObject(nvs_json, "reads", nvs_stats.reads);
+  cJSON_AddNumberToObject(nvs_json, "writes", nvs_stats.writes);
+  cJSON_AddNumberToObject(nvs_json, "commits", nvs_stats.commits);
+  cJSON_AddNumberToObject(nvs_json, "erases", nvs_stats.erases);
+  IndyJournalStats journal_stats = journal.GetStats();
+  cJSON *journal_json = cJSON_AddObjectToObject(storage_json, "journal");
+  cJSON_AddNumberToObject(journal_json, "writes", journal_stats.writes);
+  cJSON_AddNumberToObject(journal_json, "erases", journal_stats.erases);
 
   // Create status JSON string
   char *status_json_str = cJSON_Print(status_json);
@@ -242,7 +758,7 @@ MqttResponse IndySwitch::HandleStatusMessage(const cJSON* message_content, JsonP
 
   // Clean up
   cJSON_Delete(status_json);
-  free(status_json_str);
+  cJSON_free(status_json_str);
 
   // Create response
   MqttResponse response = MqttResponse(MQTT_OK);
@@ -251,29 +767,222 @@ MqttResponse IndySwitch::HandleStatusMessage(const cJSON* message_content, JsonP
   return response;
 }
 
+// Handles MQTT data received from a channel's status topic, to get the status
+// of switch `channel`
+MqttResponse IndySwitch::HandleChannelStatusMessage(int channel, const cJSON* content, JsonParser* parser) {
+  parser->SetTag(TAG);
+
+  // Log message content
+  char *content_str = cJSON_Print(content);
+  ESP_LOGI(TAG, "Received MQTT get status for switch %d:\n%s", channel, content_str);
+  cJSON_free(content_str);
+
+  // Create status JSON
+  IndySwitchChannel& switch_channel = channels[channel];
+  cJSON *status_json = CreateChannelJson(switch_channel);
+  cJSON_AddStringToObject(status_json, "device", HOSTNAME);
+  cJSON_AddStringToObject(status_json, "date", IndyTime::FormatCurrentTime().c_str());
+  if (switch_channel.config.button != GPIO_NUM_NC)
+    cJSON_AddItemToObject(status_json, "button", switch_channel.button.CreateJson());
+
+  // Create status JSON string
+  char *status_json_str = cJSON_Print(status_json);
+  std::string status(status_json_str);
+
+  // Clean up
+  cJSON_Delete(status_json);
+  cJSON_free(status_json_str);
+
+  // Create response
+  MqttResponse response = MqttResponse(MQTT_OK);
+  response.SetContent(status);
+
+  return response;
+}
+
+// Returns JSON with the state and next scheduled action of `channel`
+cJSON* IndySwitch::CreateChannelJson(IndySwitchChannel& channel) {
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "channel", channel.index);
+  cJSON_AddBoolToObject(json, "is_on", channel.is_on);
+  cJSON_AddItemToObject(json, "usage", usage.CreateJson(channel.index));
+  cJSON *actuator_json = cJSON_AddObjectToObject(json, "actuator");
+  cJSON_AddNumberToObject(actuator_json, "commands", channel.commands);
+  cJSON_AddNumberToObject(actuator_json, "actuations", channel.actuations);
+  cJSON_AddNumberToObject(actuator_json, "deferred", channel.deferred);
+  cJSON_AddNumberToObject(actuator_json, "coalesced", channel.coalesced);
+  cJSON_AddNumberToObject(actuator_json, "unchanged", channel.unchanged);
+  IndyOverride override_state = channel.scheduler.GetOverride();
+  if (override_state.IsSet()) {
+    cJSON *override_json = cJSON_AddObjectToObject(json, "override");
+    cJSON_AddBoolToObject(override_json, "switch_on", override_state.on);
+    cJSON_AddStringToObject(override_json, "until", IndyTime::FormatTime(override_state.until).c_str());
+  }
+  if (channel.scheduler.IsActive()) {
+    cJSON_AddStringToObject(json, "next_action",
+      IndyScheduler::NextActionAsStr(channel.scheduler.GetNextAction()));
+    cJSON_AddStringToObject(json, "next_action_time",
+      IndyTime::FormatTime(channel.scheduler.GetNextActionTime()).c_str());
+  }
+  return json;
+}
+
+// Handles MQTT data received from memory topic, to get heap and stack use
+MqttResponse IndySwitch::HandleMemoryMessage(const cJSON* content, JsonParser* parser) {
+  parser->SetTag(TAG);
+
+  // Log message content
+  char *content_str = cJSON_Print(content);
+  ESP_LOGI(TAG, "Received MQTT get memory:\n%s", content_str);
+  cJSON_free(content_str);
+
+  // Create memory JSON
+  cJSON *memory_json = IndyMemory::GetInstance().CreateJson();
+  cJSON_AddItemToObject(memory_json, "stacks", IndyTaskManager::GetInstance().CreateStacksJson());
+  cJSON_AddItemToObject(memory_json, "rtos", IndyRtos::CreateJson());
+
+  // Create memory JSON string
+  char *memory_json_str = cJSON_Print(memory_json);
+  std::string memory(memory_json_str);
+
+  // Clean up
+  cJSON_Delete(memory_json);
+  cJSON_free(memory_json_str);
+
+  // Create response
+  MqttResponse response = MqttResponse(MQTT_OK);
+  response.SetContent(memory);
+
+  return response;
+}
+
+// Handles MQTT data received from history topic, to get the switch changes
+// from `from` to `to`, in seconds since the epoch. Both are optional. A page
+// of changes is returned at a time, and when there are more, `next` is the
+// `cursor` to ask for the next page with.
+MqttResponse IndySwitch::HandleHistoryMessage(const cJSON* content, JsonParser* parser) {
+  parser->SetTag(TAG);
+
+  // Log message content
+  char *content_str = cJSON_Print(content);
+  ESP_LOGI(TAG, "Received MQTT get history:\n%s", content_str);
+  cJSON_free(content_str);
+
+  // Get the optional from, to and cursor message parameters
+  const char* FROM = "from";
+  const char* TO = "to";
+  const char* CURSOR = "cursor";
+  time_t from = 0;
+  time_t to = std::numeric_limits<time_t>::max();
+  uint32_t cursor = 0;
+  for (const std::string& key : parser->LookupKeys(content)) {
+    if (key != FROM && key != TO && key != CURSOR)
+      continue;
+    JsonResult<int> value = parser->GetInt(content, "header", key.c_str());
+    if (value.is_error)
+      return MqttResponse(MQTT_BAD_REQUEST, value.message);
+    if (value.value < 0)
+      return MqttResponse(MQTT_BAD_REQUEST, FormatString("%s can't be negative", key.c_str()));
+    if (key == FROM)
+      from = value.value;
+    else if (key == TO)
+      to = value.value;
+    else
+      cursor = value.value;
+  }
+
+  // Read a page of events. The page is on the heap, since it's too big for
+  // the MQTT task's stack.
+  std::unique_ptr<IndySwitchEventPage> page = std::make_unique<IndySwitchEventPage>();
+  history.Read(from, to, cursor, page.get());
+
+  // Create history JSON
+  cJSON *history_json = cJSON_CreateObject();
+  cJSON *events_json = cJSON_AddArrayToObject(history_json, "events");
+  for (int ii = 0; ii < page->count; ii++) {
+    const IndySwitchEvent& event = page->events[ii];
+    cJSON *event_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(event_json, "seq", event.seq);
+    if (event.time != NULL_TIME) {
+      cJSON_AddNumberToObject(event_json, "time", event.time);
+      cJSON_AddStringToObject(event_json, "timestamp", IndyTime::FormatTime(event.time).c_str());
+    }
+    cJSON_AddNumberToObject(event_json, "channel", event.channel);
+    cJSON_AddBoolToObject(event_json, "switch_on", event.on);
+    cJSON_AddStringToObject(event_json, "source", IndySwitchHistory::SourceAsStr(event.source));
+    cJSON_AddItemToArray(events_json, event_json);
+  }
+  if (page->next_seq != 0)
+    cJSON_AddNumberToObject(history_json, "next", page->next_seq);
+
+  // Create history JSON string
+  char *history_json_str = cJSON_PrintUnformatted(history_json);
+  std::string history_str(history_json_str);
+
+  // Clean up
+  cJSON_Delete(history_json);
+  cJSON_free(history_json_str);
+
+  // Create response
+  MqttResponse response = MqttResponse(MQTT_OK);
+  response.SetContent(history_str);
+
+  return response;
+}
+
 // Handles MQTT data received from restart topic, to restart device
 MqttResponse IndySwitch::HandleRestartMessage(const cJSON* content, JsonParser* parser) {
+  int64_t start_time = esp_timer_get_time();
   parser->SetTag(TAG);
 
   // Log message content
   char *contentStr = cJSON_Print(content);
   ESP_LOGI(TAG, "Received MQTT restart:\n%s", contentStr);
-  free(contentStr);
+  cJSON_free(contentStr);
 
   // Get message reset parameter
   JsonResult<bool> reset = parser->GetBool(content, "header", "reset");
   if (reset.is_error)
     return MqttResponse(MQTT_BAD_REQUEST, reset.message);
 
-  // End tasks
+  // Restart once the response has been published, so the sender knows the
+  // restart command was received
+  if (!Restart(reset.value, start_time).IsStarted())
+    return MqttResponse(MQTT_SERVER_ERROR, "Unable to start restart");
+  return MqttResponse(MQTT_OK, "Restarting");
+}
+
+// Restarts the device, and erases everything saved first if `reset` is set.
+// `start_time` is when the restart command was received.
+IndyCoroutine IndySwitch::Restart(bool reset, int64_t start_time) {
+  // Wait for the response to the restart command to be published
+  if (!co_await mqtt.WaitForResponsesPublished(pdMS_TO_TICKS(RESTART_PUBLISH_WAIT_MS)))
+    ESP_LOGE(TAG, "Timed out publishing restart response");
+
+  // Write any state changes that are still pending, and end tasks
+  journal.Flush();
+  int64_t join_start_time = esp_timer_get_time();
   IndyTaskManager::GetInstance().Exit();
+  int64_t join_end_time = esp_timer_get_time();
 
-  // Reset
-  if (reset.value)
+  // Reset, or save the history and usage in case power is lost while
+  // restarting
+  if (reset) {
     nvs.Reset();
+    journal.Reset();
+    history.Reset();
+  } else {
+    history.Save(&nvs);
+    usage.Save(&nvs);
+  }
 
   // Restart
-  ESP_LOGI(TAG, "Restarting");
+  int64_t end_time = esp_timer_get_time();
+  restart_timing.join_us = (uint32_t) (join_end_time - join_start_time);
+  restart_timing.total_us = (uint32_t) (end_time - start_time);
+  restart_timing.magic = RESTART_TIMING_MAGIC;
+  ESP_LOGI(TAG, "Restarting %" PRIu32 " us after restart command, %" PRIu32 " us of it waiting for tasks to end",
+    restart_timing.total_us, restart_timing.join_us);
   esp_restart();
 }
 
@@ -285,8 +994,14 @@ void IndySwitch::HandleTimeSynced() {
   std::string time = IndyTime::FormatCurrentTime();
   ESP_LOGI(TAG, "The current time is: %s", time.c_str());
 
-  // Configure scheduler
-  scheduler.Setup(&nvs);
+  // Start adding up on time per local day
+  usage.UpdateUtcOffset();
+
+  // Configure each channel's scheduler
+  status_led.SetTimeSynced(true);
+  for (IndySwitchChannel& channel : channels)
+    channel.scheduler.Setup(&journal, channel.index);
+  status_led.SetScheduleActive(channels[0].scheduler.IsActive());
 }
 
 // Loads initial configuration from flash
@@ -322,29 +1037,38 @@ std::string IndySwitch::ApplySettings(const JsonParser &parser, cJSON *settings,
   const char* TIMEZONE = "timezone";
   const char* RANDOM_OFFSET_RANGE = "offset";
   const char* SUNTIMES = "suntimes";
+  const char* GROUPS = "groups";
+  const char* FOLLOW = "follow";
+  std::string error;
+  bool changed = false;
   for (const std::string& key : keys) {
     if (key == TIMEZONE) {
       // Get timezone setting
       JsonResult<std::string> timezone = parser.GetString(settings, SETTINGS, TIMEZONE);
       if (timezone.is_error) {
-        return timezone.message;
+        error = timezone.message;
+        break;
       }
 
-      // Set timezone
-      SetTimezone(timezone.value);
-
       // Save setting
       if (save) {
-        nvs.WriteString(NVS_KEY_CONFIG_TIMEZONE, timezone.value.c_str());
-        nvs.Commit();
+        error = saved_config.SetTimezone(timezone.value);
+        if (error.size() > 0)
+          break;
+        changed = true;
       }
+
+      // Set timezone
+      SetTimezone(timezone.value);
     } else if (key == RANDOM_OFFSET_RANGE) {
       // Get random offset setting
       JsonResult<int> offset = parser.GetInt(settings, SETTINGS, RANDOM_OFFSET_RANGE);
       if (offset.is_error) {
-        return offset.message;
+        error = offset.message;
+        break;
       } else if (offset.value <= 0) {
-        return "Random offset range needs to be a greater than 0";
+        error = "Random offset range needs to be a greater than 0";
+        break;
       }
 
       // Set offset
@@ -352,34 +1076,65 @@ std::string IndySwitch::ApplySettings(const JsonParser &parser, cJSON *settings,
 
       // Save setting
       if (save) {
-        nvs.WriteInt(NVS_KEY_CONFIG_RANDOM_OFFSET_RANGE, offset.value);
-        nvs.Commit();
+        saved_config.SetOffset(offset.value);
+        changed = true;
       }
     } else if (key == SUNTIMES) {
       // Get suntimes
       JsonResult<cJSON*> suntimes = parser.GetObject(settings, SETTINGS, SUNTIMES);
-      if (suntimes.is_error)
-        return suntimes.message;
-
-      // Save suntimes
-      std::string error = scheduler.SetSuntimes(parser, suntimes.value);
-      if (error.size() > 0) {
-        return error;
+      if (suntimes.is_error) {
+        error = suntimes.message;
+        break;
       }
 
+      // Save suntimes. Every channel follows the same schedule.
+      IndyScheduler& scheduler = channels[0].scheduler;
+      error = scheduler.SetSuntimes(parser, suntimes.value);
+      if (error.size() > 0)
+        break;
+      for (IndySwitchChannel& channel : channels)
+        channel.scheduler.SetSunTimeOffsets(scheduler.GetSunTimeOffsets());
+
       // Save setting
       if (save) {
-        char* json_str = cJSON_Print(suntimes.value);
-        nvs.WriteString(NVS_KEY_CONFIG_SUNTIMES, json_str);
-        nvs.Commit();
-        free(json_str);
+        saved_config.SetSunTimeOffsets(scheduler.GetSunTimeOffsets());
+        changed = true;
+      }
+    } else if (key == GROUPS) {
+      // Get groups
+      JsonResult<cJSON*> groups_json = parser.GetObject(settings, SETTINGS, GROUPS);
+      if (groups_json.is_error) {
+        error = groups_json.message;
+        break;
+      }
+
+      // Set and save groups. They're saved to their own key.
+      error = SetGroups(parser, groups_json.value, save);
+      if (error.size() > 0)
+        break;
+    } else if (key == FOLLOW) {
+      // Get the peer switches to follow
+      JsonResult<cJSON*> follow_json = parser.GetObject(settings, SETTINGS, FOLLOW);
+      if (follow_json.is_error) {
+        error = follow_json.message;
+        break;
       }
+
+      // Set and save them. They're saved to their own key.
+      error = SetLeaders(parser, follow_json.value, save);
+      if (error.size() > 0)
+        break;
     } else {
-      return FormatString("Unrecognized setting %s", key.c_str());
+      error = FormatString("Unrecognized setting %s", key.c_str());
+      break;
     }
   }
 
-  return "";
+  // Save settings that were applied
+  if (changed)
+    saved_config.Save(&nvs);
+
+  return error;
 }
 
 // Sets timezone on the ESP32
@@ -387,41 +1142,211 @@ void IndySwitch::SetTimezone(const std::string& timezone) {
   ESP_LOGI(TAG, "Setting timezone to %s", timezone.c_str());
   setenv("TZ", timezone.c_str(), 1);
   tzset();
+  usage.UpdateUtcOffset();
 }
 
-// Sets random offset range on the scheduler
-void IndySwitch::SetOffset(uint offset) {
-  ESP_LOGI(TAG, "Setting random offset range to %d", offset);
-  scheduler.SetRandomOffsetRange(offset);
+// Sets the groups the switch belongs to from `groups_json`, which maps each
+// group name to the channel it controls. When `save` is set, the groups are
+// saved, and the subscriptions changed. Returns an error message if the
+// groups can't be used.
+std::string IndySwitch::SetGroups(const JsonParser& parser, cJSON* groups_json, bool save) {
+  const char* GROUPS = "groups";
+  std::vector<IndySwitchGroup> new_groups;
+  for (const std::string& name : parser.LookupKeys(groups_json)) {
+    JsonResult<int> channel = parser.GetInt(groups_json, GROUPS, name.c_str());
+    if (channel.is_error)
+      return channel.message;
+    new_groups.push_back({name, channel.value});
+  }
+
+  // Leave the old groups before joining the new ones
+  if (save)
+    UnsubscribeFromGroups();
+  std::string error = groups.Set(new_groups);
+  if (save) {
+    if (error.size() == 0)
+      groups.Save(&nvs);
+    SubscribeToGroups();
+  }
+  return error;
+}
+
+// Sets the peer switch each channel follows from `follow_json`, which maps
+// each local channel to a peer switch given as "host:channel". Channels not
+// given stop following. When `save` is set, the leaders are saved. Returns an
+// error message if they can't be used.
+std::string IndySwitch::SetLeaders(const JsonParser& parser, cJSON* follow_json, bool save) {
+  const char* FOLLOW = "follow";
+  std::vector<IndySwitchLeader> new_leaders;
+  for (const std::string& key : parser.LookupKeys(follow_json)) {
+    JsonResult<std::string> value = parser.GetString(follow_json, FOLLOW, key.c_str());
+    if (value.is_error)
+      return value.message;
+    IndySwitchLeader leader;
+    char* end;
+    leader.channel = (int) strtol(key.c_str(), &end, 10);
+    if (key.empty() || *end != '\0')
+      return FormatString("Follow key '%s' should be a channel", key.c_str());
+    std::string error = IndySwitchLeaders::Parse(value.value, &leader);
+    if (error.size() > 0)
+      return error;
+    new_leaders.push_back(leader);
+  }
+
+  std::string error = leaders.Set(new_leaders);
+  if (save && error.size() == 0)
+    leaders.Save(&nvs);
+  return error;
+}
+
+// Switches the channels that follow the peer switch in `state`. Called on the
+// peer receive task, so the follower changes as soon as the datagram arrives.
+// Like a button press, the change skips coalescing and dwell. Returns when
+// the last relay changed, in microseconds since boot, or 0 if none did.
+int64_t IndySwitch::HandlePeerState(const IndyPeerState& state) {
+  int64_t change_time = 0;
+  for (int channel = 0; channel < INDY_CHANNEL_COUNT; channel++) {
+    if (leaders.IsLeader(channel, state.host, state.channel)) {
+      int64_t channel_change_time = SetSwitch(channel, state.on, IndySwitchSource::PEER);
+      if (channel_change_time > change_time)
+        change_time = channel_change_time;
+    }
+  }
+  return change_time;
 }
 
-// Sets suntimes on the scheduler
-void IndySwitch::SetSuntimes(const JsonParser& parser, cJSON* suntimes) {
-  scheduler.SetSuntimes(parser, suntimes);
+// Subscribes to the control topic of each group. Commands to a group are
+// handled like commands to its channel's control topic, but only acked when
+// they ask, to the group's ack topic.
+void IndySwitch::SubscribeToGroups() {
+  for (const IndySwitchGroup& group : groups.Get()) {
+    int channel = group.channel;
+    mqtt.SubscribeToSharedTopic(
+      IndySwitchGroups::GetControlTopic(group.name).c_str(),
+      IndySwitchGroups::GetAckTopic(group.name).c_str(),
+      [this, channel](const cJSON* content, JsonParser* parser) -> MqttResponse {
+        return HandleControlMessage(channel, content, parser); });
+  }
+}
+
+// Unsubscribes from the control topic of each group
+void IndySwitch::UnsubscribeFromGroups() {
+  for (const IndySwitchGroup& group : groups.Get())
+    mqtt.UnsubscribeFromTopic(IndySwitchGroups::GetControlTopic(group.name).c_str());
+}
+
+// Sets random offset range on the scheduler of every channel
+void IndySwitch::SetOffset(uint offset) {
+  ESP_LOGI(TAG, "Setting random offset range to %d", offset);
+  for (IndySwitchChannel& channel : channels)
+    channel.scheduler.SetRandomOffsetRange(offset);
 }
 
 // Loads and configuration values that were saved to NVS
-void IndySwitch::LoadSavedConfig() {
+void IndySwitch::LoadSavedConfig(const IndySwitchNvsValues& saved) {
   ESP_LOGI(TAG, "Loading saved configuration");
 
-  // Apply saved timezone
-  std::string timezone;
-  if (nvs.ReadString(NVS_KEY_CONFIG_TIMEZONE, &timezone))
-    SetTimezone(timezone);
+  // Load saved groups, which replace any in the initial configuration
+  if (saved.groups_found)
+    groups.Load(saved.groups);
+  if (saved.leaders_found)
+    leaders.Load(saved.leaders);
+
+  // Load saved configuration, moving any saved by earlier firmware versions
+  if (!saved.config_found || !saved_config.Load(saved.config)) {
+    if (!LoadLegacySavedConfig(saved))
+      return;
+    saved_config.Save(&nvs);
+  }
+
+  // Apply saved configuration
+  if (saved_config.HasTimezone())
+    SetTimezone(saved_config.GetTimezone());
+  if (saved_config.HasOffset())
+    SetOffset(saved_config.GetOffset());
+  if (saved_config.HasSunTimeOffsets()) {
+    for (IndySwitchChannel& channel : channels)
+      channel.scheduler.SetSunTimeOffsets(saved_config.GetSunTimeOffsets());
+  }
+}
+
+// Loads configuration values that were saved to NVS as separate keys by
+// earlier firmware versions into saved_config. Returns `false` if none were
+// found.
+bool IndySwitch::LoadLegacySavedConfig(const IndySwitchNvsValues& saved) {
+  bool found = false;
 
-  // Apply saved offset
-  int32_t offset;
-  if (nvs.ReadInt(NVS_KEY_CONFIG_RANDOM_OFFSET_RANGE, &offset))
-    SetOffset((uint32_t) offset);
+  // Load saved timezone
+  if (saved.timezone_found && saved_config.SetTimezone(saved.timezone).size() == 0)
+    found = true;
 
-  // Apply saved suntimes
-  std::string suntimes_json;
-  if (nvs.ReadString(NVS_KEY_CONFIG_SUNTIMES, &suntimes_json)) {
-    JsonParser parser(suntimes_json.c_str(), TAG, "JSON parsing failed for load saved config");
+  // Load saved offset
+  if (saved.offset_found) {
+    saved_config.SetOffset((uint32_t) saved.offset);
+    found = true;
+  }
+
+  // Load saved suntimes
+  if (saved.suntimes_found) {
+    JsonParser parser(saved.suntimes, TAG, "JSON parsing failed for load saved config");
     std::string message = parser.Parse();
-    if (message.length() > 0)
+    if (message.length() > 0) {
       ESP_LOGE(TAG, "Unexpected error parsing saved suntimes: %s", message.c_str());
+    } else {
+      std::array<SunTimeOffsets, 12> offsets;
+      message = IndyScheduler::ParseSuntimes(parser, parser.GetRoot(), &offsets);
+      if (message.length() > 0) {
+        ESP_LOGE(TAG, "Unexpected error in saved suntimes: %s", message.c_str());
+      } else {
+        saved_config.SetSunTimeOffsets(offsets);
+        found = true;
+      }
+    }
+  }
+
+  return found;
+}
+
+// Restores state saved to the journal. State saved to NVS by earlier firmware
+// versions is moved to channel 0 of the journal the first time the journal is
+// used. Every channel is restored with one GPIO write.
+void IndySwitch::RestoreState(const IndySwitchNvsValues& saved) {
+  journal.Setup();
+  if (!journal.HasState()) {
+    ESP_LOGI(TAG, "Moving state saved to NVS to the journal");
+    IndyJournalState state;
+    state.is_on = saved.is_on;
+    state.next_action = saved.next_action;
+    state.next_action_time = saved.next_action_time;
+    journal.WriteState(0, state);
+  }
+
+  ESP_LOGI(TAG, "Restoring is on state");
+  if (xSemaphoreTake(is_on_mutex, MAX_WAIT) != pdTRUE) {
+    ESP_LOGE(TAG, "Failed to acquire is on mutex");
+    return;
+  }
+  uint32_t high = 0;
+  uint32_t low = 0;
+  for (IndySwitchChannel& channel : channels) {
+    channel.is_on = journal.GetState(channel.index).is_on;
+    uint32_t bits = channel.relay_bit | channel.led_bit;
+    if (channel.is_on)
+      high |= bits;
     else
-      SetSuntimes(parser, parser.GetRoot());
+      low |= bits;
   }
+  outputs.Write(high, low);
+  status_led.SetSwitchOn(channels[0].is_on);
+
+  // Relays start off, so only channels restored on are a change. Usage
+  // doesn't count them as cycles.
+  for (IndySwitchChannel& channel : channels) {
+    if (channel.is_on) {
+      history.Add(channel.index, true, IndySwitchSource::RESTORE);
+      usage.Restore(channel.index, true);
+    }
+  }
+  if (xSemaphoreGive(is_on_mutex) != pdTRUE)
+    ESP_LOGE(TAG, "Failed to release is on mutex");
 }
@@ -2,50 +2,105 @@
 #define COMPONENTS_INDY_SWITCH_INDY_SWITCH_H_
 
 #include <cJSON.h>
-#include <driver/gpio.h>
 
+#include <array>
+#include <cstdint>
 #include <string>
+#include <utility>
 
 #include "indy_button.h"
 #include "indy_config.h"
+#include "indy_coroutine.h"
+#include "indy_histogram.h"
+#include "indy_journal.h"
 #include "indy_json.h"
 #include "indy_mdns.h"
 #include "indy_mqtt.h"
 #include "indy_nvs.h"
-#include "indy_output_pin.h"
+#include "indy_output_group.h"
+#include "indy_peer.h"
+#include "indy_saved_config.h"
 #include "indy_scheduler.h"
+#include "indy_status_led.h"
+#include "indy_switch_channel.h"
+#include "indy_switch_groups.h"
+#include "indy_switch_history.h"
+#include "indy_switch_leaders.h"
+#include "indy_switch_usage.h"
+#include "indy_switch_nvs.h"
 #include "indy_time.h"
 #include "indy_wifi.h"
 
 // The top-level class for managing an IndySwitch
 class IndySwitch {
  public:
-  IndySwitch() : led(LED_GPIO), relay(RELAY_GPIO) {}
-
   void Setup();
 
-  void SetSwitch(bool on);
-  void ToggleSwitch();
+  int64_t SetSwitch(int channel, bool on, IndySwitchSource source = IndySwitchSource::BUTTON);
+  void RequestSwitch(int channel, bool on, IndySwitchSource source);
+  void ToggleSwitch(int channel);
+  bool ToggleSwitchFast(int channel, int64_t press_time);
 
  private:
   // ESP32
   IndyWifi wifi;
   IndyNvs nvs;
+  IndyJournal journal;
   IndyMdns mdns;
   IndyMqtt mqtt;
   IndyTime time;
+  IndyPeer peer;
+
+  // Channels, each with its own relay, LED, button and scheduler. They're
+  // members rather than allocated, so their RAM is fixed at build time.
+  template <size_t... INDEXES>
+  static std::array<IndySwitchChannel, INDY_CHANNEL_COUNT> CreateChannels(std::index_sequence<INDEXES...>) {
+    return { IndySwitchChannel(INDEXES)... };
+  }
+  std::array<IndySwitchChannel, INDY_CHANNEL_COUNT> channels =
+    CreateChannels(std::make_index_sequence<INDY_CHANNEL_COUNT>());
+
+  // Relays and LEDs of every channel, so a change to several channels is one
+  // GPIO write. Channel 0's LED is the status LED instead.
+  IndyOutputGroup outputs;
+
+  // Status LED, which shows the state of the device, and of channel 0 once
+  // the device is connected
+  IndyStatusLed status_led{CHANNEL_CONFIGS[0].led};
+
+  void WriteOutputs(const IndySwitchChannel& channel, bool on);
+  bool Actuate(IndySwitchChannel* channel, bool on, IndySwitchSource source, int64_t start_time, bool fast = false);
+  void FinishActuate(const IndySwitchChannel& channel);
+  void FinishFastToggle(int channel);
+  int64_t GetActuateTime(const IndySwitchChannel& channel) const;
+
+  // Actuator task, which applies held commands when their channel's actuator
+  // timer expires
+  IndyTask actuator_task = IndyTask("ActuatorTask", ACTUATOR_TASK_CONFIG);
+  static void ActuatorTaskFunction(void *arg);
+  static void ActuatorTimerCallback(TimerHandle_t timer);
+  void RunActuator();
+  bool StartActuatorTimer(const IndySwitchChannel& channel, int64_t now);
+
+  // Mutex guarding the "is on" state of every channel, and the latency
+  // histograms below
+  SemaphoreHandle_t is_on_mutex;
+  StaticSemaphore_t is_on_mutex_buffer;
 
-  // Peripherals
-  IndyButton button;
-  IndyDigitalOutputPin led;
-  IndyDigitalOutputPin relay;
+  // Time taken by Actuate to change the switch, in microseconds
+  IndyHistogram actuation_latency;
 
-  // Scheduler
-  IndyScheduler scheduler;
+  // Time from the start of a button press to the relay changing on the fast
+  // path, in microseconds, and presses that missed the fast path
+  IndyHistogram press_latency;
+  uint32_t fast_path_misses = 0;
 
-  // "Is on" state
-  bool is_on = false;
-  SemaphoreHandle_t is_on_mutex;
+  // History of switch changes, kept in RTC memory and saved to NVS from time
+  // to time
+  IndySwitchHistory history;
+
+  // On time and cycles of each channel per day
+  IndySwitchUsage usage;
 
   // MQTT topics
   std::string control_topic;
@@ -53,28 +108,61 @@ class IndySwitch {
   std::string status_topic;
   std::string restart_topic;
   std::string reset_topic;
+  std::string memory_topic;
+  std::string history_topic;
 
   // Configure
   void SetTimezone(const std::string& timezone);
   void SetOffset(uint offset);
-  void SetSuntimes(const JsonParser& parser, cJSON* suntimes);
 
   // Configure with JSON
   void LoadInitialConfig();
   std::string ApplySettings(const JsonParser& parser, cJSON* settings, bool save);
 
   // Configure with values saved to NVS
-  void LoadSavedConfig();
+  IndySavedConfig saved_config;
+  void LoadSavedConfig(const IndySwitchNvsValues& saved);
+  bool LoadLegacySavedConfig(const IndySwitchNvsValues& saved);
+
+  // Groups the switch belongs to, saved to NVS. Only used on the MQTT task,
+  // and before MQTT starts.
+  IndySwitchGroups groups;
+  std::string SetGroups(const JsonParser& parser, cJSON* groups_json, bool save);
+  void SubscribeToGroups();
+  void UnsubscribeFromGroups();
+
+  // Peer switches that channels follow, saved to NVS
+  IndySwitchLeaders leaders;
+  std::string SetLeaders(const JsonParser& parser, cJSON* follow_json, bool save);
+  int64_t HandlePeerState(const IndyPeerState& state);
+
+  // Restore state saved to the journal
+  void RestoreState(const IndySwitchNvsValues& saved);
+
+  // Status
+  cJSON* CreateChannelJson(IndySwitchChannel& channel);  // Caller owns returned memory
 
   // MQTT event handlers
   void HandleMqttConnected();
-  MqttResponse HandleControlMessage(const cJSON* content, JsonParser* parser);
+  MqttResponse HandleControlMessage(int channel, const cJSON* content, JsonParser* parser);
   MqttResponse HandleConfigMessage(const cJSON* content, JsonParser* parser);
   MqttResponse HandleStatusMessage(const cJSON* content, JsonParser* parser);
+  MqttResponse HandleChannelStatusMessage(int channel, const cJSON* content, JsonParser* parser);
   MqttResponse HandleRestartMessage(const cJSON* content, JsonParser* parser);
+  MqttResponse HandleMemoryMessage(const cJSON* content, JsonParser* parser);
+  MqttResponse HandleHistoryMessage(const cJSON* content, JsonParser* parser);
 
   // Other event handlers
   void HandleTimeSynced();
+
+  // Boot events, which let network setup wait for configuration
+  static const EventBits_t CONFIG_LOADED_BIT = BIT0;
+  IndyAwaitableEvents boot_events;
+
+  // Coroutines
+  IndyCoroutine SetupNetwork();
+  IndyCoroutine Restart(bool reset, int64_t start_time);
+  IndyCoroutine SaveRecords();
 };
 
 #endif  // COMPONENTS_INDY_SWITCH_INDY_SWITCH_H_
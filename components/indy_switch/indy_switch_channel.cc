@@ -0,0 +1,22 @@
+#include "indy_switch_channel.h"
+
+#include <string>
+
+#include "indy_config.h"
+#include "indy_util.h"
+
+namespace {
+  // Returns the name of task `name` for channel `index`. Channel 0 keeps the
+  // name its task had before there were channels.
+  std::string ChannelTaskName(const char* name, int index) {
+    return index == 0 ? std::string(name) : FormatString("%s%d", name, index);
+  }
+}
+
+// Creates channel `index`, with the pins in CHANNEL_CONFIGS
+IndySwitchChannel::IndySwitchChannel(int index) :
+    index(index),
+    config(CHANNEL_CONFIGS[index]),
+    button(CHANNEL_CONFIGS[index].button, ChannelTaskName("ButtonTask", index)),
+    scheduler(ChannelTaskName("SchedulerTask", index)) {
+}
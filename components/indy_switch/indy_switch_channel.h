@@ -0,0 +1,67 @@
+#ifndef COMPONENTS_INDY_SWITCH_INDY_SWITCH_CHANNEL_H_
+#define COMPONENTS_INDY_SWITCH_INDY_SWITCH_CHANNEL_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+
+#include <cstdint>
+#include <string>
+
+#include "indy_button.h"
+#include "indy_config.h"
+#include "indy_scheduler.h"
+#include "indy_switch_history.h"
+
+// One channel of an IndySwitch: a relay, an LED that shows the relay's state,
+// a button that toggles it, and a schedule. Channels are numbered from 0, and
+// are set up and changed by IndySwitch.
+struct IndySwitchChannel {
+  explicit IndySwitchChannel(int index);
+
+  const int index;
+  const IndyChannelConfig& config;
+
+  IndyButton button;
+  IndyScheduler scheduler;
+
+  // The channel's relay and LED bits in the IndySwitch output group. Channel
+  // 0's LED is the status LED, so it has no LED bit.
+  uint32_t relay_bit = 0;
+  uint32_t led_bit = 0;
+
+  // "Is on" state, guarded by the IndySwitch is on mutex
+  bool is_on = false;
+  bool unfinished = false;  // Whether a fast change still needs its journal write and status LED update
+
+  // Actuator state, guarded by the IndySwitch is on mutex. A command that
+  // can't take effect yet is held until the coalescing window ends and the
+  // relay has dwelt long enough, and a later command replaces it.
+  bool pending = false;             // Whether a command is held
+  bool pending_on = false;          // The held command
+  IndySwitchSource pending_source = IndySwitchSource::MQTT;  // Where the held command came from
+  bool actuator_running = false;    // Whether the actuator timer is running
+  int64_t window_end_time = 0;      // When the coalescing window ends, in microseconds since boot
+  int64_t last_change_time = 0;     // When the relay last changed, in microseconds since boot
+
+  // Timer that wakes the actuator task when the held command is due
+  TimerHandle_t actuator_timer = nullptr;
+  StaticTimer_t actuator_timer_buffer;
+
+  // Actuator stats
+  uint32_t commands = 0;    // Commands from MQTT and the schedule
+  uint32_t actuations = 0;  // Times the relay changed
+  uint32_t deferred = 0;    // Commands held for the coalescing window or dwell time
+  uint32_t coalesced = 0;   // Held commands replaced by a later command
+  uint32_t unchanged = 0;   // Commands for the state the relay was already in
+
+  // MQTT topics for this channel
+  std::string control_topic;
+  std::string status_topic;
+
+  // Prevent copy and assignment since the button and scheduler tasks are
+  // registered by address.
+  IndySwitchChannel(const IndySwitchChannel&) = delete;
+  IndySwitchChannel& operator=(const IndySwitchChannel&) = delete;
+};
+
+#endif  // COMPONENTS_INDY_SWITCH_INDY_SWITCH_CHANNEL_H_
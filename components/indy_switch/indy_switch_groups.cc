@@ -0,0 +1,111 @@
+#include "indy_switch_groups.h"
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "indy_config.h"
+#include "indy_switch_nvs.h"
+#include "indy_util.h"
+
+namespace {
+  const char *TAG = "indy_switch_groups";
+
+  // Returns whether `name` can be used in a topic. Names are limited to
+  // letters, digits, '-' and '_', so they can't hold MQTT wildcards or levels.
+  bool IsValidName(const std::string& name) {
+    if (name.empty())
+      return false;
+    for (char c : name) {
+      if (!isalnum((unsigned char) c) && c != '-' && c != '_')
+        return false;
+    }
+    return true;
+  }
+}
+
+// Creates an IndySwitchGroups with no groups
+IndySwitchGroups::IndySwitchGroups() {
+  memset(&data, 0, sizeof(data));
+  data.version = VERSION;
+}
+
+// Loads the groups from `loaded`, which was read from NVS. Returns `false` if
+// they're not valid.
+bool IndySwitchGroups::Load(const Data& loaded) {
+  if (loaded.version != VERSION) {
+    ESP_LOGE(TAG, "Saved groups are version %d but expected %d", loaded.version, VERSION);
+    return false;
+  }
+  if (loaded.crc != ComputeCrc(loaded) || loaded.count > GROUPS_MAX) {
+    ESP_LOGE(TAG, "Saved groups are not valid");
+    return false;
+  }
+  data = loaded;
+  for (Data::Entry& entry : data.entries)
+    entry.name[NAME_SIZE - 1] = '\0';
+  return true;
+}
+
+// Saves the groups to `nvs`
+void IndySwitchGroups::Save(IndyNvs* nvs) {
+  data.crc = ComputeCrc(data);
+  nvs->WriteBlob(NVS_KEY_GROUPS, &data, sizeof(data));
+  nvs->Commit();
+}
+
+// Returns the groups
+std::vector<IndySwitchGroup> IndySwitchGroups::Get() const {
+  std::vector<IndySwitchGroup> groups;
+  for (size_t ii = 0; ii < data.count; ii++)
+    groups.push_back({std::string(data.entries[ii].name), data.entries[ii].channel});
+  return groups;
+}
+
+// Replaces the groups with `groups`. Returns an error message, and leaves the
+// groups unchanged, if any of them can't be used.
+std::string IndySwitchGroups::Set(const std::vector<IndySwitchGroup>& groups) {
+  if (groups.size() > GROUPS_MAX)
+    return FormatString("A switch can be in at most %d groups", GROUPS_MAX);
+  for (size_t ii = 0; ii < groups.size(); ii++) {
+    const IndySwitchGroup& group = groups[ii];
+    if (!IsValidName(group.name))
+      return FormatString("Group name '%s' can only have letters, digits, '-' and '_'", group.name.c_str());
+    if (group.name.length() >= NAME_SIZE)
+      return FormatString("Group name '%s' is longer than %d characters", group.name.c_str(), NAME_SIZE - 1);
+    if (group.channel < 0 || group.channel >= INDY_CHANNEL_COUNT)
+      return FormatString("Group '%s' has channel %d, but channels are 0 to %d", group.name.c_str(),
+        group.channel, INDY_CHANNEL_COUNT - 1);
+    for (size_t jj = 0; jj < ii; jj++) {
+      if (groups[jj].name == group.name)
+        return FormatString("Group '%s' is given more than once", group.name.c_str());
+    }
+  }
+
+  memset(data.entries, 0, sizeof(data.entries));
+  for (size_t ii = 0; ii < groups.size(); ii++) {
+    memcpy(data.entries[ii].name, groups[ii].name.c_str(), groups[ii].name.length());
+    data.entries[ii].channel = (uint8_t) groups[ii].channel;
+  }
+  data.count = (uint8_t) groups.size();
+  return "";
+}
+
+// Returns the control topic shared by the members of group `name`
+std::string IndySwitchGroups::GetControlTopic(const std::string& name) {
+  return FormatString("indy-switch/group/%s/control", name.c_str());
+}
+
+// Returns the topic members of group `name` publish acks to, when asked
+std::string IndySwitchGroups::GetAckTopic(const std::string& name) {
+  return FormatString("indy-switch/group/%s/ack", name.c_str());
+}
+
+// Returns the CRC of `data`, computed over every field but the CRC itself
+uint32_t IndySwitchGroups::ComputeCrc(const Data& data) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&data), offsetof(Data, crc));
+}
@@ -0,0 +1,57 @@
+#ifndef COMPONENTS_INDY_SWITCH_INDY_SWITCH_GROUPS_H_
+#define COMPONENTS_INDY_SWITCH_INDY_SWITCH_GROUPS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "indy_nvs.h"
+
+// A group the switch belongs to. Commands to the group control `channel`.
+struct IndySwitchGroup {
+  std::string name;
+  int channel;
+};
+
+// Holds the groups the switch belongs to, which are saved to NVS. Each group
+// has a control topic shared by its members, so a command to the group is one
+// message to the broker, which fans it out.
+class IndySwitchGroups {
+ public:
+  static const size_t GROUPS_MAX = 8;
+  static const size_t NAME_SIZE = 32;
+
+  // The groups as stored in NVS
+  struct Data {
+    uint8_t version;
+    uint8_t count;
+    uint16_t reserved;
+    struct Entry {
+      char name[NAME_SIZE];         // Null terminated
+      uint8_t channel;
+      uint8_t reserved[3];
+    } entries[GROUPS_MAX];
+    uint32_t crc;                   // CRC32 of the fields above
+  };
+  static_assert(sizeof(Data) == 296, "Saved groups should be 296 bytes");
+
+  IndySwitchGroups();
+
+  bool Load(const Data& loaded);
+  void Save(IndyNvs* nvs);
+
+  std::vector<IndySwitchGroup> Get() const;
+  std::string Set(const std::vector<IndySwitchGroup>& groups);
+
+  static std::string GetControlTopic(const std::string& name);
+  static std::string GetAckTopic(const std::string& name);
+
+ private:
+  static const uint8_t VERSION = 1;
+
+  Data data;
+
+  static uint32_t ComputeCrc(const Data& data);
+};
+
+#endif  // COMPONENTS_INDY_SWITCH_INDY_SWITCH_GROUPS_H_
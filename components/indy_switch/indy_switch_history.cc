@@ -0,0 +1,193 @@
+#include "indy_switch_history.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include <memory>
+
+#include "indy_config.h"
+#include "indy_switch_nvs.h"
+#include "indy_util.h"
+
+namespace {
+  const char *TAG = "indy_switch_history";
+
+  const uint32_t HISTORY_MAGIC = 0x48495354;
+
+  // How an event is packed into 32 bits
+  const uint32_t DELTA_MASK = 0xFFFFF;     // Bits 0-19: seconds since the event before
+  const int SOURCE_SHIFT = 20;             // Bits 20-22: source
+  const uint32_t SOURCE_MASK = 0x7;
+  const uint32_t UNSYNCED_BIT = 1U << 23;  // Time hadn't synced
+  const uint32_t ON_BIT = 1U << 24;
+  const int CHANNEL_SHIFT = 25;            // Bits 25-31: channel
+  static_assert(static_cast<uint32_t>(IndySwitchSource::COUNT) <= SOURCE_MASK + 1,
+    "History events have 3 bits for the source");
+
+  // The history, in RTC memory that isn't cleared by a restart
+  RTC_NOINIT_ATTR IndySwitchHistory::Data rtc_history;
+
+  // Returns whether `data` holds a history
+  bool IsValid(const IndySwitchHistory::Data& data) {
+    return data.magic == HISTORY_MAGIC && data.head < data.events.size() && data.count <= data.events.size();
+  }
+}
+
+// Sets up the history. The history in RTC memory is kept if it survived a
+// restart, since it's never older than the one saved to NVS. Otherwise the
+// history `saved` to NVS is used, if there is one.
+void IndySwitchHistory::Setup(const Data* saved) {
+  if (IsValid(rtc_history)) {
+    ESP_LOGI(TAG, "Kept %" PRIu32 " events in RTC memory", rtc_history.count);
+  } else if (saved != nullptr && IsValid(*saved)) {
+    rtc_history = *saved;
+    ESP_LOGI(TAG, "Loaded %" PRIu32 " events saved to NVS", rtc_history.count);
+  } else {
+    rtc_history = Data();
+    rtc_history.magic = HISTORY_MAGIC;
+    rtc_history.first_seq = 1;
+    ESP_LOGI(TAG, "Starting a new history");
+  }
+}
+
+// Records that `channel` was turned `on` or off by `source`
+void IndySwitchHistory::Add(int channel, bool on, IndySwitchSource source) {
+  time_t now = time(nullptr);
+  bool time_synced = now >= TIME_SYNCED_MIN;
+  portENTER_CRITICAL(&spinlock);
+
+  // Work out the seconds since the event before. Events from before time
+  // synced, or from when the clock went back, are given the time of the
+  // event before.
+  uint32_t delta = 0;
+  if (time_synced) {
+    if (rtc_history.last_time == 0) {
+      rtc_history.first_time = now;
+      rtc_history.last_time = now;
+    } else if (now > rtc_history.last_time) {
+      int64_t elapsed = now - rtc_history.last_time;
+      while (elapsed > DELTA_MASK) {
+        Append(DELTA_MASK, 0, false, IndySwitchSource::GAP, true);
+        elapsed -= DELTA_MASK;
+      }
+      delta = (uint32_t) elapsed;
+      rtc_history.last_time = now;
+    }
+  }
+  Append(delta, channel, on, source, time_synced);
+  unsaved = true;
+
+  portEXIT_CRITICAL(&spinlock);
+}
+
+// Appends an event, dropping the oldest if the history is full. Caller must
+// hold the spinlock.
+void IndySwitchHistory::Append(uint32_t delta, int channel, bool on, IndySwitchSource source, bool time_synced) {
+  uint32_t event = (delta & DELTA_MASK) |
+    (static_cast<uint32_t>(source) << SOURCE_SHIFT) |
+    (time_synced ? 0 : UNSYNCED_BIT) |
+    (on ? ON_BIT : 0) |
+    (static_cast<uint32_t>(channel) << CHANNEL_SHIFT);
+
+  // Drop the oldest event when full. The next oldest becomes the first, at its time.
+  size_t size = rtc_history.events.size();
+  if (rtc_history.count == size) {
+    rtc_history.head = (rtc_history.head + 1) % size;
+    rtc_history.count--;
+    rtc_history.first_seq++;
+    if (rtc_history.first_time != 0)
+      rtc_history.first_time += rtc_history.events[rtc_history.head] & DELTA_MASK;
+  }
+
+  rtc_history.events[(rtc_history.head + rtc_history.count) % size] = event;
+  rtc_history.count++;
+}
+
+// Reads into `page` the events from `from` to `to`, starting with sequence
+// number `start_seq`. Events from before time synced are only read when
+// `from` is 0. Only a page of events is read at a time, and page->next_seq
+// says where the next page starts. The history is copied first, like Save
+// does, so the walk doesn't hold the spinlock.
+void IndySwitchHistory::Read(time_t from, time_t to, uint32_t start_seq, IndySwitchEventPage* page) {
+  page->count = 0;
+  page->next_seq = 0;
+  std::unique_ptr<Data> copy = std::make_unique<Data>();
+  portENTER_CRITICAL(&spinlock);
+  *copy = rtc_history;
+  portEXIT_CRITICAL(&spinlock);
+
+  // Walk from the oldest event, adding up the time
+  size_t size = copy->events.size();
+  int64_t event_time = copy->first_time;
+  for (uint32_t ii = 0; ii < copy->count; ii++) {
+    uint32_t event = copy->events[(copy->head + ii) % size];
+    if (ii > 0)
+      event_time += event & DELTA_MASK;
+
+    // Is the event wanted?
+    uint32_t seq = copy->first_seq + ii;
+    IndySwitchSource source = static_cast<IndySwitchSource>((event >> SOURCE_SHIFT) & SOURCE_MASK);
+    bool time_synced = (event & UNSYNCED_BIT) == 0;
+    if (seq < start_seq || source == IndySwitchSource::GAP)
+      continue;
+    if (time_synced ? event_time < from || event_time > to : from != 0)
+      continue;
+
+    // Add it to the page, or stop if the page is full
+    if (page->count == IndySwitchEventPage::EVENTS_MAX) {
+      page->next_seq = seq;
+      break;
+    }
+    IndySwitchEvent& result = page->events[page->count++];
+    result.seq = seq;
+    result.time = time_synced ? (time_t) event_time : NULL_TIME;
+    result.channel = (int) (event >> CHANNEL_SHIFT);
+    result.on = (event & ON_BIT) != 0;
+    result.source = source;
+  }
+}
+
+// Saves the history to NVS, so it survives power loss. The history is copied
+// first, so events can be added while flash is written.
+void IndySwitchHistory::Save(IndyNvs* nvs) {
+  std::unique_ptr<Data> copy = std::make_unique<Data>();
+  portENTER_CRITICAL(&spinlock);
+  bool changed = unsaved;
+  if (changed)
+    *copy = rtc_history;
+  unsaved = false;
+  portEXIT_CRITICAL(&spinlock);
+  if (!changed)
+    return;
+
+  ESP_LOGI(TAG, "Saving %" PRIu32 " events to NVS", copy->count);
+  nvs->WriteBlob(NVS_KEY_HISTORY, copy.get(), sizeof(Data));
+  nvs->Commit();
+}
+
+// Erases the history in RTC memory, so the next boot starts a new one
+void IndySwitchHistory::Reset() {
+  portENTER_CRITICAL(&spinlock);
+  rtc_history.magic = 0;
+  portEXIT_CRITICAL(&spinlock);
+}
+
+// Returns `source` as a string
+const char* IndySwitchHistory::SourceAsStr(IndySwitchSource source) {
+  switch (source) {
+    case IndySwitchSource::RESTORE:
+      return "restore";
+    case IndySwitchSource::BUTTON:
+      return "button";
+    case IndySwitchSource::MQTT:
+      return "mqtt";
+    case IndySwitchSource::SCHEDULE:
+      return "schedule";
+    case IndySwitchSource::GAP:
+      return "gap";
+    case IndySwitchSource::PEER:
+      return "peer";
+    default:
+      return "invalid";
+  }
+}
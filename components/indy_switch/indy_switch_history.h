@@ -0,0 +1,81 @@
+#ifndef COMPONENTS_INDY_SWITCH_INDY_SWITCH_HISTORY_H_
+#define COMPONENTS_INDY_SWITCH_INDY_SWITCH_HISTORY_H_
+
+#include <freertos/FreeRTOS.h>
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <type_traits>
+
+#include "indy_config.h"
+#include "indy_nvs.h"
+
+// What changed a switch, recorded with each event in the history
+enum class IndySwitchSource : uint8_t {
+  RESTORE,   // Restored from the journal at boot
+  BUTTON,
+  MQTT,
+  SCHEDULE,  // A scheduled action, or the end of an override
+  GAP,       // Not a change. Carries the time across a gap too long for one event.
+  PEER,      // Following a peer switch on the LAN
+  COUNT
+};
+
+// An event read from the history
+struct IndySwitchEvent {
+  uint32_t seq;     // Sequence number, counting every event ever recorded
+  time_t time;      // NULL_TIME if it happened before time synced
+  int channel;
+  bool on;
+  IndySwitchSource source;
+};
+
+// A page of events read from the history
+struct IndySwitchEventPage {
+  static const int EVENTS_MAX = 32;
+  std::array<IndySwitchEvent, EVENTS_MAX> events;
+  int count = 0;
+  uint32_t next_seq = 0;  // Sequence number to read the next page from, or 0 if there isn't one
+};
+
+// Keeps a history of switch changes in a ring buffer in RTC memory, which
+// survives restarts but not power loss, and saves it to NVS from time to time.
+// Each event is packed into 4 bytes, with the seconds since the event before
+// it, so the history holds INDY_HISTORY_EVENT_COUNT events. When it's full,
+// the oldest events are dropped.
+class IndySwitchHistory {
+ public:
+  // The history as kept in RTC memory and saved to NVS
+  struct Data {
+    uint32_t magic;
+    uint32_t first_seq;   // Sequence number of the oldest event
+    uint32_t head;        // Index of the oldest event
+    uint32_t count;
+    int64_t first_time;   // Time of the oldest event, or 0 if time hasn't synced since
+    int64_t last_time;    // Time of the newest event, or 0 if time hasn't synced since
+    std::array<uint32_t, INDY_HISTORY_EVENT_COUNT> events;
+  };
+  static_assert(std::is_trivially_copyable<Data>::value, "History data is saved to NVS as a blob");
+  static_assert(INDY_CHANNEL_COUNT <= 128, "History events have 7 bits for the channel");
+
+  void Setup(const Data* saved);
+
+  void Add(int channel, bool on, IndySwitchSource source);
+  void Read(time_t from, time_t to, uint32_t start_seq, IndySwitchEventPage* page);
+
+  void Save(IndyNvs* nvs);  // Does nothing if no events were added since the last save
+  void Reset();
+
+  static const char* SourceAsStr(IndySwitchSource source);
+
+ private:
+  void Append(uint32_t delta, int channel, bool on, IndySwitchSource source, bool time_synced);
+
+  // Spinlock guarding the history. Adding an event only takes a moment, so
+  // the button's debounce timer can record presses without blocking.
+  portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+  bool unsaved = false;  // Whether events were added since the history was saved to NVS
+};
+
+#endif  // COMPONENTS_INDY_SWITCH_INDY_SWITCH_HISTORY_H_
@@ -0,0 +1,136 @@
+#include "indy_switch_leaders.h"
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "indy_switch_nvs.h"
+#include "indy_util.h"
+
+namespace {
+  const char *TAG = "indy_switch_leaders";
+
+  // Returns whether `host` can be a hostname: letters, digits and '-'
+  bool IsValidHost(const std::string& host) {
+    if (host.empty())
+      return false;
+    for (char c : host) {
+      if (!isalnum((unsigned char) c) && c != '-')
+        return false;
+    }
+    return true;
+  }
+}
+
+// Creates an IndySwitchLeaders with no channel following a peer
+IndySwitchLeaders::IndySwitchLeaders() {
+  memset(&data, 0, sizeof(data));
+  data.version = VERSION;
+}
+
+// Loads the leaders from `loaded`, which was read from NVS. Returns `false`
+// if they're not valid.
+bool IndySwitchLeaders::Load(const Data& loaded) {
+  if (loaded.version != VERSION) {
+    ESP_LOGE(TAG, "Saved leaders are version %d but expected %d", loaded.version, VERSION);
+    return false;
+  }
+  if (loaded.crc != ComputeCrc(loaded)) {
+    ESP_LOGE(TAG, "Saved leaders are not valid");
+    return false;
+  }
+  portENTER_CRITICAL(&spinlock);
+  data = loaded;
+  for (Data::Entry& entry : data.entries)
+    entry.host[HOST_SIZE - 1] = '\0';
+  portEXIT_CRITICAL(&spinlock);
+  return true;
+}
+
+// Saves the leaders to `nvs`
+void IndySwitchLeaders::Save(IndyNvs* nvs) {
+  portENTER_CRITICAL(&spinlock);
+  data.crc = ComputeCrc(data);
+  Data saved = data;
+  portEXIT_CRITICAL(&spinlock);
+  nvs->WriteBlob(NVS_KEY_LEADERS, &saved, sizeof(saved));
+  nvs->Commit();
+}
+
+// Returns the peer switch followed by each channel that follows one
+std::vector<IndySwitchLeader> IndySwitchLeaders::Get() {
+  portENTER_CRITICAL(&spinlock);
+  Data copy = data;
+  portEXIT_CRITICAL(&spinlock);
+
+  std::vector<IndySwitchLeader> leaders;
+  for (int ii = 0; ii < INDY_CHANNEL_COUNT; ii++) {
+    if (copy.entries[ii].host[0] != '\0')
+      leaders.push_back({ii, std::string(copy.entries[ii].host), copy.entries[ii].channel});
+  }
+  return leaders;
+}
+
+// Replaces the leaders with `leaders`. Channels not in `leaders` stop
+// following. Returns an error message, and leaves the leaders unchanged, if
+// any of them can't be used.
+std::string IndySwitchLeaders::Set(const std::vector<IndySwitchLeader>& leaders) {
+  Data::Entry entries[INDY_CHANNEL_COUNT];
+  memset(entries, 0, sizeof(entries));
+  for (const IndySwitchLeader& leader : leaders) {
+    if (leader.channel < 0 || leader.channel >= INDY_CHANNEL_COUNT)
+      return FormatString("Channel %d can't follow a peer, since channels are 0 to %d", leader.channel,
+        INDY_CHANNEL_COUNT - 1);
+    if (!IsValidHost(leader.host))
+      return FormatString("Peer host '%s' can only have letters, digits and '-'", leader.host.c_str());
+    if (leader.host.length() >= HOST_SIZE)
+      return FormatString("Peer host '%s' is longer than %d characters", leader.host.c_str(), HOST_SIZE - 1);
+    if (leader.leader_channel < 0 || leader.leader_channel > UINT8_MAX)
+      return FormatString("Peer channel %d is not valid", leader.leader_channel);
+    Data::Entry& entry = entries[leader.channel];
+    if (entry.host[0] != '\0')
+      return FormatString("Channel %d is given more than once", leader.channel);
+    memcpy(entry.host, leader.host.c_str(), leader.host.length());
+    entry.channel = (uint8_t) leader.leader_channel;
+  }
+
+  portENTER_CRITICAL(&spinlock);
+  memcpy(data.entries, entries, sizeof(entries));
+  portEXIT_CRITICAL(&spinlock);
+  return "";
+}
+
+// Returns whether `channel` follows switch `leader_channel` of peer `host`
+bool IndySwitchLeaders::IsLeader(int channel, const char* host, int leader_channel) {
+  portENTER_CRITICAL(&spinlock);
+  const Data::Entry& entry = data.entries[channel];
+  bool is_leader = entry.host[0] != '\0' && entry.channel == leader_channel && strcmp(entry.host, host) == 0;
+  portEXIT_CRITICAL(&spinlock);
+  return is_leader;
+}
+
+// Parses `value`, a peer switch given as "host:channel", into the host and
+// leader channel of `leader`. Returns an error message if it can't be parsed.
+std::string IndySwitchLeaders::Parse(const std::string& value, IndySwitchLeader* leader) {
+  size_t colon = value.rfind(':');
+  if (colon == std::string::npos || colon + 1 == value.length())
+    return FormatString("Peer switch '%s' should be given as host:channel", value.c_str());
+  const char* channel_str = value.c_str() + colon + 1;
+  char* end;
+  long channel = strtol(channel_str, &end, 10);
+  if (*end != '\0' || !isdigit((unsigned char) *channel_str))
+    return FormatString("Peer switch '%s' should be given as host:channel", value.c_str());
+  leader->host = value.substr(0, colon);
+  leader->leader_channel = channel > INT32_MAX ? -1 : (int) channel;
+  return "";
+}
+
+// Returns the CRC of `data`, computed over every field but the CRC itself
+uint32_t IndySwitchLeaders::ComputeCrc(const Data& data) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&data), offsetof(Data, crc));
+}
@@ -0,0 +1,65 @@
+#ifndef COMPONENTS_INDY_SWITCH_INDY_SWITCH_LEADERS_H_
+#define COMPONENTS_INDY_SWITCH_INDY_SWITCH_LEADERS_H_
+
+#include <freertos/FreeRTOS.h>
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "indy_config.h"
+#include "indy_nvs.h"
+
+// A switch on a peer that a local channel follows
+struct IndySwitchLeader {
+  int channel;       // Local channel that follows
+  std::string host;  // Hostname of the peer
+  int leader_channel;
+};
+
+// Holds the peer switch that each channel follows, if any, which is saved to
+// NVS. A channel that follows a peer switch is turned on and off when the
+// peer's is, as soon as the peer's datagram arrives.
+class IndySwitchLeaders {
+ public:
+  static const size_t HOST_SIZE = 32;
+
+  // The leaders as stored in NVS
+  struct Data {
+    uint8_t version;
+    uint8_t reserved[3];
+    struct Entry {
+      char host[HOST_SIZE];         // Null terminated. Empty if the channel doesn't follow a peer.
+      uint8_t channel;
+      uint8_t reserved[3];
+    } entries[INDY_CHANNEL_COUNT];
+    uint32_t crc;                   // CRC32 of the fields above
+  };
+  static_assert(std::is_trivially_copyable<Data>::value, "Leaders are saved to NVS as a blob");
+
+  IndySwitchLeaders();
+
+  bool Load(const Data& loaded);
+  void Save(IndyNvs* nvs);
+
+  std::vector<IndySwitchLeader> Get();
+  std::string Set(const std::vector<IndySwitchLeader>& leaders);
+
+  bool IsLeader(int channel, const char* host, int leader_channel);
+
+  static std::string Parse(const std::string& value, IndySwitchLeader* leader);
+
+ private:
+  static const uint8_t VERSION = 1;
+
+  Data data;
+
+  // Spinlock guarding data. Leaders are looked up on the peer receive task,
+  // and set on the task handling MQTT messages.
+  portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+  static uint32_t ComputeCrc(const Data& data);
+};
+
+#endif  // COMPONENTS_INDY_SWITCH_INDY_SWITCH_LEADERS_H_
@@ -0,0 +1,75 @@
+#ifndef COMPONENTS_INDY_SWITCH_INDY_SWITCH_NVS_H_
+#define COMPONENTS_INDY_SWITCH_INDY_SWITCH_NVS_H_
+
+#include <cstdint>
+#include <ctime>
+
+#include "indy_nvs.h"
+#include "indy_saved_config.h"
+#include "indy_switch_groups.h"
+#include "indy_switch_history.h"
+#include "indy_switch_leaders.h"
+#include "indy_switch_usage.h"
+#include "indy_util.h"
+
+// NVS keys
+constexpr const char* NVS_KEY_CONFIG = "config";
+constexpr const char* NVS_KEY_HISTORY = "history";
+constexpr const char* NVS_KEY_USAGE = "usage";
+constexpr const char* NVS_KEY_GROUPS = "groups";
+constexpr const char* NVS_KEY_LEADERS = "leaders";
+
+// NVS keys used by earlier firmware versions. Their values are moved to
+// "config" and the journal the first time they're loaded.
+constexpr const char* NVS_KEY_IS_ON = "is_on";
+constexpr const char* NVS_KEY_NEXT_ACTION = "nxtact";
+constexpr const char* NVS_KEY_NEXT_ACTION_TIME = "nxtact_time";
+constexpr const char* NVS_KEY_CONFIG_TIMEZONE = "timezone";
+constexpr const char* NVS_KEY_CONFIG_RANDOM_OFFSET_RANGE = "offset";
+constexpr const char* NVS_KEY_CONFIG_SUNTIMES = "suntimes";
+
+// Holds the values IndySwitch saves to NVS, which are all loaded at once at
+// boot by IndyNvs::LoadAll
+struct IndySwitchNvsValues {
+  IndySavedConfig::Data config;
+  bool config_found = false;
+  IndySwitchHistory::Data history;
+  bool history_found = false;
+  IndySwitchUsage::Data usage;
+  bool usage_found = false;
+  IndySwitchGroups::Data groups;
+  bool groups_found = false;
+  IndySwitchLeaders::Data leaders;
+  bool leaders_found = false;
+
+  // Values saved by earlier firmware versions
+  bool is_on = false;
+  bool is_on_found = false;
+  int32_t next_action = 0;
+  bool next_action_found = false;
+  time_t next_action_time = NULL_TIME;
+  bool next_action_time_found = false;
+  char timezone[IndySavedConfig::TIMEZONE_SIZE] = "";
+  bool timezone_found = false;
+  int32_t offset = 0;
+  bool offset_found = false;
+  char suntimes[1024] = "";
+  bool suntimes_found = false;
+};
+
+// All keys that IndySwitch saves to NVS, and their types
+constexpr IndyNvsKey NVS_KEYS[] = {
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_CONFIG, IndyNvsType::BLOB, config),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_HISTORY, IndyNvsType::BLOB, history),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_USAGE, IndyNvsType::BLOB, usage),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_GROUPS, IndyNvsType::BLOB, groups),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_LEADERS, IndyNvsType::BLOB, leaders),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_IS_ON, IndyNvsType::BOOL, is_on),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_NEXT_ACTION, IndyNvsType::INT, next_action),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_NEXT_ACTION_TIME, IndyNvsType::TIME, next_action_time),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_CONFIG_TIMEZONE, IndyNvsType::STRING, timezone),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_CONFIG_RANDOM_OFFSET_RANGE, IndyNvsType::INT, offset),
+  INDY_NVS_KEY(IndySwitchNvsValues, NVS_KEY_CONFIG_SUNTIMES, IndyNvsType::STRING, suntimes),
+};
+
+#endif  // COMPONENTS_INDY_SWITCH_INDY_SWITCH_NVS_H_
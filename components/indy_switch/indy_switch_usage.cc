@@ -0,0 +1,175 @@
+#include "indy_switch_usage.h"
+
+#include <esp_log.h>
+
+#include <memory>
+
+#include "indy_switch_nvs.h"
+#include "indy_util.h"
+
+namespace {
+  const char *TAG = "indy_switch_usage";
+
+  const uint32_t USAGE_MAGIC = 0x55534147;
+  const int32_t SECONDS_PER_DAY = 24 * 60 * 60;
+
+  // Returns the days since the epoch of the date `year`-`month`-`day`
+  int32_t DaysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    int32_t year_of_era = year - era * 400;
+    int32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+  }
+}
+
+// Sets up the usage, carrying on from the usage `saved` to NVS if there is one
+void IndySwitchUsage::Setup(const Data* saved) {
+  if (saved != nullptr && saved->magic == USAGE_MAGIC) {
+    data = *saved;
+    ESP_LOGI(TAG, "Loaded usage saved to NVS");
+  }
+  data.magic = USAGE_MAGIC;
+}
+
+// Works out the offset of local time from UTC, for the timezone and daylight
+// saving in effect now. On time up to now is added up at the old offset.
+void IndySwitchUsage::UpdateUtcOffset() {
+  time_t now = time(nullptr);
+  struct tm local;
+  localtime_r(&now, &local);
+  int64_t local_seconds = (int64_t) DaysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday) *
+    SECONDS_PER_DAY + local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+  int32_t offset = (int32_t) (local_seconds - now);
+
+  portENTER_CRITICAL(&spinlock);
+  for (int ii = 0; ii < INDY_CHANNEL_COUNT; ii++)
+    Accrue(ii, now);
+  utc_offset = offset;
+  portEXIT_CRITICAL(&spinlock);
+  ESP_LOGI(TAG, "Local time is %" PRId32 " seconds from UTC", offset);
+}
+
+// Records that `channel` was turned `on` or off. Turning it on is a cycle.
+void IndySwitchUsage::Record(int channel, bool on) {
+  time_t now = time(nullptr);
+  portENTER_CRITICAL(&spinlock);
+  Accrue(channel, now);
+  ChannelState& state = states[channel];
+  if (on && !state.on && now >= TIME_SYNCED_MIN) {
+    GetDay(channel, (now + utc_offset) / SECONDS_PER_DAY).cycles++;
+    unsaved = true;
+  }
+  state.on = on;
+  portEXIT_CRITICAL(&spinlock);
+}
+
+// Sets whether `channel` is on as it was restored at boot, with its on time
+// counted from now. Isn't a cycle, since system time survives a restart and
+// the relay was on before it.
+void IndySwitchUsage::Restore(int channel, bool on) {
+  time_t now = time(nullptr);
+  portENTER_CRITICAL(&spinlock);
+  ChannelState& state = states[channel];
+  state.on = on;
+  state.accrued_time = now >= TIME_SYNCED_MIN ? now : 0;
+  portEXIT_CRITICAL(&spinlock);
+}
+
+// Adds the time `channel` has been on since it was last added up to the days
+// it was on in, up to `now`. Caller must hold the spinlock.
+void IndySwitchUsage::Accrue(int channel, time_t now) {
+  ChannelState& state = states[channel];
+  if (now < TIME_SYNCED_MIN) {
+    state.accrued_time = 0;
+    return;
+  }
+
+  // Split the on time at local midnights. Only the last DAYS days are kept, so
+  // a longer time is cut short.
+  time_t start = state.accrued_time;
+  if (state.on && start != 0 && now > start) {
+    if (now - start > DAYS * SECONDS_PER_DAY)
+      start = now - DAYS * SECONDS_PER_DAY;
+    while (start < now) {
+      int32_t day = (start + utc_offset) / SECONDS_PER_DAY;
+      time_t day_end_time = (time_t) (day + 1) * SECONDS_PER_DAY - utc_offset;
+      time_t end = day_end_time < now ? day_end_time : now;
+      GetDay(channel, day).on_seconds += end - start;
+      start = end;
+    }
+    unsaved = true;
+  }
+  state.accrued_time = now;
+}
+
+// Returns the bucket of `day` for `channel`, emptying it first if it was
+// last used for a day DAYS or more before. Caller must hold the spinlock.
+IndySwitchUsageDay& IndySwitchUsage::GetDay(int channel, int32_t day) {
+  IndySwitchUsageDay& bucket = data.days[channel][day % DAYS];
+  if (bucket.day != day) {
+    bucket.day = (uint16_t) day;
+    bucket.cycles = 0;
+    bucket.on_seconds = 0;
+  }
+  return bucket;
+}
+
+// Saves the usage to NVS, with on time added up to now
+void IndySwitchUsage::Save(IndyNvs* nvs) {
+  time_t now = time(nullptr);
+  std::unique_ptr<Data> copy = std::make_unique<Data>();
+  portENTER_CRITICAL(&spinlock);
+  for (int ii = 0; ii < INDY_CHANNEL_COUNT; ii++)
+    Accrue(ii, now);
+  bool changed = unsaved;
+  if (changed)
+    *copy = data;
+  unsaved = false;
+  portEXIT_CRITICAL(&spinlock);
+  if (!changed)
+    return;
+
+  ESP_LOGI(TAG, "Saving usage to NVS");
+  nvs->WriteBlob(NVS_KEY_USAGE, copy.get(), sizeof(Data));
+  nvs->Commit();
+}
+
+// Returns JSON with the usage of `channel` for each of the last DAYS days,
+// oldest first and ending today, as arrays of on seconds and cycles. Empty
+// until time has synced.
+cJSON* IndySwitchUsage::CreateJson(int channel) {
+  cJSON *json = cJSON_CreateObject();
+  time_t now = time(nullptr);
+  if (now < TIME_SYNCED_MIN)
+    return json;
+
+  std::array<IndySwitchUsageDay, DAYS> days;
+  portENTER_CRITICAL(&spinlock);
+  Accrue(channel, now);
+  int32_t today = (now + utc_offset) / SECONDS_PER_DAY;
+  days = data.days[channel];
+  portEXIT_CRITICAL(&spinlock);
+
+  // The first day's date. Local days since the epoch are formatted as UTC
+  // days, so there's no offset to apply.
+  int32_t first_day = today - DAYS + 1;
+  time_t first_day_time = (time_t) first_day * SECONDS_PER_DAY;
+  struct tm first_day_tm;
+  gmtime_r(&first_day_time, &first_day_tm);
+  char date[16];
+  strftime(date, sizeof(date), "%Y-%m-%d", &first_day_tm);
+  cJSON_AddStringToObject(json, "first_day", date);
+
+  // Buckets that weren't used for their day count as 0
+  cJSON *on_seconds_json = cJSON_AddArrayToObject(json, "on_seconds");
+  cJSON *cycles_json = cJSON_AddArrayToObject(json, "cycles");
+  for (int32_t day = first_day; day <= today; day++) {
+    const IndySwitchUsageDay& bucket = days[day % DAYS];
+    bool used = bucket.day == day;
+    cJSON_AddItemToArray(on_seconds_json, cJSON_CreateNumber(used ? bucket.on_seconds : 0));
+    cJSON_AddItemToArray(cycles_json, cJSON_CreateNumber(used ? bucket.cycles : 0));
+  }
+  return json;
+}
@@ -0,0 +1,71 @@
+#ifndef COMPONENTS_INDY_SWITCH_INDY_SWITCH_USAGE_H_
+#define COMPONENTS_INDY_SWITCH_INDY_SWITCH_USAGE_H_
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <type_traits>
+
+#include "indy_config.h"
+#include "indy_nvs.h"
+
+// How long a switch was on, and how many times it was turned on, in a local day
+struct IndySwitchUsageDay {
+  uint16_t day;          // Days since the epoch, in local time
+  uint16_t cycles;       // Times turned on
+  uint32_t on_seconds;
+};
+
+// Adds up how long each switch is on, and how many times it's turned on, for
+// each of the last DAYS local days. Each change of a switch costs one update
+// to the bucket of the day, which is found from the day number, so there's no
+// searching. The buckets are kept in RAM and saved to NVS from time to time,
+// rather than on every change. Time before time synced isn't counted.
+class IndySwitchUsage {
+ public:
+  static const int DAYS = 30;
+
+  // The buckets as saved to NVS. Day `d` is in bucket `d % DAYS`.
+  struct Data {
+    uint32_t magic;
+    std::array<std::array<IndySwitchUsageDay, DAYS>, INDY_CHANNEL_COUNT> days;
+  };
+  static_assert(std::is_trivially_copyable<Data>::value, "Usage data is saved to NVS as a blob");
+
+  void Setup(const Data* saved);
+  void UpdateUtcOffset();
+
+  void Record(int channel, bool on);
+  void Restore(int channel, bool on);
+
+  void Save(IndyNvs* nvs);  // Does nothing if nothing changed since the last save
+
+  cJSON* CreateJson(int channel);  // Caller owns returned memory
+
+ private:
+  Data data = {};
+  bool unsaved = false;  // Whether buckets changed since they were saved to NVS
+
+  // Whether each switch is on, and when its on time was last added up
+  struct ChannelState {
+    bool on = false;
+    time_t accrued_time = 0;  // 0 if time hasn't synced
+  };
+  std::array<ChannelState, INDY_CHANNEL_COUNT> states;
+
+  // Seconds to add to UTC for local time. Updated when the timezone is set,
+  // and from time to time for daylight saving.
+  int32_t utc_offset = 0;
+
+  void Accrue(int channel, time_t now);
+  IndySwitchUsageDay& GetDay(int channel, int32_t day);
+
+  // Spinlock guarding buckets and channel states. Presses are recorded from
+  // the button's debounce timer, which mustn't block.
+  portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif  // COMPONENTS_INDY_SWITCH_INDY_SWITCH_USAGE_H_
@@ -5,11 +5,20 @@
 
 #include "freertos/portmacro.h"
 #include "indy_switch.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "indy_host_console.h"
+#endif
 
 extern "C" void app_main() {
-  // Create and initialize the switch
-  IndySwitch* indy_switch = new IndySwitch();
-  indy_switch->Setup();
+  // Create and initialize the switch. It's static so it's in .bss, along with
+  // the storage for its FreeRTOS objects.
+  static IndySwitch indy_switch;
+  indy_switch.Setup();
+
+#if CONFIG_IDF_TARGET_LINUX
+  // Take button presses and GPIO event requests from stdin
+  IndyHostConsole::GetInstance().Start();
+#endif
 
   // NO-OP and don't return
   while (1) {
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""Checks peer datagrams over loopback, the way Linux host builds send them.
+
+With no arguments, this is a socket smoke test only: it opens two sockets bound
+to the peer port, sends a datagram from one, and checks that both receive it
+intact. It doesn't run the firmware. Otherwise:
+
+  peer_check.py instances ELF           Runs two instances of the host build
+                                        ELF, as esp-leader and esp-follower,
+                                        presses the leader's button 0 through
+                                        its stdin console, and checks that the
+                                        follower logs the leader's change
+  peer_check.py listen                  Prints each peer datagram received
+  peer_check.py send HOST CHANNEL on|off
+                                        Sends a change as if from switch HOST
+
+The address, port and datagram layout match indy_config.cc and indy_peer.h.
+"""
+
+import os
+import queue
+import random
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+GROUP = "239.255.73.83"
+PORT = 7383
+INTERFACE = "127.0.0.1"
+MAGIC = 0x5049
+VERSION = 1
+SEND_COUNT = 3
+HOST_SIZE = 32
+
+# How long instances get to start, and to pass a change between them, in seconds
+START_TIMEOUT = 10
+CHANGE_TIMEOUT = 5
+
+# magic, version, channel, on, reserved, boot_id, seq, host. Network byte order.
+MESSAGE = struct.Struct("!HBBB3xII%ds" % HOST_SIZE)
+assert MESSAGE.size == 48
+
+
+def open_socket(timeout):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", PORT))
+    membership = socket.inet_aton(GROUP) + socket.inet_aton(INTERFACE)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(INTERFACE))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+    sock.settimeout(timeout)
+    return sock
+
+
+def pack(host, channel, on, boot_id, seq):
+    return MESSAGE.pack(MAGIC, VERSION, channel, 1 if on else 0, boot_id, seq, host.encode()[:HOST_SIZE - 1])
+
+
+def unpack(data):
+    if len(data) != MESSAGE.size:
+        return None
+    magic, version, channel, on, boot_id, seq, host = MESSAGE.unpack(data)
+    if magic != MAGIC or version != VERSION:
+        return None
+    return host.split(b"\0", 1)[0].decode(errors="replace"), channel, on != 0, boot_id, seq
+
+
+def self_test():
+    sender = open_socket(1.0)
+    receiver = open_socket(1.0)
+    sent = ("peer-check", 2, True, random.getrandbits(32), 7)
+    sender.sendto(pack(*sent), (GROUP, PORT))
+    for name, sock in (("sender", sender), ("receiver", receiver)):
+        try:
+            received = unpack(sock.recv(1024))
+        except socket.timeout:
+            sys.exit("FAILED: %s socket received nothing" % name)
+        if received != sent:
+            sys.exit("FAILED: %s socket received %s, expected %s" % (name, received, sent))
+    print("Success! Both sockets received the datagram.")
+
+
+def start_instance(elf, hostname, lines):
+    env = dict(os.environ, INDY_HOSTNAME=hostname)
+    env.pop("INDY_NVS_PATH", None)
+    instance = subprocess.Popen([elf], env=env, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                stderr=subprocess.STDOUT, text=True, bufsize=1)
+
+    def read():
+        for line in instance.stdout:
+            lines.put(line)
+    threading.Thread(target=read, daemon=True).start()
+    return instance
+
+
+def wait_for(lines, text, timeout):
+    end_time = time.monotonic() + timeout
+    while time.monotonic() < end_time:
+        try:
+            line = lines.get(timeout=end_time - time.monotonic())
+        except queue.Empty:
+            break
+        if text in line:
+            return True
+    return False
+
+
+def check_instances(elf):
+    leader_lines = queue.Queue()
+    follower_lines = queue.Queue()
+    follower = start_instance(elf, "esp-follower", follower_lines)
+    leader = start_instance(elf, "esp-leader", leader_lines)
+    try:
+        for name, lines in (("leader", leader_lines), ("follower", follower_lines)):
+            if not wait_for(lines, "Reading commands from stdin", START_TIMEOUT):
+                sys.exit("FAILED: %s didn't start its console" % name)
+        time.sleep(1)  # Let the peer receive tasks start
+        leader.stdin.write("press 0\n")
+        leader.stdin.flush()
+        if not wait_for(follower_lines, "esp-leader turned switch 0", CHANGE_TIMEOUT):
+            sys.exit("FAILED: follower didn't receive the leader's change")
+        print("Success! The follower received the leader's change.")
+    finally:
+        for instance in (leader, follower):
+            instance.kill()
+            instance.wait()
+
+
+def listen():
+    sock = open_socket(None)
+    while True:
+        data = sock.recv(1024)
+        message = unpack(data)
+        if message is None:
+            print("invalid datagram of %d bytes" % len(data))
+        else:
+            host, channel, on, boot_id, seq = message
+            print("%s turned switch %d %s (boot %08x seq %d)" % (host, channel, "on" if on else "off", boot_id, seq))
+
+
+def send(host, channel, on):
+    sock = open_socket(1.0)
+    data = pack(host, channel, on, random.getrandbits(32), 1)
+    for _ in range(SEND_COUNT):
+        sock.sendto(data, (GROUP, PORT))
+
+
+def main(args):
+    if not args:
+        self_test()
+    elif len(args) == 2 and args[0] == "instances":
+        check_instances(args[1])
+    elif args == ["listen"]:
+        listen()
+    elif len(args) == 4 and args[0] == "send" and args[3] in ("on", "off"):
+        send(args[1], int(args[2]), args[3] == "on")
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])